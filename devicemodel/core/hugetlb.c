@@ -36,8 +36,10 @@
 #include <sys/types.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "vmmapi.h"
+#include "atomic.h"
 
 #define HUGETLB_LV1		0
 #define HUGETLB_LV2		1
@@ -58,6 +60,10 @@
 #define SYS_NR_HUGEPAGES  "nr_hugepages"
 #define SYS_FREE_HUGEPAGES  "free_hugepages"
 
+/* unit of work of the threads touching or scrubbing guest memory */
+#define HUGETLB_CHUNK_SIZE	(64 * MB)
+#define HUGETLB_MAX_THREADS	64
+
 /* hugetlb_info record private information for one specific hugetlbfs:
  * - mounted: is hugetlbfs mounted for below mount_path
  * - mount_path: hugetlbfs mount path
@@ -120,6 +126,32 @@ static void *ptr;
 static size_t total_size;
 static int hugetlb_lv_max;
 
+/* threads touching and scrubbing guest memory, see --prefault_threads */
+static int hugetlb_threads = 1;
+
+/*
+ * Guest memory kept mapped over a full reset, see hugetlb_reset_memory():
+ * the VM created next reuses it if it has the same memory size.
+ */
+static bool hugetlb_kept;
+static void *kept_baseaddr;
+static size_t kept_lowmem;
+static size_t kept_highmem;
+
+/*
+ * Touching (so faulting in, which makes the kernel zero the huge pages)
+ * or scrubbing the guest memory, split into chunks handed out to
+ * hugetlb_threads threads.
+ */
+struct hugetlb_work {
+	char *addr[2];		/* lowmem and highmem */
+	size_t len[2];
+	size_t chunk;
+	size_t nchunks[2];
+	size_t next;		/* next chunk to process */
+	bool scrub;
+};
+
 static int open_hugetlbfs(struct vmctx *ctx, int level)
 {
 	char uuid_str[48];
@@ -219,7 +251,7 @@ static int mmap_hugetlbfs(struct vmctx *ctx, int level, size_t len,
 {
 	char *addr;
 	size_t pagesz = 0;
-	int fd, i;
+	int fd;
 
 	if (level >= HUGETLB_LV_MAX) {
 		perror("exceed max hugetlb level");
@@ -234,14 +266,156 @@ static int mmap_hugetlbfs(struct vmctx *ctx, int level, size_t len,
 
 	printf("mmap 0x%lx@%p\n", len, addr);
 
-	/* pre-allocate hugepages by touch them */
+	/* hugepages are pre-allocated by hugetlb_touch_memory() */
 	pagesz = hugetlb_priv[level].pg_size;
 
-	printf("touch %ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
+	printf("%ld pages with pagesz 0x%lx\n", len/pagesz, pagesz);
+
+	return 0;
+}
+
+static void hugetlb_work_chunk(struct hugetlb_work *work, int region,
+		size_t idx)
+{
+	size_t off, len, pagesz, i;
+	char *addr;
+
+	off = idx * work->chunk;
+	len = work->len[region] - off;
+	if (len > work->chunk)
+		len = work->chunk;
+	addr = work->addr[region] + off;
 
-	for (i = 0; i < len/pagesz; i++) {
-		*(volatile char *)addr = *addr;
-		addr += pagesz;
+	if (work->scrub) {
+		bzero(addr, len);
+		return;
+	}
+
+	/* a touch per smallest hugepage, bigger ones are touched repeatedly */
+	pagesz = hugetlb_priv[HUGETLB_LV1].pg_size;
+	for (i = 0; i < len; i += pagesz)
+		*(volatile char *)(addr + i) = *(addr + i);
+}
+
+static void *hugetlb_worker(void *arg)
+{
+	struct hugetlb_work *work = arg;
+	size_t idx;
+
+	for (;;) {
+		idx = atomic_fetch_add(&work->next, 1);
+		if (idx < work->nchunks[0])
+			hugetlb_work_chunk(work, 0, idx);
+		else if (idx < work->nchunks[0] + work->nchunks[1])
+			hugetlb_work_chunk(work, 1, idx - work->nchunks[0]);
+		else
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * Run the work with hugetlb_threads threads, the calling one included.
+ * Faulting in a hugepage zeroes it, so this is mostly bounded by memory
+ * bandwidth, which one SOS core alone is far from saturating.
+ */
+static void hugetlb_run_work(struct hugetlb_work *work)
+{
+	pthread_t tids[HUGETLB_MAX_THREADS];
+	int i, nthreads, started;
+	size_t chunk;
+
+	/* chunks don't split the largest hugepage mapped */
+	chunk = HUGETLB_CHUNK_SIZE;
+	for (i = HUGETLB_LV1; i < hugetlb_lv_max; i++) {
+		if (should_enable_hugetlb_level(i) &&
+				(size_t)hugetlb_priv[i].pg_size > chunk)
+			chunk = hugetlb_priv[i].pg_size;
+	}
+	work->chunk = chunk;
+	for (i = 0; i < 2; i++)
+		work->nchunks[i] = (work->len[i] + chunk - 1) / chunk;
+	work->next = 0;
+
+	nthreads = hugetlb_threads;
+	if (nthreads == 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > HUGETLB_MAX_THREADS)
+		nthreads = HUGETLB_MAX_THREADS;
+
+	for (started = 0; started < nthreads - 1; started++) {
+		if (pthread_create(&tids[started], NULL, hugetlb_worker,
+				work) != 0)
+			break;
+	}
+	hugetlb_worker(work);
+	for (i = 0; i < started; i++)
+		pthread_join(tids[i], NULL);
+}
+
+static void hugetlb_init_work(struct vmctx *ctx, struct hugetlb_work *work,
+		bool scrub)
+{
+	memset(work, 0, sizeof(*work));
+	work->addr[0] = ctx->baseaddr;
+	work->len[0] = ctx->lowmem;
+	work->addr[1] = ctx->baseaddr + 4 * GB;
+	work->len[1] = ctx->highmem;
+	work->scrub = scrub;
+}
+
+/* pre-allocate hugepages by touching them */
+static void hugetlb_touch_memory(struct vmctx *ctx)
+{
+	struct hugetlb_work work;
+
+	hugetlb_init_work(ctx, &work, false);
+	printf("touch guest memory with %d thread(s)\n", hugetlb_threads);
+	hugetlb_run_work(&work);
+}
+
+/*
+ * For security reason, clean the VM's memory region
+ * to avoid secret information leaking in below case:
+ * After a UOS is destroyed, the memory will be reclaimed,
+ * then if the new UOS starts, that memory region may be
+ * allocated the new UOS, the previous UOS sensitive data
+ * may be leaked to the new UOS if the memory is not cleared.
+ */
+void hugetlb_scrub_memory(struct vmctx *ctx)
+{
+	struct hugetlb_work work;
+
+	hugetlb_init_work(ctx, &work, true);
+	hugetlb_run_work(&work);
+}
+
+int hugetlb_parse_threads(const char *opt)
+{
+	char *end;
+	long n;
+
+	n = strtol(opt, &end, 10);
+	if (*opt == '\0' || *end != '\0' || n < 0 || n > HUGETLB_MAX_THREADS)
+		return -1;
+
+	hugetlb_threads = n;
+	return 0;
+}
+
+static int hugetlb_map_ept(struct vmctx *ctx)
+{
+	/* map ept for lowmem*/
+	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
+		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
+		return -1;
+
+	/* map ept for highmem*/
+	if (ctx->highmem > 0) {
+		if (vm_map_memseg_vma(ctx, ctx->highmem, 4 * GB,
+			(uint64_t)(ctx->baseaddr + 4 * GB), PROT_ALL) < 0)
+			return -1;
 	}
 
 	return 0;
@@ -587,11 +761,31 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	size_t lowmem, highmem;
 	bool has_gap;
 
+	/* after a full reset, reuse the memory of the previous VM: it is
+	 * already faulted in, and was scrubbed by hugetlb_reset_memory */
+	if (hugetlb_kept) {
+		hugetlb_kept = false;
+		lowmem = ALIGN_DOWN(ctx->lowmem,
+				hugetlb_priv[HUGETLB_LV1].pg_size);
+		highmem = ALIGN_DOWN(ctx->highmem,
+				hugetlb_priv[HUGETLB_LV1].pg_size);
+		if (lowmem == kept_lowmem && highmem == kept_highmem) {
+			ctx->lowmem = lowmem;
+			ctx->highmem = highmem;
+			ctx->baseaddr = kept_baseaddr;
+			printf("reuse guest memory at baseaddr 0x%p\n",
+				ctx->baseaddr);
+			if (hugetlb_map_ept(ctx) < 0)
+				goto err;
+			return 0;
+		}
+		hugetlb_unsetup_memory(ctx);
+	}
+
 	/* for first time DM start UOS, hugetlbfs is already mounted by
-	 * check_hugetlb_support; but for reboot, here need re-mount
-	 * it as it already be umount by hugetlb_unsetup_memory
-	 * TODO: actually, correct reboot process should not change memory
-	 * layout, the setup_memory should be removed from reboot process
+	 * check_hugetlb_support; but for reboot with a different memory
+	 * size, here need re-mount it as it already be umount by
+	 * hugetlb_unsetup_memory
 	 */
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++)
 		mount_hugetlbfs(level);
@@ -696,17 +890,10 @@ int hugetlb_setup_memory(struct vmctx *ctx)
 	}
 	printf("total_size 0x%lx\n\n", total_size);
 
-	/* map ept for lowmem*/
-	if (vm_map_memseg_vma(ctx, ctx->lowmem, 0,
-		(uint64_t)ctx->baseaddr, PROT_ALL) < 0)
-		goto err;
+	hugetlb_touch_memory(ctx);
 
-	/* map ept for highmem*/
-	if (ctx->highmem > 0) {
-		if (vm_map_memseg_vma(ctx, ctx->highmem, 4 * GB,
-			(uint64_t)(ctx->baseaddr + 4 * GB), PROT_ALL) < 0)
-			goto err;
-	}
+	if (hugetlb_map_ept(ctx) < 0)
+		goto err;
 
 	return 0;
 
@@ -714,6 +901,7 @@ err:
 	if (ptr) {
 		munmap(ptr, total_size);
 		ptr = NULL;
+		total_size = 0;
 	}
 	for (level = HUGETLB_LV1; level < hugetlb_lv_max; level++) {
 		close_hugetlbfs(level);
@@ -722,10 +910,25 @@ err:
 	return -ENOMEM;
 }
 
+/*
+ * Scrub the memory of a VM being destroyed for a full reset, but keep it
+ * mapped and populated for the VM created next.
+ */
+void hugetlb_reset_memory(struct vmctx *ctx)
+{
+	hugetlb_scrub_memory(ctx);
+
+	kept_baseaddr = ctx->baseaddr;
+	kept_lowmem = ctx->lowmem;
+	kept_highmem = ctx->highmem;
+	hugetlb_kept = true;
+}
+
 void hugetlb_unsetup_memory(struct vmctx *ctx)
 {
 	int level;
 
+	hugetlb_kept = false;
 	if (total_size > 0) {
 		munmap(ptr, total_size);
 		total_size = 0;
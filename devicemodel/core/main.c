@@ -87,6 +87,7 @@ char *kernel_file_name;
 char *elf_file_name;
 uint8_t trusty_enabled;
 bool stdio_in_use;
+bool posted_ioreq_enabled;
 
 static int virtio_msix = 1;
 static bool debugexit_enabled;
@@ -160,8 +161,13 @@ usage(int code)
 		"       --enable_trusty: enable trusty for guest\n"
 		"       --ptdev_no_reset: disable reset check for ptdev\n"
 		"       --debugexit: enable debug exit function\n"
+		"       --virtio_poll: poll virtqueues, interval in ns, backing off per idle queue\n"
 		"       --intr_monitor: enable interrupt storm monitor\n"
 		"       --vtpm2: Virtual TPM2 args: sock_path=$PATH_OF_SWTPM_SOCKET\n"
+		"       --posted_ioreq: do not pause vcpus on virtqueue notify\n"
+		"       --ioreq_workers: handle io requests in one thread per vcpu\n"
+		"       --prefault_threads: threads faulting in and scrubbing guest memory,\n"
+		"                           0 for one per SOS cpu (default 1)\n"
 		"............its params: threshold/s,probe-period(s),delay_time(ms),delay_duration(ms)\n",
 		progname, (int)strlen(progname), "", (int)strlen(progname), "",
 		(int)strlen(progname), "");
@@ -385,9 +391,16 @@ static vmexit_handler_t handler[VM_EXITCODE_MAX] = {
 };
 
 static void
-handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
+handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int slot)
 {
 	enum vm_exitcode exitcode;
+	int vcpu;
+
+	/* A posted request sits in the shared ring rather than in the slot
+	 * of the vcpu issuing it. Its completion is still notified with the
+	 * slot index, which is how the hypervisor releases the slot.
+	 */
+	vcpu = vhm_req->posted ? (int)vhm_req->vcpu : slot;
 
 	exitcode = vhm_req->type;
 	if (exitcode >= VM_EXITCODE_MAX || handler[exitcode] == NULL) {
@@ -410,7 +423,21 @@ handle_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int vcpu)
 		(VM_SUSPEND_SUSPEND == vm_get_suspend_mode()))
 		return;
 
-	vm_notify_request_done(ctx, vcpu);
+	vm_notify_request_done(ctx, slot);
+}
+
+static void
+vm_notify_posted_requests_done(struct vmctx *ctx)
+{
+	int slot;
+	struct vhm_request *vhm_req;
+
+	for (slot = VHM_REQUEST_POSTED_BASE; slot < VHM_REQUEST_MAX; slot++) {
+		vhm_req = &vhm_req_buf[slot];
+		if ((atomic_load(&vhm_req->processed) == REQ_STATE_COMPLETE) &&
+			(vhm_req->client == ctx->ioreq_client))
+			vm_notify_request_done(ctx, slot);
+	}
 }
 
 static int
@@ -549,7 +576,7 @@ vm_system_reset(struct vmctx *ctx)
 	 */
 
 	vm_pause(ctx);
-	for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
 		struct vhm_request *vhm_req;
 
 		vhm_req = &vhm_req_buf[vcpu_id];
@@ -592,6 +619,7 @@ vm_system_reset(struct vmctx *ctx)
 			(vhm_req->client == ctx->ioreq_client))
 			vm_notify_request_done(ctx, vcpu_id);
 	}
+	vm_notify_posted_requests_done(ctx);
 
 	vm_reset_vdevs(ctx);
 	vm_reset(ctx);
@@ -619,7 +647,7 @@ vm_suspend_resume(struct vmctx *ctx)
 	 *   6. hypercall restart vm
 	 */
 	vm_pause(ctx);
-	for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
+	for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
 		struct vhm_request *vhm_req;
 
 		vhm_req = &vhm_req_buf[vcpu_id];
@@ -630,6 +658,7 @@ vm_suspend_resume(struct vmctx *ctx)
 			(vhm_req->client == ctx->ioreq_client))
 			vm_notify_request_done(ctx, vcpu_id);
 	}
+	vm_notify_posted_requests_done(ctx);
 
 	vm_stop_watchdog(ctx);
 	wait_for_resume(ctx);
@@ -644,6 +673,165 @@ vm_suspend_resume(struct vmctx *ctx)
 	vm_run(ctx);
 }
 
+/*
+ * With --ioreq_workers, requests are handled by one worker thread per vcpu
+ * instead of vm_loop itself, so that a slow emulation for one vcpu does not
+ * hold up the requests of the others. Posted requests go to the worker of the
+ * vcpu issuing them. A worker handles one request at a time; vm_loop leaves a
+ * request in PROCESSING state until the worker is free again.
+ */
+#define IOREQ_WORKER_POLL_NS	50000
+
+struct ioreq_worker {
+	pthread_t	thr;
+	pthread_cond_t	cond;
+	struct vmctx	*ctx;
+	int		vcpu;
+	struct vhm_request *req;	/* request being handled, NULL if idle */
+	int		slot;		/* slot of req in vhm_req_buf */
+	bool		exit;
+};
+
+static bool ioreq_workers_enabled;
+static struct ioreq_worker ioreq_workers[VM_MAXCPU];
+static pthread_mutex_t ioreq_worker_mtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ioreq_done_cond = PTHREAD_COND_INITIALIZER;
+static bool ioreq_slot_busy[VHM_REQUEST_MAX];
+static int ioreq_inflight;
+
+static void *
+ioreq_worker_thread(void *param)
+{
+	struct ioreq_worker *worker = param;
+	struct vhm_request *vhm_req;
+	int slot;
+
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	while (1) {
+		while (!worker->req && !worker->exit)
+			pthread_cond_wait(&worker->cond, &ioreq_worker_mtx);
+		if (worker->exit)
+			break;
+
+		vhm_req = worker->req;
+		slot = worker->slot;
+		pthread_mutex_unlock(&ioreq_worker_mtx);
+
+		handle_vmexit(worker->ctx, vhm_req, slot);
+
+		pthread_mutex_lock(&ioreq_worker_mtx);
+		worker->req = NULL;
+		ioreq_slot_busy[slot] = false;
+		ioreq_inflight--;
+		pthread_cond_signal(&ioreq_done_cond);
+	}
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+
+	return NULL;
+}
+
+static int
+ioreq_workers_start(struct vmctx *ctx)
+{
+	char tname[MAXCOMLEN + 1];
+	struct ioreq_worker *worker;
+	int i, error;
+
+	for (i = 0; i < guest_ncpus; i++) {
+		worker = &ioreq_workers[i];
+		worker->ctx = ctx;
+		worker->vcpu = i;
+		worker->req = NULL;
+		worker->exit = false;
+		pthread_cond_init(&worker->cond, NULL);
+
+		error = pthread_create(&worker->thr, NULL,
+			ioreq_worker_thread, worker);
+		if (error) {
+			fprintf(stderr, "failed to create ioreq worker %d\n", i);
+			return error;
+		}
+
+		snprintf(tname, sizeof(tname), "ioreq %d", i);
+		pthread_setname_np(worker->thr, tname);
+	}
+
+	return 0;
+}
+
+static void
+ioreq_workers_stop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	for (i = 0; i < guest_ncpus; i++) {
+		ioreq_workers[i].exit = true;
+		pthread_cond_signal(&ioreq_workers[i].cond);
+	}
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+
+	for (i = 0; i < guest_ncpus; i++) {
+		pthread_join(ioreq_workers[i].thr, NULL);
+		pthread_cond_destroy(&ioreq_workers[i].cond);
+	}
+}
+
+/*
+ * VHM keeps waking vm_loop up as long as any request of the client is not
+ * completed. So while workers are busy, wait until one of them is done, or for
+ * a short while to pick up requests newly assigned to other vcpus. With
+ * @drain set, wait until all the workers are idle.
+ */
+static void
+ioreq_workers_wait(bool drain)
+{
+	struct timespec ts;
+
+	if (!ioreq_workers_enabled)
+		return;
+
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	if (drain) {
+		while (ioreq_inflight > 0)
+			pthread_cond_wait(&ioreq_done_cond, &ioreq_worker_mtx);
+	} else if (ioreq_inflight > 0) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += IOREQ_WORKER_POLL_NS;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&ioreq_done_cond, &ioreq_worker_mtx,
+			&ts);
+	}
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+}
+
+static void
+dispatch_vmexit(struct vmctx *ctx, struct vhm_request *vhm_req, int slot)
+{
+	struct ioreq_worker *worker;
+	int vcpu;
+
+	vcpu = vhm_req->posted ? (int)vhm_req->vcpu : slot;
+	if (!ioreq_workers_enabled || vcpu >= guest_ncpus) {
+		handle_vmexit(ctx, vhm_req, slot);
+		return;
+	}
+
+	worker = &ioreq_workers[vcpu];
+	pthread_mutex_lock(&ioreq_worker_mtx);
+	if (!ioreq_slot_busy[slot] && !worker->req) {
+		ioreq_slot_busy[slot] = true;
+		worker->req = vhm_req;
+		worker->slot = slot;
+		ioreq_inflight++;
+		pthread_cond_signal(&worker->cond);
+	}
+	pthread_mutex_unlock(&ioreq_worker_mtx);
+}
+
 static void
 vm_loop(struct vmctx *ctx)
 {
@@ -652,22 +840,35 @@ vm_loop(struct vmctx *ctx)
 	ctx->ioreq_client = vm_create_ioreq_client(ctx);
 	assert(ctx->ioreq_client > 0);
 
+	if (ioreq_workers_enabled) {
+		error = ioreq_workers_start(ctx);
+		assert(error == 0);
+	}
+
 	error = vm_run(ctx);
 	assert(error == 0);
 
 	while (1) {
-		int vcpu_id;
+		int vcpu_id, slot;
 		struct vhm_request *vhm_req;
 
 		error = vm_attach_ioreq_client(ctx);
 		if (error)
 			break;
 
-		for (vcpu_id = 0; vcpu_id < 4; vcpu_id++) {
+		for (vcpu_id = 0; vcpu_id < guest_ncpus; vcpu_id++) {
 			vhm_req = &vhm_req_buf[vcpu_id];
 			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
 				&& (vhm_req->client == ctx->ioreq_client))
-				handle_vmexit(ctx, vhm_req, vcpu_id);
+				dispatch_vmexit(ctx, vhm_req, vcpu_id);
+		}
+
+		for (slot = VHM_REQUEST_POSTED_BASE; slot < VHM_REQUEST_MAX;
+				slot++) {
+			vhm_req = &vhm_req_buf[slot];
+			if ((atomic_load(&vhm_req->processed) == REQ_STATE_PROCESSING)
+				&& (vhm_req->client == ctx->ioreq_client))
+				dispatch_vmexit(ctx, vhm_req, slot);
 		}
 
 		if (VM_SUSPEND_FULL_RESET == vm_get_suspend_mode() ||
@@ -676,13 +877,20 @@ vm_loop(struct vmctx *ctx)
 		}
 
 		if (VM_SUSPEND_SYSTEM_RESET == vm_get_suspend_mode()) {
+			ioreq_workers_wait(true);
 			vm_system_reset(ctx);
 		}
 
 		if (VM_SUSPEND_SUSPEND == vm_get_suspend_mode()) {
+			ioreq_workers_wait(true);
 			vm_suspend_resume(ctx);
 		}
+
+		ioreq_workers_wait(false);
 	}
+
+	if (ioreq_workers_enabled)
+		ioreq_workers_stop();
 	printf("VM loop exit\n");
 }
 
@@ -691,8 +899,11 @@ num_vcpus_allowed(struct vmctx *ctx)
 {
 	/* TODO: add ioctl to get gerneric information including
 	 * virtual cpus, now hardcode
+	 *
+	 * Only the first VHM_REQUEST_POSTED_BASE slots of the ioreq page are
+	 * dedicated to vcpus.
 	 */
-	return VM_MAXCPU;
+	return MIN(VM_MAXCPU, VHM_REQUEST_POSTED_BASE);
 }
 
 static void
@@ -714,6 +925,9 @@ enum {
 	CMD_OPT_DUMP,
 	CMD_OPT_INTR_MONITOR,
 	CMD_OPT_VTPM2,
+	CMD_OPT_POSTED_IOREQ,
+	CMD_OPT_IOREQ_WORKERS,
+	CMD_OPT_PREFAULT_THREADS,
 };
 
 static struct option long_options[] = {
@@ -750,6 +964,10 @@ static struct option long_options[] = {
 	{"debugexit",		no_argument,		0, CMD_OPT_DEBUGEXIT},
 	{"intr_monitor",	required_argument,	0, CMD_OPT_INTR_MONITOR},
 	{"vtpm2",		required_argument,	0, CMD_OPT_VTPM2},
+	{"posted_ioreq",	no_argument,		0, CMD_OPT_POSTED_IOREQ},
+	{"ioreq_workers",	no_argument,		0, CMD_OPT_IOREQ_WORKERS},
+	{"prefault_threads",	required_argument,	0,
+		CMD_OPT_PREFAULT_THREADS},
 	{0,			0,			0,  0  },
 };
 
@@ -882,6 +1100,19 @@ dm_run(int argc, char *argv[])
 		case CMD_OPT_DEBUGEXIT:
 			debugexit_enabled = true;
 			break;
+		case CMD_OPT_POSTED_IOREQ:
+			posted_ioreq_enabled = true;
+			break;
+		case CMD_OPT_IOREQ_WORKERS:
+			ioreq_workers_enabled = true;
+			break;
+		case CMD_OPT_PREFAULT_THREADS:
+			if (hugetlb_parse_threads(optarg) != 0) {
+				errx(EX_USAGE, "invalid prefault threads %s",
+					optarg);
+				exit(1);
+			}
+			break;
 		case CMD_OPT_VTPM2:
 			if (acrn_parse_vtpm2(optarg) != 0) {
 				errx(EX_USAGE, "invalid vtpm2 param %s", optarg);
@@ -1003,7 +1234,7 @@ dm_run(int argc, char *argv[])
 
 		vm_deinit_vdevs(ctx);
 		mevent_deinit();
-		vm_unsetup_memory(ctx);
+		vm_reset_memory(ctx);
 		vm_destroy(ctx);
 		_ctx = 0;
 
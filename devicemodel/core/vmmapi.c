@@ -202,6 +202,21 @@ vm_notify_request_done(struct vmctx *ctx, int vcpu)
 	return 0;
 }
 
+int
+vm_set_posted_ioreq_range(struct vmctx *ctx, uint32_t type, uint64_t start,
+		uint64_t end, bool assign)
+{
+	struct acrn_posted_ioreq_range range;
+
+	bzero(&range, sizeof(range));
+	range.op = assign ? POSTED_IOREQ_ASSIGN : POSTED_IOREQ_DEASSIGN;
+	range.type = type;
+	range.start = start;
+	range.end = end;
+
+	return ioctl(ctx->fd, IC_SET_POSTED_IOREQ_RANGE, &range);
+}
+
 void
 vm_destroy(struct vmctx *ctx)
 {
@@ -298,23 +313,20 @@ vm_setup_memory(struct vmctx *ctx, size_t memsize)
 void
 vm_unsetup_memory(struct vmctx *ctx)
 {
-	/*
-	 * For security reason, clean the VM's memory region
-	 * to avoid secret information leaking in below case:
-	 * After a UOS is destroyed, the memory will be reclaimed,
-	 * then if the new UOS starts, that memory region may be
-	 * allocated the new UOS, the previous UOS sensitive data
-	 * may be leaked to the new UOS if the memory is not cleared.
-	 *
-	 */
-	bzero((void *)ctx->baseaddr, ctx->lowmem);
-	if (ctx->highmem > 0) {
-		bzero((void *)(ctx->baseaddr + 4 * GB), ctx->highmem);
-	}
-
+	hugetlb_scrub_memory(ctx);
 	hugetlb_unsetup_memory(ctx);
 }
 
+/*
+ * Release the memory of a VM destroyed for a full reset: it is scrubbed,
+ * but stays mapped for the vm_setup_memory() of the VM created next.
+ */
+void
+vm_reset_memory(struct vmctx *ctx)
+{
+	hugetlb_reset_memory(ctx);
+}
+
 /*
  * Returns a non-NULL pointer if [gaddr, gaddr+len) is entirely contained in
  * the lowmem or highmem regions.
@@ -29,8 +29,12 @@
 #include <sys/param.h>
 #include <sys/queue.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 #include <linux/fs.h>
+#include <linux/io_uring.h>
 #include <errno.h>
 #include <assert.h>
 #include <err.h>
@@ -64,6 +68,14 @@
 #define BLOCKIF_NUMTHR	8
 #define BLOCKIF_MAXREQ	(64 + BLOCKIF_NUMTHR)
 
+/*
+ * Size of the io_uring submission queue. It must be a power of 2 and hold
+ * every request slot plus the wakeup NOP posted by blockif_close, so an
+ * sqe is always available once a request slot has been taken.
+ */
+#define BLOCKIF_URING_ENTRIES	128
+#define BLOCKIF_URING_REAP	16
+
 /*
  * Debug printf
  */
@@ -75,7 +87,13 @@ enum blockop {
 	BOP_READ,
 	BOP_WRITE,
 	BOP_FLUSH,
-	BOP_DELETE
+	BOP_DELETE,
+	BOP_ZERO
+};
+
+enum blockengine {
+	BLOCKIF_ENGINE_THREADS,		/* preadv/pwritev on worker threads */
+	BLOCKIF_ENGINE_IO_URING		/* async submission via io_uring */
 };
 
 enum blockstat {
@@ -83,16 +101,40 @@ enum blockstat {
 	BST_BLOCK,
 	BST_PEND,
 	BST_BUSY,
+	BST_SYNC,	/* written, waiting for the group commit */
 	BST_DONE
 };
 
 struct blockif_elem {
 	TAILQ_ENTRY(blockif_elem) link;
+	TAILQ_ENTRY(blockif_elem) sync_link;
 	struct blockif_req  *req;
 	enum blockop	     op;
 	enum blockstat	     status;
 	pthread_t            tid;
 	off_t		     block;
+	int		     err;	/* io_uring: completed before submit */
+};
+
+struct blockif_uring {
+	int			fd;
+	void			*sq_ring;
+	size_t			sq_ring_sz;
+	void			*cq_ring;
+	size_t			cq_ring_sz;
+	struct io_uring_sqe	*sqes;
+	size_t			sqes_sz;
+	unsigned int		*sq_tail;
+	unsigned int		*sq_mask;
+	unsigned int		*sq_array;
+	unsigned int		*cq_head;
+	unsigned int		*cq_tail;
+	unsigned int		*cq_mask;
+	struct io_uring_cqe	*cqes;
+	int			queued;		/* sqes not handed to kernel */
+	int			inflight;	/* request slots in use */
+	pthread_mutex_t		cq_mtx;		/* serializes cq consumers */
+	pthread_t		tid;
 };
 
 struct blockif_ctxt {
@@ -100,6 +142,7 @@ struct blockif_ctxt {
 	int			fd;
 	int			isblk;
 	int			candelete;
+	int			canzero;
 	int			rdonly;
 	off_t			size;
 	int			sub_file_assign;
@@ -109,9 +152,12 @@ struct blockif_ctxt {
 	int			psectsz;
 	int			psectoff;
 	int			closing;
+	int			plugged;
+	enum blockengine	engine;
 	pthread_t		btid[BLOCKIF_NUMTHR];
 	pthread_mutex_t		mtx;
 	pthread_cond_t		cond;
+	struct blockif_uring	uring;
 
 	/* Request elements and free/pending/busy queues */
 	TAILQ_HEAD(, blockif_elem) freeq;
@@ -119,6 +165,10 @@ struct blockif_ctxt {
 	TAILQ_HEAD(, blockif_elem) busyq;
 	struct blockif_elem	reqs[BLOCKIF_MAXREQ];
 
+	/* Write-through writes waiting for the next fdatasync */
+	TAILQ_HEAD(, blockif_elem) syncq;
+	int			syncing;
+
 	/* write cache enable */
 	uint8_t			wce;
 };
@@ -134,20 +184,6 @@ struct blockif_sig_elem {
 
 static struct blockif_sig_elem *blockif_bse_head;
 
-static int
-blockif_flush_cache(struct blockif_ctxt *bc)
-{
-	int err;
-
-	err = 0;
-	assert(bc != NULL);
-	if (!bc->wce) {
-		if (fsync(bc->fd))
-			err = errno;
-	}
-	return err;
-}
-
 static int
 blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
@@ -165,11 +201,14 @@ blockif_enqueue(struct blockif_ctxt *bc, struct blockif_req *breq,
 	switch (op) {
 	case BOP_READ:
 	case BOP_WRITE:
-	case BOP_DELETE:
 		off = breq->offset;
 		for (i = 0; i < breq->iovcnt; i++)
 			off += breq->iov[i].iov_len;
 		break;
+	case BOP_DELETE:
+	case BOP_ZERO:
+		off = breq->offset + breq->resid;
+		break;
 	default:
 		/* off = OFF_MAX; */
 		off = 1 << (sizeof(off_t) - 1);
@@ -218,7 +257,8 @@ blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
 	struct blockif_elem *tbe;
 
-	if (be->status == BST_DONE || be->status == BST_BUSY)
+	if (be->status == BST_DONE || be->status == BST_BUSY ||
+	    be->status == BST_SYNC)
 		TAILQ_REMOVE(&bc->busyq, be, link);
 	else
 		TAILQ_REMOVE(&bc->pendq, be, link);
@@ -232,11 +272,112 @@ blockif_complete(struct blockif_ctxt *bc, struct blockif_elem *be)
 	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
 }
 
+/*
+ * Discard: BLKDISCARD on block devices, hole punching on image files so
+ * the freed range no longer takes host space.
+ */
+static int
+blockif_discard(struct blockif_ctxt *bc, struct blockif_req *br)
+{
+	off_t arg[2];
+	int err;
+
+	err = 0;
+	arg[0] = br->offset + bc->sub_file_start_lba;
+	arg[1] = br->resid;
+	if (!bc->candelete)
+		err = EOPNOTSUPP;
+	else if (bc->rdonly)
+		err = EROFS;
+	else if (bc->isblk) {
+		if (ioctl(bc->fd, BLKDISCARD, arg))
+			err = errno;
+		else
+			br->resid = 0;
+	} else {
+		if (fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE |
+				FALLOC_FL_KEEP_SIZE, arg[0], arg[1]))
+			err = errno;
+		else
+			br->resid = 0;
+	}
+	return err;
+}
+
+/*
+ * Write zeroes without moving any data: BLKZEROOUT on block devices,
+ * zero-range (or a hole where that is not supported) on image files.
+ */
+static int
+blockif_zero(struct blockif_ctxt *bc, struct blockif_req *br)
+{
+	off_t arg[2];
+	int err;
+
+	err = 0;
+	arg[0] = br->offset + bc->sub_file_start_lba;
+	arg[1] = br->resid;
+	if (!bc->canzero)
+		err = EOPNOTSUPP;
+	else if (bc->rdonly)
+		err = EROFS;
+	else if (bc->isblk) {
+		if (ioctl(bc->fd, BLKZEROOUT, arg))
+			err = errno;
+		else
+			br->resid = 0;
+	} else {
+		if (fallocate(bc->fd, FALLOC_FL_ZERO_RANGE |
+				FALLOC_FL_KEEP_SIZE, arg[0], arg[1]) &&
+		    (errno != EOPNOTSUPP ||
+		     fallocate(bc->fd, FALLOC_FL_PUNCH_HOLE |
+				FALLOC_FL_KEEP_SIZE, arg[0], arg[1])))
+			err = errno;
+		else
+			br->resid = 0;
+	}
+	return err;
+}
+
+/*
+ * Check whether discard can be passed down to the backing file. Block
+ * devices report it in sysfs, partitions through their parent disk. For
+ * image files, punching a hole past EOF changes nothing but fails if the
+ * host filesystem has no hole support.
+ */
+static int
+blockif_probe_discard(int fd, const struct stat *sbuf)
+{
+	char path[80];
+	unsigned long long max;
+	FILE *fp;
+
+	if (!S_ISBLK(sbuf->st_mode))
+		return !fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+				sbuf->st_size, DEV_BSIZE);
+
+	snprintf(path, sizeof(path),
+		"/sys/dev/block/%u:%u/queue/discard_max_bytes",
+		major(sbuf->st_rdev), minor(sbuf->st_rdev));
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		snprintf(path, sizeof(path),
+			"/sys/dev/block/%u:%u/../queue/discard_max_bytes",
+			major(sbuf->st_rdev), minor(sbuf->st_rdev));
+		fp = fopen(path, "r");
+	}
+	if (fp == NULL)
+		return 0;
+	if (fscanf(fp, "%llu", &max) != 1)
+		max = 0;
+	fclose(fp);
+	return (max != 0);
+}
+
 static void
 blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 {
 	struct blockif_req *br;
-	off_t arg[2];
 	ssize_t len;
 	int err;
 
@@ -263,7 +404,14 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			err = errno;
 		else {
 			br->resid -= len;
-			err = blockif_flush_cache(bc);
+			/*
+			 * Write-through: the request is completed by
+			 * blockif_group_commit() once it is durable.
+			 */
+			if (!bc->wce) {
+				be->status = BST_SYNC;
+				return;
+			}
 		}
 		break;
 	case BOP_FLUSH:
@@ -271,21 +419,15 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 			err = errno;
 		break;
 	case BOP_DELETE:
-		/* only used by AHCI */
-		if (!bc->candelete)
-			err = EOPNOTSUPP;
-		else if (bc->rdonly)
-			err = EROFS;
-		else if (bc->isblk) {
-			arg[0] = br->offset;
-			arg[1] = br->resid;
-			if (ioctl(bc->fd, BLKDISCARD, arg))
-				err = errno;
-			else
-				br->resid = 0;
+		err = blockif_discard(bc, br);
+		break;
+	case BOP_ZERO:
+		err = blockif_zero(bc, br);
+		/* zeroed ranges are writes, make them durable the same way */
+		if (!err && !bc->wce) {
+			be->status = BST_SYNC;
+			return;
 		}
-		else
-			err = EOPNOTSUPP;
 		break;
 	default:
 		err = EINVAL;
@@ -297,6 +439,48 @@ blockif_proc(struct blockif_ctxt *bc, struct blockif_elem *be)
 	(*br->callback)(br, err);
 }
 
+/*
+ * Write-through group commit, called with bc->mtx held for a request in
+ * BST_SYNC state. The request joins the sync queue; if no other worker is
+ * syncing, this one becomes the leader and keeps issuing one fdatasync()
+ * for everything queued so far until the queue is empty. Writes finished
+ * by other workers while a sync is running are picked up by the next one,
+ * so concurrent guest writes share a single flush and complete together.
+ */
+static void
+blockif_group_commit(struct blockif_ctxt *bc, struct blockif_elem *be)
+{
+	TAILQ_HEAD(, blockif_elem) batch;
+	struct blockif_elem *tbe;
+	int err;
+
+	TAILQ_INSERT_TAIL(&bc->syncq, be, sync_link);
+	if (bc->syncing)
+		return;
+
+	bc->syncing = 1;
+	while (!TAILQ_EMPTY(&bc->syncq)) {
+		TAILQ_INIT(&batch);
+		TAILQ_CONCAT(&batch, &bc->syncq, sync_link);
+		pthread_mutex_unlock(&bc->mtx);
+
+		err = 0;
+		if (fdatasync(bc->fd))
+			err = errno;
+		TAILQ_FOREACH(tbe, &batch, sync_link) {
+			tbe->status = BST_DONE;
+			(*tbe->req->callback)(tbe->req, err);
+		}
+
+		pthread_mutex_lock(&bc->mtx);
+		while ((tbe = TAILQ_FIRST(&batch)) != NULL) {
+			TAILQ_REMOVE(&batch, tbe, sync_link);
+			blockif_complete(bc, tbe);
+		}
+	}
+	bc->syncing = 0;
+}
+
 static void *
 blockif_thr(void *arg)
 {
@@ -314,7 +498,10 @@ blockif_thr(void *arg)
 			pthread_mutex_unlock(&bc->mtx);
 			blockif_proc(bc, be);
 			pthread_mutex_lock(&bc->mtx);
-			blockif_complete(bc, be);
+			if (be->status == BST_SYNC)
+				blockif_group_commit(bc, be);
+			else
+				blockif_complete(bc, be);
 		}
 		/* Check ctxt status here to see if exit requested */
 		if (bc->closing)
@@ -327,6 +514,287 @@ blockif_thr(void *arg)
 	return NULL;
 }
 
+/*
+ * io_uring engine
+ *
+ * Requests are written straight into the submission ring by the caller and
+ * handed to the kernel with one io_uring_enter(), either immediately or,
+ * between blockif_plug() and blockif_unplug(), once for the whole batch.
+ * Completions are reaped by a single thread sleeping in io_uring_enter(),
+ * and opportunistically by blockif_unplug() itself, so requests which the
+ * kernel finishes inline (e.g. page cache hits) complete in the caller's
+ * context. The ring is driven through the raw syscalls, liburing is not
+ * required.
+ */
+static inline int
+blockif_uring_enter(int fd, unsigned int to_submit, unsigned int min_complete,
+		unsigned int flags)
+{
+	return syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+			flags, NULL, 0);
+}
+
+static void
+blockif_uring_deinit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+
+	munmap(ur->sqes, ur->sqes_sz);
+	munmap(ur->cq_ring, ur->cq_ring_sz);
+	munmap(ur->sq_ring, ur->sq_ring_sz);
+	close(ur->fd);
+	pthread_mutex_destroy(&ur->cq_mtx);
+}
+
+static int
+blockif_uring_init(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	ur->fd = syscall(__NR_io_uring_setup, BLOCKIF_URING_ENTRIES, &p);
+	if (ur->fd < 0)
+		return -1;
+
+	ur->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+	ur->cq_ring_sz = p.cq_off.cqes +
+			p.cq_entries * sizeof(struct io_uring_cqe);
+	ur->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+
+	ur->sq_ring = mmap(NULL, ur->sq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQ_RING);
+	if (ur->sq_ring == MAP_FAILED)
+		goto err_sq;
+	ur->cq_ring = mmap(NULL, ur->cq_ring_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_CQ_RING);
+	if (ur->cq_ring == MAP_FAILED)
+		goto err_cq;
+	ur->sqes = mmap(NULL, ur->sqes_sz, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ur->fd, IORING_OFF_SQES);
+	if (ur->sqes == MAP_FAILED)
+		goto err_sqes;
+
+	ur->sq_tail = ur->sq_ring + p.sq_off.tail;
+	ur->sq_mask = ur->sq_ring + p.sq_off.ring_mask;
+	ur->sq_array = ur->sq_ring + p.sq_off.array;
+	ur->cq_head = ur->cq_ring + p.cq_off.head;
+	ur->cq_tail = ur->cq_ring + p.cq_off.tail;
+	ur->cq_mask = ur->cq_ring + p.cq_off.ring_mask;
+	ur->cqes = ur->cq_ring + p.cq_off.cqes;
+	ur->queued = 0;
+	ur->inflight = 0;
+	pthread_mutex_init(&ur->cq_mtx, NULL);
+	return 0;
+
+err_sqes:
+	munmap(ur->cq_ring, ur->cq_ring_sz);
+err_cq:
+	munmap(ur->sq_ring, ur->sq_ring_sz);
+err_sq:
+	close(ur->fd);
+	return -1;
+}
+
+/* Must be called with bc->mtx held */
+static void
+blockif_uring_queue(struct blockif_ctxt *bc, uint8_t opcode,
+		struct blockif_elem *be)
+{
+	struct blockif_uring *ur = &bc->uring;
+	struct io_uring_sqe *sqe;
+	struct blockif_req *br;
+	unsigned int tail, idx;
+
+	tail = *ur->sq_tail;
+	idx = tail & *ur->sq_mask;
+	sqe = &ur->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = bc->fd;
+	sqe->user_data = (uintptr_t)be;
+	if (opcode == IORING_OP_FSYNC && be != NULL && be->op == BOP_ZERO)
+		sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+	if (opcode == IORING_OP_READV || opcode == IORING_OP_WRITEV) {
+		br = be->req;
+		sqe->addr = (uintptr_t)br->iov;
+		sqe->len = br->iovcnt;
+		sqe->off = br->offset + bc->sub_file_start_lba;
+		/* per-write O_DSYNC replaces the fsync of blockif_flush_cache */
+		if (opcode == IORING_OP_WRITEV && !bc->wce)
+			sqe->rw_flags = RWF_DSYNC;
+	}
+	ur->sq_array[idx] = idx;
+	__atomic_store_n(ur->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ur->queued++;
+}
+
+/* Must be called with bc->mtx held */
+static void
+blockif_uring_submit(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+	int ret;
+
+	while (ur->queued > 0) {
+		ret = blockif_uring_enter(ur->fd, ur->queued, 0, 0);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			WPRINTF(("blockif: io_uring submit failed, errno %d\n",
+				errno));
+			break;
+		}
+		ur->queued -= ret;
+	}
+}
+
+static void
+blockif_uring_complete(struct blockif_ctxt *bc, const struct io_uring_cqe *cqe)
+{
+	struct blockif_elem *be;
+	struct blockif_req *br;
+	int err;
+
+	be = (struct blockif_elem *)(uintptr_t)cqe->user_data;
+	if (be == NULL)		/* wakeup posted by blockif_close */
+		return;
+
+	br = be->req;
+	err = be->err;
+	if (err == 0) {
+		if (cqe->res < 0)
+			err = -cqe->res;
+		else if (be->op == BOP_READ || be->op == BOP_WRITE)
+			br->resid -= cqe->res;
+	}
+	be->status = BST_DONE;
+
+	(*br->callback)(br, err);
+
+	pthread_mutex_lock(&bc->mtx);
+	be->status = BST_FREE;
+	be->req = NULL;
+	TAILQ_INSERT_TAIL(&bc->freeq, be, link);
+	bc->uring.inflight--;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+/*
+ * Consume up to BLOCKIF_URING_REAP completions and run their callbacks
+ * without holding any blockif lock. Returns the number reaped.
+ */
+static int
+blockif_uring_reap(struct blockif_ctxt *bc)
+{
+	struct blockif_uring *ur = &bc->uring;
+	struct io_uring_cqe cqes[BLOCKIF_URING_REAP];
+	unsigned int head, tail;
+	int i, n;
+
+	pthread_mutex_lock(&ur->cq_mtx);
+	head = *ur->cq_head;
+	tail = __atomic_load_n(ur->cq_tail, __ATOMIC_ACQUIRE);
+	for (n = 0; head != tail && n < BLOCKIF_URING_REAP; n++, head++)
+		cqes[n] = ur->cqes[head & *ur->cq_mask];
+	__atomic_store_n(ur->cq_head, head, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&ur->cq_mtx);
+
+	for (i = 0; i < n; i++)
+		blockif_uring_complete(bc, &cqes[i]);
+	return n;
+}
+
+static void *
+blockif_uring_thr(void *arg)
+{
+	struct blockif_ctxt *bc;
+	int done;
+
+	bc = arg;
+
+	for (;;) {
+		if (blockif_uring_enter(bc->uring.fd, 0, 1,
+				IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+			WPRINTF(("blockif: io_uring wait failed, errno %d\n",
+				errno));
+			break;
+		}
+		while (blockif_uring_reap(bc) > 0)
+			;
+
+		pthread_mutex_lock(&bc->mtx);
+		done = bc->closing && (bc->uring.inflight == 0);
+		pthread_mutex_unlock(&bc->mtx);
+		if (done)
+			break;
+	}
+
+	pthread_exit(NULL);
+	return NULL;
+}
+
+static int
+blockif_uring_request(struct blockif_ctxt *bc, struct blockif_req *breq,
+		enum blockop op)
+{
+	struct blockif_elem *be;
+	uint8_t opcode;
+
+	pthread_mutex_lock(&bc->mtx);
+	be = TAILQ_FIRST(&bc->freeq);
+	if (be == NULL) {
+		/* Same queue limit as the worker thread engine */
+		pthread_mutex_unlock(&bc->mtx);
+		return E2BIG;
+	}
+	TAILQ_REMOVE(&bc->freeq, be, link);
+	be->req = breq;
+	be->op = op;
+	be->status = BST_BUSY;
+	be->err = 0;
+	bc->uring.inflight++;
+
+	switch (op) {
+	case BOP_READ:
+		opcode = IORING_OP_READV;
+		break;
+	case BOP_WRITE:
+		opcode = IORING_OP_WRITEV;
+		if (bc->rdonly) {
+			be->err = EROFS;
+			opcode = IORING_OP_NOP;
+		}
+		break;
+	case BOP_FLUSH:
+		opcode = IORING_OP_FSYNC;
+		break;
+	case BOP_ZERO:
+		/*
+		 * Zeroing has no vectored io_uring opcode; do it inline and
+		 * complete through a data sync in write-through mode.
+		 */
+		be->err = blockif_zero(bc, breq);
+		opcode = (be->err == 0 && !bc->wce) ?
+			IORING_OP_FSYNC : IORING_OP_NOP;
+		break;
+	default:
+		/*
+		 * Discard has no io_uring opcode; do it inline and let a NOP
+		 * deliver the completion through the normal callback path.
+		 */
+		be->err = blockif_discard(bc, breq);
+		opcode = IORING_OP_NOP;
+		break;
+	}
+	blockif_uring_queue(bc, opcode, be);
+	if (!bc->plugged)
+		blockif_uring_submit(bc);
+	pthread_mutex_unlock(&bc->mtx);
+
+	return 0;
+}
+
 static void
 blockif_sigcont_handler(int signal)
 {
@@ -408,18 +876,67 @@ sub_file_unlock(struct blockif_ctxt *bc)
 }
 
 
+/*
+ * Set up the request queues of a context and start its engine. Falls back
+ * to worker threads if io_uring was requested but cannot be set up.
+ */
+static void
+blockif_start(struct blockif_ctxt *bc, const char *ident)
+{
+	char tname[MAXCOMLEN + 1];
+	int i;
+
+	pthread_mutex_init(&bc->mtx, NULL);
+	pthread_cond_init(&bc->cond, NULL);
+	TAILQ_INIT(&bc->freeq);
+	TAILQ_INIT(&bc->pendq);
+	TAILQ_INIT(&bc->busyq);
+	TAILQ_INIT(&bc->syncq);
+	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+		bc->reqs[i].status = BST_FREE;
+		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
+	}
+
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING &&
+	    blockif_uring_init(bc) < 0) {
+		warn("io_uring unavailable for blk-%s, using worker threads",
+			ident);
+		bc->engine = BLOCKIF_ENGINE_THREADS;
+	}
+
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-cq",
+					ident) >= sizeof(tname)) {
+			perror("blk thread name too long");
+		}
+		pthread_create(&bc->uring.tid, NULL, blockif_uring_thr, bc);
+		pthread_setname_np(bc->uring.tid, tname);
+		return;
+	}
+
+	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
+		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
+					ident, i) >= sizeof(tname)) {
+			perror("blk thread name too long");
+		}
+		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
+		pthread_setname_np(bc->btid[i], tname);
+	}
+}
+
 struct blockif_ctxt *
 blockif_open(const char *optstr, const char *ident)
 {
-	char tname[MAXCOMLEN + 1];
 	/* char name[MAXPATHLEN]; */
 	char *nopt, *xopts, *cp;
 	struct blockif_ctxt *bc;
 	struct stat sbuf;
 	/* struct diocgattr_arg arg; */
 	off_t size, psectsz, psectoff;
-	int fd, i, sectsz;
+	int fd, sectsz;
 	int writeback, ro, candelete, ssopt, pssopt;
+	int direct, oflags;
+	enum blockengine engine;
 	long sz;
 	long long b;
 	int err_code = -1;
@@ -435,6 +952,8 @@ blockif_open(const char *optstr, const char *ident)
 	sub_file_assign = 0;
 	sub_file_start_lba = 0;
 	sub_file_size = 0;
+	direct = 0;
+	engine = BLOCKIF_ENGINE_THREADS;
 
 	/* writethru is on by default */
 	writeback = 0;
@@ -458,6 +977,12 @@ blockif_open(const char *optstr, const char *ident)
 			writeback = 0;
 		else if (!strcmp(cp, "ro"))
 			ro = 1;
+		else if (!strcmp(cp, "direct"))
+			direct = 1;
+		else if (!strcmp(cp, "aio=threads"))
+			engine = BLOCKIF_ENGINE_THREADS;
+		else if (!strcmp(cp, "aio=io_uring"))
+			engine = BLOCKIF_ENGINE_IO_URING;
 		else if (!strncmp(cp, "sectorsize", strlen("sectorsize"))) {
 			/*
 			 *  sectorsize=<sector size>
@@ -494,10 +1019,11 @@ blockif_open(const char *optstr, const char *ident)
 	 * operation to emulate it.
 	 */
 
-	fd = open(nopt, ro ? O_RDONLY : O_RDWR);
+	oflags = direct ? O_DIRECT : 0;
+	fd = open(nopt, (ro ? O_RDONLY : O_RDWR) | oflags);
 	if (fd < 0 && !ro) {
 		/* Attempt a r/w fail with a r/o open */
-		fd = open(nopt, O_RDONLY);
+		fd = open(nopt, O_RDONLY | oflags);
 		ro = 1;
 	}
 
@@ -517,7 +1043,7 @@ blockif_open(const char *optstr, const char *ident)
 	size = sbuf.st_size;
 	sectsz = DEV_BSIZE;
 	psectsz = psectoff = 0;
-	candelete = 0;
+	candelete = ro ? 0 : blockif_probe_discard(fd, &sbuf);
 
 	if (S_ISBLK(sbuf.st_mode)) {
 		/* get size */
@@ -613,30 +1139,15 @@ blockif_open(const char *optstr, const char *ident)
 	bc->fd = fd;
 	bc->isblk = S_ISBLK(sbuf.st_mode);
 	bc->candelete = candelete;
+	bc->canzero = ro ? 0 : (S_ISBLK(sbuf.st_mode) || candelete);
 	bc->rdonly = ro;
 	bc->size = size;
 	bc->sectsz = sectsz;
 	bc->psectsz = psectsz;
 	bc->psectoff = psectoff;
 	bc->wce = writeback;
-	pthread_mutex_init(&bc->mtx, NULL);
-	pthread_cond_init(&bc->cond, NULL);
-	TAILQ_INIT(&bc->freeq);
-	TAILQ_INIT(&bc->pendq);
-	TAILQ_INIT(&bc->busyq);
-	for (i = 0; i < BLOCKIF_MAXREQ; i++) {
-		bc->reqs[i].status = BST_FREE;
-		TAILQ_INSERT_HEAD(&bc->freeq, &bc->reqs[i], link);
-	}
-
-	for (i = 0; i < BLOCKIF_NUMTHR; i++) {
-		if (snprintf(tname, sizeof(tname), "blk-%s-%d",
-					ident, i) >= sizeof(tname)) {
-			perror("blk thread name too long");
-		}
-		pthread_create(&bc->btid[i], NULL, blockif_thr, bc);
-		pthread_setname_np(bc->btid[i], tname);
-	}
+	bc->engine = engine;
+	blockif_start(bc, ident);
 
 	return bc;
 err:
@@ -645,12 +1156,59 @@ err:
 	return NULL;
 }
 
+/*
+ * Create another submission lane on the backing file of bc. The new context
+ * shares the file (through a dup'ed descriptor) and all of its settings, but
+ * has its own request slots, lock and engine, so lanes never contend with
+ * each other. The sub file lock stays owned by the original context.
+ */
+struct blockif_ctxt *
+blockif_clone(struct blockif_ctxt *bc, const char *ident)
+{
+	struct blockif_ctxt *nbc;
+
+	assert(bc->magic == BLOCKIF_SIG);
+
+	nbc = calloc(1, sizeof(struct blockif_ctxt));
+	if (nbc == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	nbc->fd = dup(bc->fd);
+	if (nbc->fd < 0) {
+		warn("Could not dup backing file descriptor");
+		free(nbc);
+		return NULL;
+	}
+
+	nbc->magic = BLOCKIF_SIG;
+	nbc->isblk = bc->isblk;
+	nbc->candelete = bc->candelete;
+	nbc->canzero = bc->canzero;
+	nbc->rdonly = bc->rdonly;
+	nbc->size = bc->size;
+	nbc->sub_file_assign = 0;
+	nbc->sub_file_start_lba = bc->sub_file_start_lba;
+	nbc->sectsz = bc->sectsz;
+	nbc->psectsz = bc->psectsz;
+	nbc->psectoff = bc->psectoff;
+	nbc->wce = bc->wce;
+	nbc->engine = bc->engine;
+	blockif_start(nbc, ident);
+
+	return nbc;
+}
+
 static int
 blockif_request(struct blockif_ctxt *bc, struct blockif_req *breq,
 		enum blockop op)
 {
 	int err;
 
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING)
+		return blockif_uring_request(bc, breq, op);
+
 	err = 0;
 
 	pthread_mutex_lock(&bc->mtx);
@@ -703,13 +1261,69 @@ blockif_delete(struct blockif_ctxt *bc, struct blockif_req *breq)
 	return blockif_request(bc, breq, BOP_DELETE);
 }
 
+/*
+ * Requests issued between blockif_plug() and blockif_unplug() are submitted
+ * to the host as one batch. Plugging nests and is a no-op for the worker
+ * thread engine. blockif_unplug() may run completion callbacks in the
+ * caller's context.
+ */
+void
+blockif_plug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	bc->plugged++;
+	pthread_mutex_unlock(&bc->mtx);
+}
+
+void
+blockif_unplug(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+
+	pthread_mutex_lock(&bc->mtx);
+	assert(bc->plugged > 0);
+	bc->plugged--;
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING && bc->plugged == 0)
+		blockif_uring_submit(bc);
+	pthread_mutex_unlock(&bc->mtx);
+
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING) {
+		while (blockif_uring_reap(bc) > 0)
+			;
+	}
+}
+
+int
+blockif_write_zeroes(struct blockif_ctxt *bc, struct blockif_req *breq)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	return blockif_request(bc, breq, BOP_ZERO);
+}
+
 int
 blockif_cancel(struct blockif_ctxt *bc, struct blockif_req *breq)
 {
 	struct blockif_elem *be;
+	int i;
 
 	assert(bc->magic == BLOCKIF_SIG);
 
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING) {
+		/*
+		 * Requests are owned by the kernel once queued, so they are
+		 * never pulled back; report busy and let the callback run.
+		 */
+		pthread_mutex_lock(&bc->mtx);
+		for (i = 0; i < BLOCKIF_MAXREQ; i++) {
+			if (bc->reqs[i].req == breq)
+				break;
+		}
+		pthread_mutex_unlock(&bc->mtx);
+		return (i < BLOCKIF_MAXREQ) ? -EBUSY : -1;
+	}
+
 	pthread_mutex_lock(&bc->mtx);
 	/*
 	 * Check pending requests.
@@ -794,10 +1408,21 @@ blockif_close(struct blockif_ctxt *bc)
 	 */
 	pthread_mutex_lock(&bc->mtx);
 	bc->closing = 1;
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING) {
+		/* Post a NOP so the completion thread sees the flag */
+		blockif_uring_queue(bc, IORING_OP_NOP, NULL);
+		blockif_uring_submit(bc);
+	}
 	pthread_mutex_unlock(&bc->mtx);
-	pthread_cond_broadcast(&bc->cond);
-	for (i = 0; i < BLOCKIF_NUMTHR; i++)
-		pthread_join(bc->btid[i], &jval);
+
+	if (bc->engine == BLOCKIF_ENGINE_IO_URING) {
+		pthread_join(bc->uring.tid, &jval);
+		blockif_uring_deinit(bc);
+	} else {
+		pthread_cond_broadcast(&bc->cond);
+		for (i = 0; i < BLOCKIF_NUMTHR; i++)
+			pthread_join(bc->btid[i], &jval);
+	}
 
 	/* XXX Cancel queued i/o's ??? */
 
@@ -906,6 +1531,13 @@ blockif_candelete(struct blockif_ctxt *bc)
 	return bc->candelete;
 }
 
+int
+blockif_canzero(struct blockif_ctxt *bc)
+{
+	assert(bc->magic == BLOCKIF_SIG);
+	return bc->canzero;
+}
+
 uint8_t
 blockif_get_wce(struct blockif_ctxt *bc)
 {
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 
 #include "dm.h"
+#include "vmmapi.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "timer.h"
@@ -51,6 +52,15 @@
 static uint8_t virtio_poll_enabled;
 static size_t virtio_poll_interval;
 
+/*
+ * Polling adapts per queue: a queue with new buffers is polled every
+ * virtio_poll_interval, each idle poll doubles its polling period. Once
+ * idle for VIRTIO_POLL_MAX_BACKOFF intervals the queue goes back to guest
+ * notifications, and the next doorbell resumes polling it. The timer
+ * stops while no queue is polled.
+ */
+#define VIRTIO_POLL_MAX_BACKOFF	64
+
 static void
 virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 {
@@ -65,42 +75,147 @@ virtio_start_timer(struct acrn_timer *timer, time_t sec, time_t nsec)
 	assert(acrn_timer_settime(timer, &ts) == 0);
 }
 
+static void
+virtio_vq_notify(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	struct virtio_ops *vops = base->vops;
+
+	if (vq->notify)
+		(*vq->notify)(DEV_STRUCT(base), vq);
+	else if (vops->qnotify)
+		(*vops->qnotify)(DEV_STRUCT(base), vq);
+	else
+		fprintf(stderr,
+			"%s: qnotify queue %d: missing vq/vops notify\r\n",
+			vops->name, vq->num);
+}
+
+/*
+ * Start polling a queue, with guest notifications suppressed.
+ */
+static void
+virtio_poll_start(struct virtio_vq_info *vq)
+{
+	vq->polling = true;
+	vq->poll_backoff = 1;
+	vq->poll_wait = 1;
+	vq->poll_avail = vq->avail->idx;
+	vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+}
+
+/*
+ * Poll a queue that is due. Returns false if the queue went idle and is
+ * back to guest notifications.
+ */
+static bool
+virtio_poll_vq(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (--vq->poll_wait > 0)
+		return true;
+
+	if (vq->avail->idx == vq->poll_avail) {
+		vq->poll_misses++;
+		if (vq->poll_backoff < VIRTIO_POLL_MAX_BACKOFF) {
+			vq->poll_backoff <<= 1;
+			vq->poll_wait = vq->poll_backoff;
+			return true;
+		}
+
+		vq->polling = false;
+		vq_clear_used_ring_flags(base, vq);
+		/* memory barrier */
+		mb();
+		/* the guest may have skipped its kick before that */
+		if (vq->avail->idx == vq->poll_avail)
+			return false;
+		vq->polling = true;
+		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+	}
+
+	vq->poll_hits++;
+	vq->poll_backoff = 1;
+	vq->poll_wait = 1;
+	vq->poll_avail = vq->avail->idx;
+	virtio_vq_notify(base, vq);
+	return true;
+}
+
 static void
 virtio_poll_timer(void *arg)
 {
 	struct virtio_base *base;
-	struct virtio_ops *vops;
 	struct virtio_vq_info *vq;
-	const char *name;
+	bool active = false;
 	int i;
 
 	base = arg;
-	vops = base->vops;
-	name = vops->name;
 
 	if (base->mtx)
 		pthread_mutex_lock(base->mtx);
 
-	base->polling_in_progress = 1;
+	/* the first expiry switches all the ready queues to polling */
+	if (!base->polling_in_progress) {
+		base->polling_in_progress = 1;
+		for (i = 0; i < base->vops->nvq; i++) {
+			vq = &base->queues[i];
+			if (vq_ring_ready(vq))
+				virtio_poll_start(vq);
+		}
+	}
 
 	for (i = 0; i < base->vops->nvq; i++) {
 		vq = &base->queues[i];
-		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-		/* TODO: call notify when necessary */
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			fprintf(stderr,
-				"%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, i);
+		if (vq->polling && vq_ring_ready(vq))
+			active |= virtio_poll_vq(base, vq);
 	}
 
+	base->polling_idle = !active;
+	if (active)
+		virtio_start_timer(&base->polling_timer, 0,
+				   virtio_poll_interval);
+
 	if (base->mtx)
 		pthread_mutex_unlock(base->mtx);
+}
+
+/*
+ * A doorbell on a queue that went back to notifications resumes polling
+ * it, restarting the timer if all the queues were idle.
+ */
+static void
+virtio_poll_doorbell(struct virtio_base *base, struct virtio_vq_info *vq)
+{
+	if (!virtio_poll_enabled || base->backend_type != BACKEND_VBSU ||
+	    !base->polling_in_progress || vq->polling || !vq_ring_ready(vq))
+		return;
 
-	virtio_start_timer(&base->polling_timer, 0, virtio_poll_interval);
+	virtio_poll_start(vq);
+	if (base->polling_idle) {
+		base->polling_idle = false;
+		virtio_start_timer(&base->polling_timer, 0,
+				   virtio_poll_interval);
+	}
+}
+
+/*
+ * Report the poll hits and misses of the polled queues.
+ */
+static void
+virtio_poll_stats(struct virtio_base *base)
+{
+	struct virtio_vq_info *vq;
+	int i;
+
+	for (i = 0; i < base->vops->nvq; i++) {
+		vq = &base->queues[i];
+		if (vq->poll_hits || vq->poll_misses)
+			printf("%s: queue %d polls: %lu hits, %lu misses\n",
+				base->vops->name, i, vq->poll_hits,
+				vq->poll_misses);
+		vq->polling = false;
+		vq->poll_hits = 0;
+		vq->poll_misses = 0;
+	}
 }
 
 /**
@@ -137,6 +252,70 @@ virtio_linkup(struct virtio_base *base, struct virtio_ops *vops,
 	}
 }
 
+/*
+ * Register (or unregister) the queue notify range of a device as posted, so
+ * that the vcpu kicking a virtqueue is not paused until the DM has handled the
+ * notification. Only devices whose notifications are handled in the DM
+ * (BACKEND_VBSU) benefit from this. A failure leaves the device in the
+ * default synchronous mode, which is always correct.
+ */
+static void
+virtio_set_posted_notify(struct virtio_base *base, bool assign)
+{
+	struct pcibar *bar;
+	uint32_t type;
+	uint64_t start, end;
+
+	if (!posted_ioreq_enabled || base->backend_type != BACKEND_VBSU)
+		return;
+
+	if (!assign) {
+		if (base->posted_notify.registered) {
+			vm_set_posted_ioreq_range(base->dev->vmctx,
+				base->posted_notify.type,
+				base->posted_notify.start,
+				base->posted_notify.end, false);
+			base->posted_notify.registered = false;
+		}
+		return;
+	}
+
+	if (base->posted_notify.registered)
+		return;
+
+	if (base->device_caps & ACRN_VIRTIO_F_VERSION_1) {
+		if (base->modern_pio_bar_idx) {
+			bar = &base->dev->bar[base->modern_pio_bar_idx];
+			type = REQ_PORTIO;
+			start = bar->addr;
+			end = start + bar->size;
+		} else if (base->modern_mmio_bar_idx) {
+			bar = &base->dev->bar[base->modern_mmio_bar_idx];
+			type = REQ_MMIO;
+			start = bar->addr + VIRTIO_CAP_NOTIFY_OFFSET;
+			end = start + VIRTIO_CAP_NOTIFY_SIZE;
+		} else
+			return;
+	} else {
+		bar = &base->dev->bar[base->legacy_pio_bar_idx];
+		type = REQ_PORTIO;
+		start = bar->addr + VIRTIO_CR_QNOTIFY;
+		end = start + 2;
+	}
+
+	if (vm_set_posted_ioreq_range(base->dev->vmctx, type, start, end,
+			true) < 0) {
+		fprintf(stderr, "%s: failed to register posted notify range "
+			"0x%lx-0x%lx\r\n", base->vops->name, start, end);
+		return;
+	}
+
+	base->posted_notify.type = type;
+	base->posted_notify.start = start;
+	base->posted_notify.end = end;
+	base->posted_notify.registered = true;
+}
+
 /**
  * @brief Reset device (device-wide).
  *
@@ -161,7 +340,11 @@ virtio_reset_dev(struct virtio_base *base)
 /* assert(pthread_mutex_isowned_np(base->mtx)); */
 
 	acrn_timer_deinit(&base->polling_timer);
+	if (base->polling_in_progress)
+		virtio_poll_stats(base);
 	base->polling_in_progress = 0;
+	base->polling_idle = false;
+	virtio_set_posted_notify(base, false);
 
 	nvq = base->vops->nvq;
 	for (vq = base->queues, i = 0; i < nvq; vq++, i++) {
@@ -650,8 +833,9 @@ void vq_clear_used_ring_flags(struct virtio_base *base, struct virtio_vq_info *v
 	int backend_type = base->backend_type;
 	int polling_in_progress = base->polling_in_progress;
 
-	/* we should never unmask notification in polling mode */
-	if (virtio_poll_enabled && backend_type == BACKEND_VBSU && polling_in_progress == 1)
+	/* we should never unmask notification of a polled queue */
+	if (virtio_poll_enabled && backend_type == BACKEND_VBSU &&
+	    polling_in_progress == 1 && vq->polling)
 		return;
 
 	vq->used->flags &= ~ACRN_VRING_USED_F_NO_NOTIFY;
@@ -949,14 +1133,8 @@ bad:
 			goto done;
 		}
 		vq = &base->queues[value];
-		if (vq->notify)
-			(*vq->notify)(DEV_STRUCT(base), vq);
-		else if (vops->qnotify)
-			(*vops->qnotify)(DEV_STRUCT(base), vq);
-		else
-			fprintf(stderr,
-			    "%s: qnotify queue %d: missing vq/vops notify\r\n",
-				name, (int)value);
+		virtio_poll_doorbell(base, vq);
+		virtio_vq_notify(base, vq);
 		break;
 	case VIRTIO_CR_STATUS:
 		base->status = value;
@@ -964,6 +1142,8 @@ bad:
 			(*vops->set_status)(DEV_STRUCT(base), value);
 		if (value == 0)
 			(*vops->reset)(DEV_STRUCT(base));
+		if (value & VIRTIO_CR_STATUS_DRIVER_OK)
+			virtio_set_posted_notify(base, true);
 		if ((value & VIRTIO_CR_STATUS_DRIVER_OK) &&
 		     base->backend_type == BACKEND_VBSU &&
 		     virtio_poll_enabled) {
@@ -1400,6 +1580,8 @@ virtio_common_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 			(*vops->set_status)(DEV_STRUCT(base), value);
 		if (base->status == 0)
 			(*vops->reset)(DEV_STRUCT(base));
+		if (base->status & VIRTIO_CR_STATUS_DRIVER_OK)
+			virtio_set_posted_notify(base, true);
 		/* TODO: virtio poll mode for modern devices */
 		break;
 	case VIRTIO_COMMON_Q_SELECT:
@@ -1574,14 +1756,8 @@ virtio_notify_cfg_write(struct pci_vdev *dev, uint64_t offset, int size,
 	}
 
 	vq = &base->queues[idx];
-	if (vq->notify)
-		(*vq->notify)(DEV_STRUCT(base), vq);
-	else if (vops->qnotify)
-		(*vops->qnotify)(DEV_STRUCT(base), vq);
-	else
-		fprintf(stderr,
-			"%s: qnotify queue %lu: missing vq/vops notify\r\n",
-			name, idx);
+	virtio_poll_doorbell(base, vq);
+	virtio_vq_notify(base, vq);
 }
 
 static uint32_t
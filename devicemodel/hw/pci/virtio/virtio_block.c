@@ -33,14 +33,17 @@
 #include <string.h>
 #include <assert.h>
 #include <pthread.h>
+#include <unistd.h>
 #include <openssl/md5.h>
 
 #include "dm.h"
 #include "pci_core.h"
 #include "virtio.h"
 #include "block_if.h"
+#include "dm_string.h"
 
 #define VIRTIO_BLK_RINGSZ	64
+#define VIRTIO_BLK_MAX_QUEUES	16
 #define VIRTIO_BLK_MAX_OPTS_LEN	256
 
 #define VIRTIO_BLK_S_OK	0
@@ -57,6 +60,17 @@
 
 /* Device can toggle its cache between writeback and writethrough modes */
 #define	VIRTIO_BLK_F_CONFIG_WCE	(1 << 11)
+#define	VIRTIO_BLK_F_MQ		(1 << 12)	/* Multiple queues */
+#define	VIRTIO_BLK_F_DISCARD	(1 << 13)	/* Discard support */
+#define	VIRTIO_BLK_F_WRITE_ZEROES	(1 << 14)	/* Write zeroes support */
+
+/*
+ * Discard and write zeroes limits, one range per request. The backend
+ * never touches the data path for them, so the size limit is only there
+ * to bound the time a single request can take.
+ */
+#define	VIRTIO_BLK_MAX_DISCARD_SECTORS	(1U << 22)
+#define	VIRTIO_BLK_MAX_DISCARD_SEG	1
 
 /*
  * Basic device capabilities
@@ -94,6 +108,15 @@ struct virtio_blk_config {
 		uint32_t opt_io_size;
 	} topology;
 	uint8_t	writeback;
+	uint8_t	unused;
+	uint16_t num_queues;
+	uint32_t max_discard_sectors;
+	uint32_t max_discard_seg;
+	uint32_t discard_sector_alignment;
+	uint32_t max_write_zeroes_sectors;
+	uint32_t max_write_zeroes_seg;
+	uint8_t write_zeroes_may_unmap;
+	uint8_t unused1[3];
 } __attribute__((packed));
 
 /*
@@ -105,12 +128,24 @@ struct virtio_blk_hdr {
 #define	VBH_OP_FLUSH		4
 #define	VBH_OP_FLUSH_OUT	5
 #define	VBH_OP_IDENT		8
+#define	VBH_OP_DISCARD		11
+#define	VBH_OP_WRITE_ZEROES	13
 #define	VBH_FLAG_BARRIER	0x80000000	/* OR'ed into type */
 	uint32_t type;
 	uint32_t ioprio;
 	uint64_t sector;
 } __attribute__((packed));
 
+/*
+ * Payload of discard and write zeroes requests
+ */
+struct virtio_blk_discard_write_zeroes {
+#define	VBH_DWZ_FLAG_UNMAP	0x1
+	uint64_t sector;
+	uint32_t num_sectors;
+	uint32_t flags;
+} __attribute__((packed));
+
 /*
  * Debug printf
  */
@@ -120,22 +155,43 @@ static int virtio_blk_debug;
 
 struct virtio_blk_ioreq {
 	struct blockif_req req;
-	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
 	uint8_t *status;
 	uint16_t idx;
 };
 
+/*
+ * Per-virtqueue struct. Every queue submits to its own blockif lane and
+ * completes under its own lock. With more than one queue, each queue is
+ * also drained by its own I/O thread so that the notify path only has to
+ * wake it up.
+ */
+struct virtio_blk_queue {
+	struct virtio_blk *blk;
+	struct virtio_vq_info *vq;
+	struct blockif_ctxt *bc;
+	pthread_mutex_t mtx;		/* used ring updates */
+	pthread_cond_t cond;
+	pthread_t tid;
+	int in_progress;
+	volatile int closing;
+	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
+};
+
 /*
  * Per-device struct
  */
 struct virtio_blk {
 	struct virtio_base base;
 	pthread_mutex_t mtx;
-	struct virtio_vq_info vq;
+	struct virtio_ops ops;
+	struct virtio_vq_info vqs[VIRTIO_BLK_MAX_QUEUES];
+	struct virtio_blk_queue queues[VIRTIO_BLK_MAX_QUEUES];
+	int num_queues;
+	volatile int resetting;
 	struct virtio_blk_config cfg;
 	struct blockif_ctxt *bc;
 	char ident[VIRTIO_BLK_BLK_ID_BYTES + 1];
-	struct virtio_blk_ioreq ios[VIRTIO_BLK_RINGSZ];
 	uint8_t original_wce;
 };
 
@@ -146,7 +202,7 @@ static int virtio_blk_cfgwrite(void *, int, int, uint32_t);
 
 static struct virtio_ops virtio_blk_ops = {
 	"virtio_blk",		/* our name */
-	1,			/* we support 1 virtqueue */
+	1,			/* 1 virtqueue unless num_queues */
 	sizeof(struct virtio_blk_config), /* config reg size */
 	virtio_blk_reset,	/* reset */
 	virtio_blk_notify,	/* device-wide qnotify */
@@ -156,21 +212,58 @@ static struct virtio_ops virtio_blk_ops = {
 	NULL,			/* called on guest set status */
 };
 
+static void
+virtio_blk_set_wce(struct virtio_blk *blk, uint8_t wce)
+{
+	int i;
+
+	for (i = 0; i < blk->num_queues; i++)
+		blockif_set_wce(blk->queues[i].bc, wce);
+}
+
+/*
+ * If a queue I/O thread is active then stall until it is done.
+ */
+static void
+virtio_blk_queue_wait(struct virtio_blk_queue *q)
+{
+	pthread_mutex_lock(&q->mtx);
+	while (q->in_progress) {
+		pthread_mutex_unlock(&q->mtx);
+		usleep(10000);
+		pthread_mutex_lock(&q->mtx);
+	}
+	pthread_mutex_unlock(&q->mtx);
+}
+
 static void
 virtio_blk_reset(void *vdev)
 {
 	struct virtio_blk *blk = vdev;
+	int i;
 
 	DPRINTF(("virtio_blk: device reset requested !\n"));
+
+	blk->resetting = 1;
+	for (i = 0; i < blk->num_queues; i++)
+		virtio_blk_queue_wait(&blk->queues[i]);
+
+	/* keep completions off the rings while they are reset */
+	for (i = 0; i < blk->num_queues; i++)
+		pthread_mutex_lock(&blk->queues[i].mtx);
 	virtio_reset_dev(&blk->base);
-	blockif_set_wce(blk->bc, blk->original_wce);
+	for (i = blk->num_queues - 1; i >= 0; i--)
+		pthread_mutex_unlock(&blk->queues[i].mtx);
+
+	virtio_blk_set_wce(blk, blk->original_wce);
+	blk->resetting = 0;
 }
 
 static void
 virtio_blk_done(struct blockif_req *br, int err)
 {
 	struct virtio_blk_ioreq *io = br->param;
-	struct virtio_blk *blk = io->blk;
+	struct virtio_blk_queue *q = io->q;
 
 	if (err)
 		DPRINTF(("virtio_blk: done with error = %d\n\r", err));
@@ -187,16 +280,21 @@ virtio_blk_done(struct blockif_req *br, int err)
 	 * Return the descriptor back to the host.
 	 * We wrote 1 byte (our status) to host.
 	 */
-	pthread_mutex_lock(&blk->mtx);
-	vq_relchain(&blk->vq, io->idx, 1);
-	vq_endchains(&blk->vq, 0);
-	pthread_mutex_unlock(&blk->mtx);
+	pthread_mutex_lock(&q->mtx);
+	if (vq_ring_ready(q->vq)) {
+		vq_relchain(q->vq, io->idx, 1);
+		vq_endchains(q->vq, 0);
+	}
+	pthread_mutex_unlock(&q->mtx);
 }
 
 static void
-virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
+virtio_blk_proc(struct virtio_blk_queue *q)
 {
+	struct virtio_blk *blk = q->blk;
+	struct virtio_vq_info *vq = q->vq;
 	struct virtio_blk_hdr *vbh;
+	struct virtio_blk_discard_write_zeroes *dwz;
 	struct virtio_blk_ioreq *io;
 	int i, n;
 	int err;
@@ -217,7 +315,7 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 */
 	assert(n >= 2 && n <= BLOCKIF_IOV_MAX + 2);
 
-	io = &blk->ios[idx];
+	io = &q->ios[idx];
 	assert((flags[0] & ACRN_VRING_DESC_F_WRITE) == 0);
 	assert(iov[0].iov_len == sizeof(struct virtio_blk_hdr));
 	vbh = iov[0].iov_base;
@@ -234,7 +332,8 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	 * we don't advertise the capability.
 	 */
 	type = vbh->type & ~VBH_FLAG_BARRIER;
-	writeop = (type == VBH_OP_WRITE);
+	writeop = (type == VBH_OP_WRITE || type == VBH_OP_DISCARD ||
+		   type == VBH_OP_WRITE_ZEROES);
 
 	iolen = 0;
 	for (i = 1; i < n; i++) {
@@ -277,11 +376,40 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 		}
 
 		err = ((type == VBH_OP_READ) ? blockif_read : blockif_write)
-				(blk->bc, &io->req);
+				(q->bc, &io->req);
 		break;
 	case VBH_OP_FLUSH:
 	case VBH_OP_FLUSH_OUT:
-		err = blockif_flush(blk->bc, &io->req);
+		err = blockif_flush(q->bc, &io->req);
+		break;
+	case VBH_OP_DISCARD:
+	case VBH_OP_WRITE_ZEROES:
+		/*
+		 * VirtIO v1.1 spec 5.2.6.2:
+		 * - the unmap flag is only defined for write zeroes,
+		 * - a range beyond capacity is an I/O error.
+		 */
+		if (n != 2 || iolen != sizeof(*dwz)) {
+			virtio_blk_done(&io->req, EINVAL);
+			return;
+		}
+		dwz = iov[1].iov_base;
+		if ((dwz->flags & ~VBH_DWZ_FLAG_UNMAP) ||
+		    (type == VBH_OP_DISCARD && dwz->flags)) {
+			virtio_blk_done(&io->req, EOPNOTSUPP);
+			return;
+		}
+		if (dwz->num_sectors > VIRTIO_BLK_MAX_DISCARD_SECTORS ||
+		    dwz->sector > blk->cfg.capacity ||
+		    dwz->sector + dwz->num_sectors > blk->cfg.capacity) {
+			virtio_blk_done(&io->req, EINVAL);
+			return;
+		}
+		io->req.iovcnt = 0;
+		io->req.offset = dwz->sector * DEV_BSIZE;
+		io->req.resid = (ssize_t)dwz->num_sectors * DEV_BSIZE;
+		err = ((type == VBH_OP_DISCARD) ? blockif_delete :
+			blockif_write_zeroes)(q->bc, &io->req);
 		break;
 	case VBH_OP_IDENT:
 		/* Assume a single buffer */
@@ -298,13 +426,111 @@ virtio_blk_proc(struct virtio_blk *blk, struct virtio_vq_info *vq)
 	assert(err == 0);
 }
 
+static void
+virtio_blk_proc_queue(struct virtio_blk_queue *q)
+{
+	/* Hand the whole pass to the backend as one submission batch */
+	blockif_plug(q->bc);
+	while (vq_has_descs(q->vq))
+		virtio_blk_proc(q);
+	blockif_unplug(q->bc);
+}
+
 static void
 virtio_blk_notify(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_blk *blk = vdev;
 
-	while (vq_has_descs(vq))
-		virtio_blk_proc(blk, vq);
+	virtio_blk_proc_queue(&blk->queues[vq->num]);
+}
+
+/*
+ * Per-queue notify in multiqueue mode: wake up the queue I/O thread.
+ */
+static void
+virtio_blk_ping_queue(void *vdev, struct virtio_vq_info *vq)
+{
+	struct virtio_blk *blk = vdev;
+	struct virtio_blk_queue *q = &blk->queues[vq->num];
+
+	if (!vq_has_descs(vq))
+		return;
+
+	pthread_mutex_lock(&q->mtx);
+	if (q->in_progress == 0)
+		pthread_cond_signal(&q->cond);
+	pthread_mutex_unlock(&q->mtx);
+}
+
+/*
+ * Thread which drains one virtqueue in multiqueue mode
+ */
+static void *
+virtio_blk_queue_thread(void *param)
+{
+	struct virtio_blk_queue *q = param;
+	int error;
+
+	pthread_mutex_lock(&q->mtx);
+	for (;;) {
+		/* note - queue mutex is locked here */
+		while (q->blk->resetting || !vq_has_descs(q->vq)) {
+			q->in_progress = 0;
+			if (q->closing) {
+				pthread_mutex_unlock(&q->mtx);
+				return NULL;
+			}
+			error = pthread_cond_wait(&q->cond, &q->mtx);
+			assert(error == 0);
+		}
+		q->in_progress = 1;
+		pthread_mutex_unlock(&q->mtx);
+
+		virtio_blk_proc_queue(q);
+
+		pthread_mutex_lock(&q->mtx);
+	}
+}
+
+/*
+ * Split the virtio-blk specific "num_queues=<n>" option off opts, the
+ * remaining options are left in bopts for blockif_open().
+ */
+static int
+virtio_blk_parse_opts(const char *opts, char *bopts, size_t len,
+		int *num_queues)
+{
+	char *dup, *cp, *xopts;
+	size_t n;
+
+	*num_queues = 1;
+	bopts[0] = '\0';
+	n = 0;
+
+	dup = xopts = strdup(opts);
+	if (!dup)
+		return -1;
+	while ((cp = strsep(&xopts, ",")) != NULL) {
+		if (!strncmp(cp, "num_queues=", strlen("num_queues="))) {
+			if (dm_strtoi(cp + strlen("num_queues="), &cp, 10,
+					num_queues) || *num_queues < 1 ||
+					*num_queues > VIRTIO_BLK_MAX_QUEUES) {
+				WPRINTF(("virtio_blk: num_queues must be 1..%d\n",
+					VIRTIO_BLK_MAX_QUEUES));
+				free(dup);
+				return -1;
+			}
+			continue;
+		}
+		n += snprintf(bopts + n, len - n, "%s%s", n ? "," : "", cp);
+		if (n >= len) {
+			WPRINTF(("virtio_blk: options too long\n"));
+			free(dup);
+			return -1;
+		}
+	}
+	free(dup);
+	return 0;
 }
 
 static uint64_t
@@ -315,6 +541,12 @@ virtio_blk_get_caps(struct virtio_blk *blk, bool wb)
 	caps = VIRTIO_BLK_S_HOSTCAPS;
 	if (wb)
 		caps |= VIRTIO_BLK_F_WB_BITS;
+	if (blk->num_queues > 1)
+		caps |= VIRTIO_BLK_F_MQ;
+	if (blockif_candelete(blk->bc))
+		caps |= VIRTIO_BLK_F_DISCARD;
+	if (blockif_canzero(blk->bc))
+		caps |= VIRTIO_BLK_F_WRITE_ZEROES;
 	return caps;
 }
 
@@ -322,12 +554,14 @@ static int
 virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	char bident[16];
+	char bopts[VIRTIO_BLK_MAX_OPTS_LEN];
 	struct blockif_ctxt *bctxt;
 	MD5_CTX mdctx;
 	u_char digest[16];
 	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
 	off_t size;
-	int i, sectsz, sts, sto;
+	int i, j, sectsz, sts, sto, num_queues;
 	pthread_mutexattr_t attr;
 	int rc;
 
@@ -336,6 +570,9 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		return -1;
 	}
 
+	if (virtio_blk_parse_opts(opts, bopts, sizeof(bopts), &num_queues))
+		return -1;
+
 	/*
 	 * The supplied backing file has to exist
 	 */
@@ -343,7 +580,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 				dev->slot, dev->func) >= sizeof(bident)) {
 		WPRINTF(("bident error, please check slot and func\n"));
 	}
-	bctxt = blockif_open(opts, bident);
+	bctxt = blockif_open(bopts, bident);
 	if (bctxt == NULL) {
 		perror("Could not open backing file");
 		return -1;
@@ -360,14 +597,7 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	}
 
 	blk->bc = bctxt;
-	for (i = 0; i < VIRTIO_BLK_RINGSZ; i++) {
-		struct virtio_blk_ioreq *io = &blk->ios[i];
-
-		io->req.callback = virtio_blk_done;
-		io->req.param = io;
-		io->blk = blk;
-		io->idx = i;
-	}
+	blk->num_queues = num_queues;
 
 	/* init mutex attribute properly to avoid deadlock */
 	rc = pthread_mutexattr_init(&attr);
@@ -384,11 +614,44 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 					"error %d!\n", rc));
 
 	/* init virtio struct and virtqueues */
-	virtio_linkup(&blk->base, &virtio_blk_ops, blk, dev, &blk->vq, BACKEND_VBSU);
+	blk->ops = virtio_blk_ops;
+	blk->ops.nvq = num_queues;
+	virtio_linkup(&blk->base, &blk->ops, blk, dev, blk->vqs, BACKEND_VBSU);
 	blk->base.mtx = &blk->mtx;
 
-	blk->vq.qsize = VIRTIO_BLK_RINGSZ;
-	/* blk->vq.vq_notify = we have no per-queue notify */
+	for (i = 0; i < num_queues; i++) {
+		q = &blk->queues[i];
+		q->blk = blk;
+		q->vq = &blk->vqs[i];
+		q->vq->qsize = VIRTIO_BLK_RINGSZ;
+		/* queue 0 uses blockif context opened above */
+		if (i == 0)
+			q->bc = bctxt;
+		else {
+			if (snprintf(bident, sizeof(bident), "%d:%d.%d",
+				dev->slot, dev->func, i) >= sizeof(bident)) {
+				WPRINTF(("bident error, please check slot and func\n"));
+			}
+			q->bc = blockif_clone(bctxt, bident);
+			if (q->bc == NULL) {
+				for (j = 1; j < i; j++)
+					blockif_close(blk->queues[j].bc);
+				blockif_close(bctxt);
+				free(blk);
+				return -1;
+			}
+		}
+		pthread_mutex_init(&q->mtx, &attr);
+		pthread_cond_init(&q->cond, NULL);
+		for (j = 0; j < VIRTIO_BLK_RINGSZ; j++) {
+			struct virtio_blk_ioreq *io = &q->ios[j];
+
+			io->req.callback = virtio_blk_done;
+			io->req.param = io;
+			io->q = q;
+			io->idx = j;
+		}
+	}
 
 	/*
 	 * Create an identifier for the backing file. Use parts of the
@@ -420,6 +683,13 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	blk->cfg.topology.opt_io_size = 0;
 	blk->cfg.writeback = blockif_get_wce(blk->bc);
 	blk->original_wce = blk->cfg.writeback; /* save for reset */
+	blk->cfg.num_queues = num_queues;
+	blk->cfg.max_discard_sectors = VIRTIO_BLK_MAX_DISCARD_SECTORS;
+	blk->cfg.max_discard_seg = VIRTIO_BLK_MAX_DISCARD_SEG;
+	blk->cfg.discard_sector_alignment = MAX(sts, sectsz) / DEV_BSIZE;
+	blk->cfg.max_write_zeroes_sectors = VIRTIO_BLK_MAX_DISCARD_SECTORS;
+	blk->cfg.max_write_zeroes_seg = VIRTIO_BLK_MAX_DISCARD_SEG;
+	blk->cfg.write_zeroes_may_unmap = 0;
 	blk->base.device_caps =
 		virtio_blk_get_caps(blk, !!blk->cfg.writeback);
 
@@ -435,10 +705,26 @@ virtio_blk_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	if (virtio_interrupt_init(&blk->base, virtio_uses_msix())) {
-		blockif_close(blk->bc);
+		for (i = num_queues - 1; i >= 0; i--)
+			blockif_close(blk->queues[i].bc);
 		free(blk);
 		return -1;
 	}
+
+	/* one I/O thread per queue in multiqueue mode */
+	if (num_queues > 1) {
+		for (i = 0; i < num_queues; i++) {
+			q = &blk->queues[i];
+			q->vq->notify = virtio_blk_ping_queue;
+			pthread_create(&q->tid, NULL, virtio_blk_queue_thread, q);
+			if (snprintf(bident, sizeof(bident), "vtblk-%d:%d-%d",
+				dev->slot, dev->func, i) >= sizeof(bident)) {
+				WPRINTF(("vtblk thread name too long\n"));
+			}
+			pthread_setname_np(q->tid, bident);
+		}
+	}
+
 	virtio_set_io_bar(&blk->base, 0);
 	return 0;
 }
@@ -448,15 +734,30 @@ virtio_blk_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 {
 	struct blockif_ctxt *bctxt;
 	struct virtio_blk *blk;
+	struct virtio_blk_queue *q;
+	void *jval;
+	int i;
 
 	if (dev->arg) {
 		DPRINTF(("virtio_blk: deinit\n"));
 		blk = (struct virtio_blk *) dev->arg;
+		if (blk->num_queues > 1) {
+			for (i = 0; i < blk->num_queues; i++) {
+				q = &blk->queues[i];
+				pthread_mutex_lock(&q->mtx);
+				q->closing = 1;
+				pthread_cond_broadcast(&q->cond);
+				pthread_mutex_unlock(&q->mtx);
+				pthread_join(q->tid, &jval);
+			}
+		}
 		bctxt = blk->bc;
 		if (blockif_flush_all(bctxt))
 			WPRINTF(("vrito_blk:"
 				"Failed to flush before close\n"));
-		blockif_close(bctxt);
+		/* lanes share the backing file, close the clones first */
+		for (i = blk->num_queues - 1; i >= 0; i--)
+			blockif_close(blk->queues[i].bc);
 		free(blk);
 	}
 }
@@ -473,7 +774,7 @@ virtio_blk_cfgwrite(void *vdev, int offset, int size, uint32_t value)
 	if ((offset == offsetof(struct virtio_blk_config, writeback))
 		&& (size == 1)) {
 		memcpy(ptr, &value, size);
-		blockif_set_wce(blk->bc, blkcfg->writeback);
+		virtio_blk_set_wce(blk, blkcfg->writeback);
 		if (blkcfg->writeback)
 			blk->base.device_caps |= VIRTIO_BLK_F_FLUSH;
 		else
@@ -26,6 +26,7 @@
  * $FreeBSD$
  */
 
+#include <sys/param.h>
 #include <sys/uio.h>
 #include <net/ethernet.h>
 #include <fcntl.h>
@@ -50,6 +51,7 @@
 
 #define VIRTIO_NET_RINGSZ	1024
 #define VIRTIO_NET_MAXSEGS	256
+#define VIRTIO_NET_BUDGET	64	/* default chains per batch */
 
 /*
  * Host capabilities.  Note that we only offer a few of these.
@@ -73,6 +75,7 @@
 #define	VIRTIO_NET_F_CTRL_VLAN	(1 << 19) /* control channel VLAN filtering */
 #define	VIRTIO_NET_F_GUEST_ANNOUNCE \
 				(1 << 21) /* guest can send gratuitous pkts */
+#define	VIRTIO_NET_F_MQ		(1 << 22) /* multiple rx/tx queue pairs */
 #define	VHOST_NET_F_VIRTIO_NET_HDR \
 				(1 << 27) /* vhost provides virtio_net_hdr */
 
@@ -80,6 +83,16 @@
 	(VIRTIO_NET_F_MAC | VIRTIO_NET_F_MRG_RXBUF | VIRTIO_NET_F_STATUS | \
 	ACRN_VIRTIO_F_NOTIFY_ON_EMPTY | ACRN_VIRTIO_RING_F_INDIRECT_DESC)
 
+/*
+ * Offloads offered when the tap device passes the virtio-net header
+ * through (IFF_VNET_HDR)
+ */
+#define VIRTIO_NET_S_OFFLOADCAPS      \
+	(VIRTIO_NET_F_CSUM | VIRTIO_NET_F_GUEST_CSUM | \
+	VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6 | \
+	VIRTIO_NET_F_GUEST_ECN | VIRTIO_NET_F_HOST_TSO4 | \
+	VIRTIO_NET_F_HOST_TSO6 | VIRTIO_NET_F_HOST_ECN)
+
 #define VIRTIO_NET_S_VHOSTCAPS      \
 	(ACRN_VIRTIO_F_NOTIFY_ON_EMPTY | ACRN_VIRTIO_RING_F_INDIRECT_DESC | \
 	ACRN_VIRTIO_RING_F_EVENT_IDX | VIRTIO_NET_F_MRG_RXBUF | \
@@ -94,16 +107,48 @@
 struct virtio_net_config {
 	uint8_t  mac[6];
 	uint16_t status;
+	uint16_t max_virtqueue_pairs;
 } __attribute__((packed));
 
 /*
- * Queue definitions.
+ * Queue definitions. Queue pair i uses rx queue 2i and tx queue 2i + 1,
+ * the control queue follows the last pair. It is only present when more
+ * than one pair is configured, in which case it is queue 2 until the
+ * guest negotiates VIRTIO_NET_F_MQ.
  */
 #define VIRTIO_NET_RXQ	0
 #define VIRTIO_NET_TXQ	1
-#define VIRTIO_NET_CTLQ	2	/* NB: not yet supported */
 
-#define VIRTIO_NET_MAXQ	3
+#define VIRTIO_NET_MAX_PAIRS	8
+#define VIRTIO_NET_MAXQ	(VIRTIO_NET_MAX_PAIRS * 2 + 1)
+
+/*
+ * Control queue commands
+ */
+struct virtio_net_ctrl_hdr {
+	uint8_t		class;
+	uint8_t		cmd;
+} __attribute__((packed));
+
+#define VIRTIO_NET_CTRL_MQ			4
+#define VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET		0
+
+#define VIRTIO_NET_OK	0
+#define VIRTIO_NET_ERR	1
+
+#define VIRTIO_NET_CTRL_MAXSEGS	4
+
+/*
+ * Largest frame the guest can be handed: a 64KB GSO frame plus Ethernet
+ * and VLAN headers when guest TSO is negotiated, a full sized Ethernet
+ * frame otherwise.
+ */
+#define VIRTIO_NET_MAX_GSO_FRAME	(65535 + ETHER_HDR_LEN + 4)
+
+/*
+ * Max number of rx descriptor chains merged into one frame
+ */
+#define VIRTIO_NET_RX_MAXCHAINS	64
 
 /*
  * Fixed network header size
@@ -130,42 +175,64 @@ static int virtio_net_debug;
  */
 struct vhost_net {
 	struct vhost_dev vdev;
-	struct vhost_vq vqs[VIRTIO_NET_MAXQ - 1];
+	struct vhost_vq vqs[2];		/* vhost serves a single queue pair */
 	int tapfd;
 	bool vhost_started;
 };
 
+struct virtio_net;
+
 /*
- * Per-device struct
+ * Per queue pair struct, each pair has its own tap queue, rx event
+ * and tx thread.
  */
-struct virtio_net {
-	struct virtio_base base;
-	struct virtio_vq_info queues[VIRTIO_NET_MAXQ - 1];
-	pthread_mutex_t mtx;
-	struct mevent	*mevp;
+struct virtio_net_qp {
+	struct virtio_net	*net;
+	struct virtio_vq_info	*rxq;
+	struct virtio_vq_info	*txq;
 
 	int		tapfd;
+	int		attached;	/* tap queue attached */
+	struct mevent	*mevp;
 
 	int		rx_ready;
+	int		rx_stalled;	/* tap not polled, no rx buffers */
+	pthread_mutex_t	rx_mtx;
+	int		rx_in_progress;
+
+	pthread_t	tx_tid;
+	pthread_mutex_t	tx_mtx;
+	pthread_cond_t	tx_cond;
+	int		tx_in_progress;
+};
+
+/*
+ * Per-device struct
+ */
+struct virtio_net {
+	struct virtio_base base;
+	struct virtio_ops ops;
+	struct virtio_vq_info queues[VIRTIO_NET_MAXQ];
+	struct virtio_net_qp qps[VIRTIO_NET_MAX_PAIRS];
+	int		num_pairs;	/* queue pairs offered */
+	int		curr_pairs;	/* queue pairs enabled by the guest */
+	pthread_mutex_t mtx;
 
 	volatile int	resetting;	/* set and checked outside lock */
-	volatile int	closing;	/* stop the tx i/o thread */
+	volatile int	closing;	/* stop the tx i/o threads */
 
 	uint64_t	features;	/* negotiated features */
 
 	struct virtio_net_config config;
 
-	pthread_mutex_t	rx_mtx;
-	int		rx_in_progress;
 	int		rx_vhdrlen;
 	int		rx_merge;	/* merged rx bufs in use */
-	pthread_t	tx_tid;
-	pthread_mutex_t	tx_mtx;
-	pthread_cond_t	tx_cond;
-	int		tx_in_progress;
+	int		rx_maxlen;	/* largest frame the guest accepts */
+	int		tap_vnethdr;	/* tap carries the virtio-net header */
+	int		budget;		/* chains handled per batch */
 
-	void (*virtio_net_rx)(struct virtio_net *net);
-	void (*virtio_net_tx)(struct virtio_net *net, struct iovec *iov,
+	void (*virtio_net_rx)(struct virtio_net_qp *qp);
+	void (*virtio_net_tx)(struct virtio_net_qp *qp, struct iovec *iov,
 			     int iovcnt, int len);
 
 	struct vhost_net *vhost_net;
@@ -180,6 +247,8 @@ static int virtio_net_cfgwrite(void *vdev, int offset, int size,
 	uint32_t value);
 static void virtio_net_neg_features(void *vdev, uint64_t negotiated_features);
 static void virtio_net_set_status(void *vdev, uint64_t status);
+static void virtio_net_tap_offload(struct virtio_net *net);
+static void virtio_net_set_notify(struct virtio_net *net);
 static struct vhost_net *vhost_net_init(struct virtio_base *base, int vhostfd,
 	int tapfd, int vq_idx);
 static int vhost_net_deinit(struct vhost_net *vhost_net);
@@ -188,7 +257,7 @@ static int vhost_net_stop(struct vhost_net *vhost_net);
 
 static struct virtio_ops virtio_net_ops = {
 	"vtnet",			/* our name */
-	VIRTIO_NET_MAXQ - 1,		/* we currently support 2 virtqueues */
+	2,				/* 2 virtqueues unless num_queues */
 	sizeof(struct virtio_net_config), /* config reg size */
 	virtio_net_reset,		/* reset */
 	NULL,				/* device-wide qnotify -- not used */
@@ -233,36 +302,67 @@ ether_aton(const char *a, struct ether_addr *e)
  * If the transmit thread is active then stall until it is done.
  */
 static void
-virtio_net_txwait(struct virtio_net *net)
+virtio_net_txwait(struct virtio_net_qp *qp)
 {
-	pthread_mutex_lock(&net->tx_mtx);
-	while (net->tx_in_progress) {
-		pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
+	while (qp->tx_in_progress) {
+		pthread_mutex_unlock(&qp->tx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->tx_mtx);
+		pthread_mutex_lock(&qp->tx_mtx);
 	}
-	pthread_mutex_unlock(&net->tx_mtx);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
  * If the receive thread is active then stall until it is done.
  */
 static void
-virtio_net_rxwait(struct virtio_net *net)
+virtio_net_rxwait(struct virtio_net_qp *qp)
 {
-	pthread_mutex_lock(&net->rx_mtx);
-	while (net->rx_in_progress) {
-		pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	while (qp->rx_in_progress) {
+		pthread_mutex_unlock(&qp->rx_mtx);
 		usleep(10000);
-		pthread_mutex_lock(&net->rx_mtx);
+		pthread_mutex_lock(&qp->rx_mtx);
+	}
+	pthread_mutex_unlock(&qp->rx_mtx);
+}
+
+/*
+ * Attach the tap queues of the first 'pairs' queue pairs and detach the
+ * others, so that the host only steers frames to enabled rx queues.
+ */
+static int
+virtio_net_set_pairs(struct virtio_net *net, int pairs)
+{
+	struct virtio_net_qp *qp;
+	struct ifreq ifr;
+	int i, attach;
+
+	for (i = 0; net->num_pairs > 1 && i < net->num_pairs; i++) {
+		qp = &net->qps[i];
+		attach = (i < pairs);
+		if (qp->tapfd < 0 || qp->attached == attach)
+			continue;
+
+		memset(&ifr, 0, sizeof(ifr));
+		ifr.ifr_flags = attach ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+		if (ioctl(qp->tapfd, TUNSETQUEUE, &ifr) < 0) {
+			WPRINTF(("vtnet: failed to %s tap queue %d: %d\n",
+				attach ? "attach" : "detach", i, errno));
+			return -1;
+		}
+		qp->attached = attach;
 	}
-	pthread_mutex_unlock(&net->rx_mtx);
+	net->curr_pairs = pairs;
+	return 0;
 }
 
 static void
 virtio_net_reset(void *vdev)
 {
 	struct virtio_net *net = vdev;
+	int i;
 
 	DPRINTF(("vtnet: device reset requested !\n"));
 
@@ -272,46 +372,57 @@ virtio_net_reset(void *vdev)
 	 * Wait for the transmit and receive threads to finish their
 	 * processing.
 	 */
-	virtio_net_txwait(net);
-	virtio_net_rxwait(net);
+	for (i = 0; i < net->num_pairs; i++) {
+		virtio_net_txwait(&net->qps[i]);
+		virtio_net_rxwait(&net->qps[i]);
+		net->qps[i].rx_ready = 0;
+	}
 
-	net->rx_ready = 0;
+	virtio_net_set_pairs(net, 1);
 	net->rx_merge = 1;
 	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->rx_maxlen = ETHER_MAX_LEN;
+	net->features = 0;
+	virtio_net_tap_offload(net);
 
 	/* now reset rings, MSI-X vectors, and negotiated capabilities */
 	virtio_reset_dev(&net->base);
+	virtio_net_set_notify(net);
 
 	net->resetting = 0;
 	net->closing = 0;
 }
 
 /*
- * Send signal to tx I/O thread and wait till it exits
+ * Send signal to tx I/O threads and wait till they exit
  */
 static void
 virtio_net_tx_stop(struct virtio_net *net)
 {
 	void *jval;
+	int i;
 
 	net->closing = 1;
 
-	pthread_cond_broadcast(&net->tx_cond);
-
-	pthread_join(net->tx_tid, &jval);
+	for (i = 0; i < net->num_pairs; i++) {
+		pthread_mutex_lock(&net->qps[i].tx_mtx);
+		pthread_cond_broadcast(&net->qps[i].tx_cond);
+		pthread_mutex_unlock(&net->qps[i].tx_mtx);
+		pthread_join(net->qps[i].tx_tid, &jval);
+	}
 }
 
 /*
  * Called to send a buffer chain out to the tap device
  */
 static void
-virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
+virtio_net_tap_tx(struct virtio_net_qp *qp, struct iovec *iov, int iovcnt,
 		  int len)
 {
 	static char pad[60]; /* all zero bytes */
 	ssize_t ret;
 
-	if (net->tapfd == -1)
+	if (qp->tapfd == -1)
 		return;
 
 	/*
@@ -324,19 +435,10 @@ virtio_net_tap_tx(struct virtio_net *net, struct iovec *iov, int iovcnt,
 		iov[iovcnt].iov_len = 60 - len;
 		iovcnt++;
 	}
-	ret = writev(net->tapfd, iov, iovcnt);
+	ret = writev(qp->tapfd, iov, iovcnt);
 	(void)ret; /*avoid compiler warning*/
 }
 
-/*
- *  Called when there is read activity on the tap file descriptor.
- * Each buffer posted by the guest is assumed to be able to contain
- * an entire ethernet frame + rx header.
- *  MP note: the dummybuf is only used for discarding frames, so there
- * is no need for it to be per-vtnet or locked.
- */
-static uint8_t dummybuf[2048];
-
 static inline struct iovec *
 rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 {
@@ -358,110 +460,177 @@ rx_iov_trim(struct iovec *iov, int *niov, int tlen)
 	return riov;
 }
 
+/*
+ * Resume reading the tap once the guest has posted rx buffers. Either the
+ * guest notification or the rx path itself may get here first, whoever
+ * clears rx_stalled re-enables the event.
+ */
 static void
-virtio_net_tap_rx(struct virtio_net *net)
+virtio_net_rx_resume(struct virtio_net_qp *qp)
 {
+	if (qp->mevp == NULL ||
+	    !__sync_bool_compare_and_swap(&qp->rx_stalled, 1, 0))
+		return;
+
+	if (vq_ring_ready(qp->rxq))
+		qp->rxq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
+	mevent_enable(qp->mevp);
+}
+
+/*
+ * Stop reading the tap while there is no rx buffer, the frames stay
+ * queued in the tap instead of being dropped. The guest is asked to
+ * notify us when it posts more buffers.
+ */
+static void
+virtio_net_rx_stall(struct virtio_net_qp *qp)
+{
+	struct virtio_vq_info *vq = qp->rxq;
+
+	/* disable first, a racing resume must not be undone */
+	mevent_disable(qp->mevp);
+	qp->rx_stalled = 1;
+
+	if (!qp->rx_ready || qp->net->resetting || !vq_ring_ready(vq))
+		return;
+
+	vq_clear_used_ring_flags(&qp->net->base, vq);
+	/* memory barrier */
+	mb();
+	if (vq_has_descs(vq))
+		virtio_net_rx_resume(qp);
+}
+
+/*
+ * Called when there is read activity on the tap file descriptor. Up to
+ * the budget of frames is moved to the guest per call, with a single
+ * interrupt for the batch.
+ */
+static void
+virtio_net_tap_rx(struct virtio_net_qp *qp)
+{
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS], *riov;
 	struct virtio_vq_info *vq;
+	uint16_t idx[VIRTIO_NET_RX_MAXCHAINS];
+	int clen[VIRTIO_NET_RX_MAXCHAINS];
 	void *vrx;
-	int len, n;
-	uint16_t idx;
-	ssize_t ret;
+	int len, n, i, niov, nchains, cap, used, budget;
 
 	/*
 	 * Should never be called without a valid tap fd
 	 */
-	assert(net->tapfd != -1);
+	assert(qp->tapfd != -1);
 
 	/*
-	 * But, will be called when the rx ring hasn't yet
-	 * been set up or the guest is resetting the device.
+	 * But, will be called when the rx ring hasn't yet been set up, the
+	 * guest is resetting the device or there are no rx buffers.
 	 */
-	if (!net->rx_ready || net->resetting) {
-		/*
-		 * Drop the packet and try later.
-		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
+	vq = qp->rxq;
+	if (!qp->rx_ready || net->resetting || !vq_has_descs(vq)) {
+		/* Interrupt on empty, if that's negotiated. */
+		if (qp->rx_ready && !net->resetting && vq_ring_ready(vq))
+			vq_endchains(vq, 1);
+		virtio_net_rx_stall(qp);
 		return;
 	}
 
-	/*
-	 * Check for available rx buffers
-	 */
-	vq = &net->queues[VIRTIO_NET_RXQ];
-	if (!vq_has_descs(vq)) {
-		/*
-		 * Drop the packet and try later.  Interrupt on
-		 * empty, if that's negotiated.
-		 */
-		ret = read(net->tapfd, dummybuf, sizeof(dummybuf));
-		(void)ret; /*avoid compiler warning*/
-
-		vq_endchains(vq, 1);
-		return;
-	}
-
-	do {
+	for (budget = net->budget; budget > 0 && vq_has_descs(vq); budget--) {
 		/*
-		 * Get descriptor chain.
+		 * Get descriptor chains. Without merged rx buffers a single
+		 * chain has to hold the entire frame. With them, chains are
+		 * gathered until the largest frame the guest accepts fits,
+		 * and the unused ones are returned after the read.
 		 */
-		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_MAXSEGS, NULL);
-		assert(n >= 1 && n <= VIRTIO_NET_MAXSEGS);
+		niov = 0;
+		nchains = 0;
+		cap = 0;
+		do {
+			n = vq_getchain(vq, &idx[nchains], &iov[niov],
+					VIRTIO_NET_MAXSEGS - niov, NULL);
+			assert(n >= 1);
+			if (n > VIRTIO_NET_MAXSEGS - niov) {
+				assert(nchains > 0);
+				vq_retchain(vq);
+				break;
+			}
+			for (i = 0, clen[nchains] = 0; i < n; i++)
+				clen[nchains] += iov[niov + i].iov_len;
+			cap += clen[nchains];
+			niov += n;
+			nchains++;
+		} while (net->rx_merge && cap < net->rx_vhdrlen + net->rx_maxlen &&
+			 nchains < VIRTIO_NET_RX_MAXCHAINS && vq_has_descs(vq));
 
 		/*
-		 * Get a pointer to the rx header, and use the
-		 * data immediately following it for the packet buffer.
+		 * Get a pointer to the rx header. A tap with IFF_VNET_HDR
+		 * fills it in; otherwise use the data immediately following
+		 * it for the packet buffer.
 		 */
 		vrx = iov[0].iov_base;
-		riov = rx_iov_trim(iov, &n, net->rx_vhdrlen);
-
-		len = readv(net->tapfd, riov, n);
+		if (net->tap_vnethdr)
+			len = readv(qp->tapfd, iov, niov);
+		else {
+			riov = rx_iov_trim(iov, &niov, net->rx_vhdrlen);
+			len = readv(qp->tapfd, riov, niov);
+			if (len >= 0) {
+				/*
+				 * No offloads, so the only valid field in the
+				 * rx header is the number of buffers.
+				 */
+				memset(vrx, 0, net->rx_vhdrlen);
+				len += net->rx_vhdrlen;
+			}
+		}
 
-		if (len < 0 && errno == EWOULDBLOCK) {
+		if (len < 0) {
 			/*
 			 * No more packets, but still some avail ring
 			 * entries.  Interrupt if needed/appropriate.
 			 */
-			vq_retchain(vq);
+			for (i = 0; i < nchains; i++)
+				vq_retchain(vq);
 			vq_endchains(vq, 0);
 			return;
 		}
 
-		/*
-		 * The only valid field in the rx packet header is the
-		 * number of buffers if merged rx bufs were negotiated.
-		 */
-		memset(vrx, 0, net->rx_vhdrlen);
-
-		if (net->rx_merge) {
-			struct virtio_net_rxhdr *vrxh;
-
-			vrxh = vrx;
-			vrxh->vrh_bufs = 1;
-		}
+		/* Count the chains the frame spans */
+		for (used = 0, n = len; used < nchains &&
+				(used == 0 || n > 0); used++)
+			n -= clen[used];
+		if (net->rx_merge)
+			((struct virtio_net_rxhdr *)vrx)->vrh_bufs = used;
 
 		/*
-		 * Release this chain and handle more chains.
+		 * Release the used chains, return the spare ones and
+		 * handle more chains.
 		 */
-		vq_relchain(vq, idx, len + net->rx_vhdrlen);
-	} while (vq_has_descs(vq));
+		for (i = 0; i < used; i++) {
+			n = MIN(len, clen[i]);
+			vq_relchain(vq, idx[i], n);
+			len -= n;
+		}
+		for (i = used; i < nchains; i++)
+			vq_retchain(vq);
+	}
 
-	/* Interrupt if needed, including for NOTIFY_ON_EMPTY. */
-	vq_endchains(vq, 1);
+	/*
+	 * Interrupt if needed, including for NOTIFY_ON_EMPTY. Frames left
+	 * over the budget keep the tap readable, so we are called again.
+	 */
+	vq_endchains(vq, !vq_has_descs(vq));
 }
 
 static void
 virtio_net_rx_callback(int fd, enum ev_type type, void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qp *qp = param;
 
-	pthread_mutex_lock(&net->rx_mtx);
-	net->rx_in_progress = 1;
-	net->virtio_net_rx(net);
-	net->rx_in_progress = 0;
-	pthread_mutex_unlock(&net->rx_mtx);
+	pthread_mutex_lock(&qp->rx_mtx);
+	qp->rx_in_progress = 1;
+	qp->net->virtio_net_rx(qp);
+	qp->rx_in_progress = 0;
+	pthread_mutex_unlock(&qp->rx_mtx);
 
 }
 
@@ -469,19 +638,24 @@ static void
 virtio_net_ping_rxq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qp *qp = &net->qps[vq->num / 2];
 
 	/*
 	 * A qnotify means that the rx process can now begin
 	 */
-	if (net->rx_ready == 0) {
-		net->rx_ready = 1;
+	if (qp->rx_ready == 0) {
+		qp->rx_ready = 1;
 		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
 	}
+
+	/* or that the guest posted the rx buffers we were waiting for */
+	virtio_net_rx_resume(qp);
 }
 
 static void
-virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
+virtio_net_proctx(struct virtio_net_qp *qp, struct virtio_vq_info *vq)
 {
+	struct virtio_net *net = qp->net;
 	struct iovec iov[VIRTIO_NET_MAXSEGS + 1];
 	int i, n;
 	int plen, tlen;
@@ -502,7 +676,11 @@ virtio_net_proctx(struct virtio_net *net, struct virtio_vq_info *vq)
 	}
 
 	DPRINTF(("virtio: packet send, %d bytes, %d segs\n\r", plen, n));
-	net->virtio_net_tx(net, &iov[1], n - 1, plen);
+	/* A tap with IFF_VNET_HDR takes the virtio-net header as is */
+	if (net->tap_vnethdr)
+		net->virtio_net_tx(qp, iov, n, plen);
+	else
+		net->virtio_net_tx(qp, &iov[1], n - 1, plen);
 
 	/* chain is processed, release it and set tlen */
 	vq_relchain(vq, idx, tlen);
@@ -512,6 +690,7 @@ static void
 virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 {
 	struct virtio_net *net = vdev;
+	struct virtio_net_qp *qp = &net->qps[vq->num / 2];
 
 	/*
 	 * Any ring entries to process?
@@ -520,11 +699,11 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 		return;
 
 	/* Signal the tx thread for processing */
-	pthread_mutex_lock(&net->tx_mtx);
+	pthread_mutex_lock(&qp->tx_mtx);
 	vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-	if (net->tx_in_progress == 0)
-		pthread_cond_signal(&net->tx_cond);
-	pthread_mutex_unlock(&net->tx_mtx);
+	if (qp->tx_in_progress == 0)
+		pthread_cond_signal(&qp->tx_cond);
+	pthread_mutex_unlock(&qp->tx_mtx);
 }
 
 /*
@@ -533,22 +712,25 @@ virtio_net_ping_txq(void *vdev, struct virtio_vq_info *vq)
 static void *
 virtio_net_tx_thread(void *param)
 {
-	struct virtio_net *net = param;
+	struct virtio_net_qp *qp = param;
+	struct virtio_net *net = qp->net;
 	struct virtio_vq_info *vq;
-	int error;
+	int error, budget;
 
-	vq = &net->queues[VIRTIO_NET_TXQ];
+	vq = qp->txq;
 
 	/*
 	 * Let us wait till the tx queue pointers get initialised &
 	 * first tx signaled
 	 */
-	pthread_mutex_lock(&net->tx_mtx);
-	error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
-	assert(error == 0);
+	pthread_mutex_lock(&qp->tx_mtx);
+	if (!net->closing) {
+		error = pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
+		assert(error == 0);
+	}
 	if (net->closing) {
 		WPRINTF(("vtnet tx thread closing...\n"));
-		pthread_mutex_unlock(&net->tx_mtx);
+		pthread_mutex_unlock(&qp->tx_mtx);
 		return NULL;
 	}
 
@@ -561,44 +743,127 @@ virtio_net_tx_thread(void *param)
 			if (!net->resetting && vq_has_descs(vq))
 				break;
 
-			net->tx_in_progress = 0;
-			error = pthread_cond_wait(&net->tx_cond, &net->tx_mtx);
+			qp->tx_in_progress = 0;
+			error = pthread_cond_wait(&qp->tx_cond, &qp->tx_mtx);
 			assert(error == 0);
 			if (net->closing) {
 				WPRINTF(("vtnet tx thread closing...\n"));
-				pthread_mutex_unlock(&net->tx_mtx);
+				pthread_mutex_unlock(&qp->tx_mtx);
 				return NULL;
 			}
 		}
 		vq->used->flags |= ACRN_VRING_USED_F_NO_NOTIFY;
-		net->tx_in_progress = 1;
-		pthread_mutex_unlock(&net->tx_mtx);
+		qp->tx_in_progress = 1;
+		pthread_mutex_unlock(&qp->tx_mtx);
 
 		do {
 			/*
-			 * Run through entries, placing them into
-			 * iovecs and sending when an end-of-packet
+			 * Run through up to a budget of entries, placing
+			 * them into iovecs and sending when an end-of-packet
 			 * is found
 			 */
-			virtio_net_proctx(net, vq);
+			for (budget = net->budget; budget > 0 &&
+					vq_has_descs(vq); budget--)
+				virtio_net_proctx(qp, vq);
+
+			/*
+			 * Generate one interrupt, if needed, per batch so
+			 * the guest reclaims buffers while we go on.
+			 */
+			vq_endchains(vq, !vq_has_descs(vq));
 		} while (vq_has_descs(vq));
 
-		/*
-		 * Generate an interrupt if needed.
-		 */
-		vq_endchains(vq, 1);
+		pthread_mutex_lock(&qp->tx_mtx);
+	}
+}
 
-		pthread_mutex_lock(&net->tx_mtx);
+static uint8_t
+virtio_net_ctrl_mq(struct virtio_net *net, struct virtio_net_ctrl_hdr *hdr,
+		   struct iovec *iov, int n)
+{
+	uint16_t pairs;
+
+	if (hdr->cmd != VIRTIO_NET_CTRL_MQ_VQ_PAIRS_SET || n != 1 ||
+	    iov[0].iov_len < sizeof(pairs) ||
+	    !(net->features & VIRTIO_NET_F_MQ))
+		return VIRTIO_NET_ERR;
+
+	pairs = *(uint16_t *)iov[0].iov_base;
+	if (pairs < 1 || pairs > net->num_pairs) {
+		WPRINTF(("vtnet: invalid number of queue pairs %d\n", pairs));
+		return VIRTIO_NET_ERR;
 	}
+
+	DPRINTF(("vtnet: %d queue pairs enabled\n\r", pairs));
+	return virtio_net_set_pairs(net, pairs) ? VIRTIO_NET_ERR : VIRTIO_NET_OK;
 }
 
-#ifdef notyet
+/*
+ * Control queue requests are a read-only header, read-only command data
+ * and a writable ack byte. Called with the device mutex held, which
+ * serializes them against reset.
+ */
 static void
 virtio_net_ping_ctlq(void *vdev, struct virtio_vq_info *vq)
 {
-	DPRINTF(("vtnet: control qnotify!\n\r"));
+	struct virtio_net *net = vdev;
+	struct iovec iov[VIRTIO_NET_CTRL_MAXSEGS];
+	uint16_t flags[VIRTIO_NET_CTRL_MAXSEGS];
+	struct virtio_net_ctrl_hdr *hdr;
+	uint8_t *ack, status;
+	uint16_t idx;
+	int n;
+
+	while (vq_has_descs(vq)) {
+		n = vq_getchain(vq, &idx, iov, VIRTIO_NET_CTRL_MAXSEGS, flags);
+		if (n < 2 || n > VIRTIO_NET_CTRL_MAXSEGS ||
+		    iov[0].iov_len < sizeof(*hdr) || iov[n - 1].iov_len < 1 ||
+		    !(flags[n - 1] & ACRN_VRING_DESC_F_WRITE)) {
+			WPRINTF(("vtnet: bad control queue request\n"));
+			vq_relchain(vq, idx, 0);
+			continue;
+		}
+
+		hdr = iov[0].iov_base;
+		ack = iov[n - 1].iov_base;
+		switch (hdr->class) {
+		case VIRTIO_NET_CTRL_MQ:
+			status = virtio_net_ctrl_mq(net, hdr, &iov[1], n - 2);
+			break;
+		default:
+			DPRINTF(("vtnet: unsupported control class %d\n\r",
+				hdr->class));
+			status = VIRTIO_NET_ERR;
+			break;
+		}
+
+		*ack = status;
+		vq_relchain(vq, idx, sizeof(*ack));
+	}
+
+	vq_endchains(vq, 1);
+}
+
+/*
+ * Hook up the queue notifications. The control queue moves from queue 2
+ * to after the last pair once the guest negotiates VIRTIO_NET_F_MQ.
+ */
+static void
+virtio_net_set_notify(struct virtio_net *net)
+{
+	int i, ctlq;
+
+	for (i = 0; i < net->num_pairs * 2; i++)
+		net->queues[i].notify = (i & 1) ? virtio_net_ping_txq :
+			virtio_net_ping_rxq;
+
+	if (net->num_pairs == 1)
+		return;
+
+	ctlq = (net->features & VIRTIO_NET_F_MQ) ? net->num_pairs * 2 : 2;
+	net->queues[net->num_pairs * 2].notify = NULL;
+	net->queues[ctlq].notify = virtio_net_ping_ctlq;
 }
-#endif
 
 static int
 virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
@@ -625,10 +890,15 @@ virtio_net_parsemac(char *mac_str, uint8_t *mac_addr)
 	return 0;
 }
 
+/*
+ * Open a tap queue. With multiqueue set, every open of the same devname
+ * adds a queue to the tap device.
+ */
 static int
-virtio_net_tap_open(char *devname)
+virtio_net_tap_open(char *devname, int *vnethdr, int *multiqueue)
 {
 	int tunfd, rc;
+	unsigned int features;
 	struct ifreq ifr;
 
 #define PATH_NET_TUN "/dev/net/tun"
@@ -641,6 +911,21 @@ virtio_net_tap_open(char *devname)
 	memset(&ifr, 0, sizeof(ifr));
 	ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
 
+	/*
+	 * Pass the virtio-net header through and open multiple queues if the
+	 * tap supports it
+	 */
+	if (ioctl(tunfd, TUNGETFEATURES, &features) < 0)
+		features = 0;
+	if (!(features & IFF_VNET_HDR))
+		*vnethdr = 0;
+	if (!(features & IFF_MULTI_QUEUE))
+		*multiqueue = 0;
+	if (*vnethdr)
+		ifr.ifr_flags |= IFF_VNET_HDR;
+	if (*multiqueue)
+		ifr.ifr_flags |= IFF_MULTI_QUEUE;
+
 	if (*devname)
 		strncpy(ifr.ifr_name, devname, IFNAMSIZ);
 
@@ -656,12 +941,62 @@ virtio_net_tap_open(char *devname)
 	return tunfd;
 }
 
+/*
+ * Match the tap vnet header size and offloads to the negotiated features.
+ * TUNSETOFFLOAD tells the tap which offloaded frames the guest accepts;
+ * offloaded frames from the guest are always taken.
+ */
+static void
+virtio_net_tap_offload(struct virtio_net *net)
+{
+	unsigned int offload;
+	int hdrlen;
+
+	/* the header size and offloads are per tap device, not per queue */
+	if (!net->tap_vnethdr || net->qps[0].tapfd < 0)
+		return;
+
+	hdrlen = net->rx_vhdrlen;
+	if (ioctl(net->qps[0].tapfd, TUNSETVNETHDRSZ, &hdrlen) < 0)
+		WPRINTF(("vtnet: failed to set tap vnet header size\n"));
+
+	offload = 0;
+	if (net->features & VIRTIO_NET_F_GUEST_CSUM) {
+		offload |= TUN_F_CSUM;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO4)
+			offload |= TUN_F_TSO4;
+		if (net->features & VIRTIO_NET_F_GUEST_TSO6)
+			offload |= TUN_F_TSO6;
+		if (net->features & VIRTIO_NET_F_GUEST_ECN)
+			offload |= TUN_F_TSO_ECN;
+	}
+	if (ioctl(net->qps[0].tapfd, TUNSETOFFLOAD, offload) < 0)
+		WPRINTF(("vtnet: failed to set tap offloads 0x%x\n", offload));
+}
+
+static void
+virtio_net_tap_close(struct virtio_net *net)
+{
+	int i;
+
+	for (i = 0; i < net->num_pairs; i++) {
+		if (net->qps[i].mevp != NULL) {
+			mevent_delete(net->qps[i].mevp);
+			net->qps[i].mevp = NULL;
+		}
+		if (net->qps[i].tapfd >= 0) {
+			close(net->qps[i].tapfd);
+			net->qps[i].tapfd = -1;
+		}
+	}
+}
+
 static void
 virtio_net_tap_setup(struct virtio_net *net, char *devname)
 {
 	char tbuf[80 + 5];	/* room for "acrn_" prefix */
-	int vhost_fd = -1;
-	int rc;
+	struct virtio_net_qp *qp;
+	int rc, i, mq, vnethdr;
 
 	rc = snprintf(tbuf, strnlen(devname, 79) + 6, "acrn_%s", devname);
 	if (rc < 0 || rc >= 85)	/* give warning if error or truncation happens */
@@ -670,24 +1005,68 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	net->virtio_net_rx = virtio_net_tap_rx;
 	net->virtio_net_tx = virtio_net_tap_tx;
 
-	net->tapfd = virtio_net_tap_open(tbuf);
-	if (net->tapfd == -1) {
-		WPRINTF(("open of tap device %s failed\n", tbuf));
+	/* vhost-net adds the virtio-net header itself */
+	net->tap_vnethdr = !net->use_vhost;
+	mq = (net->num_pairs > 1);
+	for (i = 0; i < net->num_pairs; i++) {
+		qp = &net->qps[i];
+		vnethdr = net->tap_vnethdr;
+		qp->tapfd = virtio_net_tap_open(tbuf, &vnethdr, &mq);
+		if (qp->tapfd == -1) {
+			WPRINTF(("open of tap device %s queue %d failed\n",
+				tbuf, i));
+			break;
+		}
+		qp->attached = 1;
+		if (i == 0)
+			net->tap_vnethdr = vnethdr;
+
+		/*
+		 * Set non-blocking and register for read
+		 * notifications with the event loop
+		 */
+		int opt = 1;
+
+		if (ioctl(qp->tapfd, FIONBIO, &opt) < 0) {
+			WPRINTF(("tap device O_NONBLOCK failed\n"));
+			close(qp->tapfd);
+			qp->tapfd = -1;
+			break;
+		}
+
+		if (!mq) {
+			i++;
+			break;
+		}
+	}
+
+	if (i == 0) {
+		net->num_pairs = 1;
 		return;
 	}
+
+	/* run with the queue pairs that could be set up */
+	if (i < net->num_pairs) {
+		WPRINTF(("vtnet: tap %s: using %d of %d queue pairs\n",
+			tbuf, i, net->num_pairs));
+		net->num_pairs = i;
+	}
 	DPRINTF(("open of tap device %s success!\n", tbuf));
+}
 
-	/*
-	 * Set non-blocking and register for read
-	 * notifications with the event loop
-	 */
-	int opt = 1;
+/*
+ * Hand the tap to vhost-net or register the rx events of all queue
+ * pairs, once the virtqueues are set up.
+ */
+static void
+virtio_net_tap_start(struct virtio_net *net)
+{
+	struct virtio_net_qp *qp;
+	int vhost_fd = -1;
+	int i;
 
-	if (ioctl(net->tapfd, FIONBIO, &opt) < 0) {
-		WPRINTF(("tap device O_NONBLOCK failed\n"));
-		close(net->tapfd);
-		net->tapfd = -1;
-	}
+	if (net->qps[0].tapfd < 0)
+		return;
 
 	if (net->use_vhost) {
 		vhost_fd = open("/dev/vhost-net", O_RDWR);
@@ -695,7 +1074,7 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 			WPRINTF(("open of vhost-net failed\n"));
 		else {
 			net->vhost_net = vhost_net_init(&net->base, vhost_fd,
-				net->tapfd, 0);
+				net->qps[0].tapfd, 0);
 			if (!net->vhost_net) {
 				WPRINTF(("vhost_net_init failed, fallback "
 					"to userspace virtio\n"));
@@ -706,12 +1085,15 @@ virtio_net_tap_setup(struct virtio_net *net, char *devname)
 	}
 
 	if (vhost_fd < 0) {
-		net->mevp = mevent_add(net->tapfd, EVF_READ,
-				       virtio_net_rx_callback, net);
-		if (net->mevp == NULL) {
-			WPRINTF(("Could not register event\n"));
-			close(net->tapfd);
-			net->tapfd = -1;
+		for (i = 0; i < net->num_pairs; i++) {
+			qp = &net->qps[i];
+			qp->mevp = mevent_add(qp->tapfd, EVF_READ,
+					      virtio_net_rx_callback, qp);
+			if (qp->mevp == NULL) {
+				WPRINTF(("Could not register event\n"));
+				virtio_net_tap_close(net);
+				return;
+			}
 		}
 	}
 }
@@ -729,7 +1111,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	char *opt;
 	int mac_provided;
 	pthread_mutexattr_t attr;
-	int rc;
+	struct virtio_net_qp *qp;
+	int rc, i;
 
 	net = calloc(1, sizeof(struct virtio_net));
 	if (!net) {
@@ -756,6 +1139,8 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	 */
 	mac_provided = 0;
 	net->vhost_net = NULL;
+	net->num_pairs = 1;
+	net->budget = VIRTIO_NET_BUDGET;
 	if (opts != NULL) {
 		int err;
 
@@ -770,7 +1155,29 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		while ((opt = strsep(&vtopts, ",")) != NULL) {
 			if (strcmp("vhost", opt) == 0)
 				net->use_vhost = true;
-			else {
+			else if (!strncmp(opt, "num_queues=",
+					strlen("num_queues="))) {
+				if (dm_strtoi(opt + strlen("num_queues="),
+						&opt, 10, &net->num_pairs) ||
+						net->num_pairs < 1 ||
+						net->num_pairs > VIRTIO_NET_MAX_PAIRS) {
+					WPRINTF(("virtio_net: num_queues must "
+						"be 1..%d\n", VIRTIO_NET_MAX_PAIRS));
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else if (!strncmp(opt, "budget=", strlen("budget="))) {
+				if (dm_strtoi(opt + strlen("budget="), &opt, 10,
+						&net->budget) || net->budget < 1 ||
+						net->budget > VIRTIO_NET_RINGSZ) {
+					WPRINTF(("virtio_net: budget must be "
+						"1..%d\n", VIRTIO_NET_RINGSZ));
+					free(devname);
+					free(net);
+					return -1;
+				}
+			} else {
 				err = virtio_net_parsemac(opt,
 					net->config.mac);
 				if (err != 0) {
@@ -782,36 +1189,71 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 		}
 	}
 
-	virtio_linkup(&net->base, &virtio_net_ops, net, dev, net->queues,
-		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
-	net->base.mtx = &net->mtx;
-	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
-
-	net->queues[VIRTIO_NET_RXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_RXQ].notify = virtio_net_ping_rxq;
-	net->queues[VIRTIO_NET_TXQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_TXQ].notify = virtio_net_ping_txq;
-#ifdef notyet
-	net->queues[VIRTIO_NET_CTLQ].qsize = VIRTIO_NET_RINGSZ;
-	net->queues[VIRTIO_NET_CTLQ].notify = virtio_net_ping_ctlq;
-#endif
+	/* vhost-net serves a single queue pair */
+	if (net->use_vhost && net->num_pairs > 1) {
+		WPRINTF(("virtio_net: vhost supports 1 queue pair only\n"));
+		net->num_pairs = 1;
+	}
 
 	/*
 	 * Attempt to open the tap device
 	 */
-	net->tapfd = -1;
+	for (i = 0; i < VIRTIO_NET_MAX_PAIRS; i++)
+		net->qps[i].tapfd = -1;
 
 	if (!devname) {
 		WPRINTF(("virtio_net: devname NULL\n"));
 		return -1;
 	}
 
+	net->rx_merge = 1;
+	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
+	net->rx_maxlen = ETHER_MAX_LEN;
+
 	if (strncmp(devname, "tap", 3) == 0 ||
 	    strncmp(devname, "vmnet", 5) == 0)
 		virtio_net_tap_setup(net, devname);
 
 	free(devname);
 
+	/*
+	 * The tap may provide fewer queues than asked for, so the queues are
+	 * laid out once it is open: the rx/tx pairs, then the control queue
+	 * if there is more than one pair.
+	 */
+	net->ops = virtio_net_ops;
+	if (net->num_pairs > 1)
+		net->ops.nvq = net->num_pairs * 2 + 1;
+	virtio_linkup(&net->base, &net->ops, net, dev, net->queues,
+		      net->use_vhost ? BACKEND_VHOST : BACKEND_VBSU);
+	net->base.mtx = &net->mtx;
+	net->base.device_caps = VIRTIO_NET_S_HOSTCAPS;
+
+	for (i = 0; i < net->ops.nvq; i++)
+		net->queues[i].qsize = VIRTIO_NET_RINGSZ;
+	for (i = 0; i < net->num_pairs; i++) {
+		qp = &net->qps[i];
+		qp->net = net;
+		qp->rxq = &net->queues[i * 2 + VIRTIO_NET_RXQ];
+		qp->txq = &net->queues[i * 2 + VIRTIO_NET_TXQ];
+		qp->rx_in_progress = 0;
+		pthread_mutex_init(&qp->rx_mtx, NULL);
+	}
+	virtio_net_set_notify(net);
+	virtio_net_tap_start(net);
+
+	if (net->num_pairs > 1) {
+		net->base.device_caps |= VIRTIO_NET_F_CTRL_VQ | VIRTIO_NET_F_MQ;
+		net->config.max_virtqueue_pairs = net->num_pairs;
+	}
+	/* only the first pair is enabled until the guest asks for more */
+	virtio_net_set_pairs(net, 1);
+
+	if (net->tap_vnethdr && net->qps[0].tapfd >= 0) {
+		net->base.device_caps |= VIRTIO_NET_S_OFFLOADCAPS;
+		virtio_net_tap_offload(net);
+	}
+
 	/*
 	 * The default MAC address is the standard NetApp OUI of 00-a0-98,
 	 * followed by an MD5 of the PCI slot/func number and dev name
@@ -840,7 +1282,7 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	pci_set_cfgdata16(dev, PCIR_SUBVEND_0, VIRTIO_VENDOR);
 
 	/* Link is up if we managed to open tap device */
-	net->config.status = (opts == NULL || net->tapfd >= 0);
+	net->config.status = (opts == NULL || net->qps[0].tapfd >= 0);
 
 	/* use BAR 1 to map MSI-X table and PBA, if we're using MSI-X */
 	if (virtio_interrupt_init(&net->base, virtio_uses_msix())) {
@@ -855,24 +1297,25 @@ virtio_net_init(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 	net->resetting = 0;
 	net->closing = 0;
 
-	net->rx_merge = 1;
-	net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr);
-	net->rx_in_progress = 0;
-	pthread_mutex_init(&net->rx_mtx, NULL);
-
 	/*
-	 * Initialize tx semaphore & spawn TX processing thread.
-	 * As of now, only one thread for TX desc processing is
-	 * spawned.
+	 * Initialize tx semaphores & spawn one TX processing thread
+	 * per queue pair.
 	 */
-	net->tx_in_progress = 0;
-	pthread_mutex_init(&net->tx_mtx, NULL);
-	pthread_cond_init(&net->tx_cond, NULL);
-	pthread_create(&net->tx_tid, NULL, virtio_net_tx_thread,
-		       (void *)net);
-	snprintf(tname, sizeof(tname), "vtnet-%d:%d tx", dev->slot,
-		 dev->func);
-	pthread_setname_np(net->tx_tid, tname);
+	for (i = 0; i < net->num_pairs; i++) {
+		qp = &net->qps[i];
+		qp->tx_in_progress = 0;
+		pthread_mutex_init(&qp->tx_mtx, NULL);
+		pthread_cond_init(&qp->tx_cond, NULL);
+		pthread_create(&qp->tx_tid, NULL, virtio_net_tx_thread,
+			       (void *)qp);
+		if (net->num_pairs > 1)
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx%d",
+				 dev->slot, dev->func, i);
+		else
+			snprintf(tname, sizeof(tname), "vtnet-%d:%d tx",
+				 dev->slot, dev->func);
+		pthread_setname_np(qp->tx_tid, tname);
+	}
 
 	return 0;
 }
@@ -919,8 +1362,16 @@ virtio_net_neg_features(void *vdev, uint64_t negotiated_features)
 	if (!(net->features & VIRTIO_NET_F_MRG_RXBUF)) {
 		net->rx_merge = 0;
 		/* non-merge rx header is 2 bytes shorter */
-		net->rx_vhdrlen -= 2;
+		net->rx_vhdrlen = sizeof(struct virtio_net_rxhdr) - 2;
 	}
+
+	if (net->features & (VIRTIO_NET_F_GUEST_TSO4 | VIRTIO_NET_F_GUEST_TSO6))
+		net->rx_maxlen = VIRTIO_NET_MAX_GSO_FRAME;
+	else
+		net->rx_maxlen = ETHER_MAX_LEN;
+
+	virtio_net_tap_offload(net);
+	virtio_net_set_notify(net);
 }
 
 static void
@@ -934,9 +1385,9 @@ virtio_net_set_status(void *vdev, uint64_t status)
 
 	if (!net->vhost_net->vhost_started &&
 		(status & VIRTIO_CR_STATUS_DRIVER_OK)) {
-		if (net->mevp) {
-			mevent_delete(net->mevp);
-			net->mevp = NULL;
+		if (net->qps[0].mevp) {
+			mevent_delete(net->qps[0].mevp);
+			net->qps[0].mevp = NULL;
 		}
 
 		rc = vhost_net_start(net->vhost_net);
@@ -969,14 +1420,9 @@ virtio_net_deinit(struct vmctx *ctx, struct pci_vdev *dev, char *opts)
 			net->vhost_net = NULL;
 		}
 
-		if (net->tapfd >= 0) {
-			close(net->tapfd);
-			net->tapfd = -1;
-		} else
+		if (net->qps[0].tapfd < 0)
 			fprintf(stderr, "net->tapfd is -1!\n");
-
-		if (net->mevp != NULL)
-			mevent_delete(net->mevp);
+		virtio_net_tap_close(net);
 
 		free(net);
 
@@ -45,6 +45,15 @@
  */
 #define VHM_REQUEST_MAX 16U
 
+/*
+ * Request slots [0, VHM_REQUEST_POSTED_BASE) are dedicated to the vCPUs with
+ * the same IDs. The remaining slots form a ring shared by all vCPUs of a VM to
+ * deliver posted requests, i.e. writes to the ranges registered through
+ * IC_SET_POSTED_IOREQ_RANGE, which the vCPU does not wait for.
+ */
+#define VHM_REQUEST_POSTED_BASE	8U
+#define VHM_REQUEST_POSTED_NUM	(VHM_REQUEST_MAX - VHM_REQUEST_POSTED_BASE)
+
 #define REQ_STATE_PENDING	0
 #define REQ_STATE_COMPLETE	1
 #define REQ_STATE_PROCESSING	2
@@ -67,6 +76,7 @@
 
 /* Generic VM flags from guest OS */
 #define SECURE_WORLD_ENABLED    (1UL<<0)  /* Whether secure world is enabled */
+#define DIRTY_LOGGING_ENABLED   (1UL<<1)  /* Whether EPT dirty page logging is enabled */
 
 /**
  * @brief Hypercall
@@ -180,11 +190,27 @@ struct vhm_request {
 	uint32_t completion_polling;
 
 	/**
-	 * @brief Reserved.
+	 * @brief Set if this is a posted request.
+	 *
+	 * The vCPU issuing a posted request does not wait for its completion.
 	 *
 	 * Byte offset: 8.
 	 */
-	uint32_t reserved0[14];
+	uint32_t posted;
+
+	/**
+	 * @brief ID of the vCPU issuing this request.
+	 *
+	 * Byte offset: 12.
+	 */
+	uint32_t vcpu;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 16.
+	 */
+	uint32_t reserved0[12];
 
 	/**
 	 * @brief Details about this request.
@@ -254,6 +280,7 @@ struct acrn_create_vm {
 
 	/* VM flag bits from Guest OS, now used
 	 *  SECURE_WORLD_ENABLED          (1UL<<0)
+	 *  DIRTY_LOGGING_ENABLED         (1UL<<1)
 	 */
 	uint64_t vm_flag;
 
@@ -358,6 +385,27 @@ struct acrn_set_ioreq_buffer {
 	uint64_t req_buf;
 } __aligned(8);
 
+/**
+ * @brief Info to add or remove a posted I/O request range
+ *
+ * the parameter for HC_SET_POSTED_IOREQ_RANGE hypercall
+ */
+struct acrn_posted_ioreq_range {
+#define POSTED_IOREQ_ASSIGN	0U
+#define POSTED_IOREQ_DEASSIGN	1U
+	/** POSTED_IOREQ_ASSIGN or POSTED_IOREQ_DEASSIGN */
+	uint32_t op;
+
+	/** REQ_PORTIO or REQ_MMIO */
+	uint32_t type;
+
+	/** start address of the range */
+	uint64_t start;
+
+	/** end address of the range (exclusive) */
+	uint64_t end;
+} __aligned(8);
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
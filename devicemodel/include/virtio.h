@@ -532,6 +532,13 @@ struct virtio_base {
 	int backend_type;               /**< VBSU, VBSK or VHOST */
 	struct acrn_timer polling_timer; /**< timer for polling mode */
 	int polling_in_progress;        /**< The polling status */
+	bool polling_idle;		/**< timer stopped, no queue polled */
+	struct {
+		bool	 registered;	/**< range registered as posted */
+		uint32_t type;		/**< REQ_PORTIO or REQ_MMIO */
+		uint64_t start;		/**< start address of the range */
+		uint64_t end;		/**< end address (exclusive) */
+	} posted_notify;		/**< notify range of posted ioreqs */
 };
 
 #define	VIRTIO_BASE_LOCK(vb)					\
@@ -615,6 +622,13 @@ struct virtio_vq_info {
 	uint32_t gpa_avail[2];	/**< gpa of avail_ring */
 	uint32_t gpa_used[2];	/**< gpa of used_ring */
 	bool enabled;		/**< whether the virtqueue is enabled */
+
+	bool polling;		/**< polled, notifications suppressed */
+	uint16_t poll_avail;	/**< avail->idx seen by the last poll */
+	uint16_t poll_backoff;	/**< polling period, in poll intervals */
+	uint16_t poll_wait;	/**< poll intervals until the next poll */
+	uint64_t poll_hits;	/**< polls that found new buffers */
+	uint64_t poll_misses;	/**< polls that found none */
 };
 
 /* as noted above, these are sort of backwards, name-wise */
@@ -450,11 +450,8 @@ static void ptirq_handle_intx(struct acrn_vm *vm,
 	}
 }
 
-void ptirq_softirq(uint16_t pcpu_id)
+static void ptirq_softirq_vm(struct acrn_vm *vm)
 {
-	struct acrn_vcpu *vcpu = (struct acrn_vcpu *)per_cpu(vcpu, pcpu_id);
-	struct acrn_vm *vm = vcpu->vm;
-
 	while (1) {
 		struct ptirq_remapping_info *entry = ptirq_dequeue_softirq(vm);
 		struct ptirq_msi_info *msi;
@@ -492,6 +489,19 @@ void ptirq_softirq(uint16_t pcpu_id)
 	}
 }
 
+void ptirq_softirq(uint16_t pcpu_id)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	uint16_t i;
+
+	/* serve the VMs of all the vcpus sharing this pcpu */
+	for (i = 0U; i < CONFIG_MAX_VCPUS_PER_PCPU; i++) {
+		if (ctx->vcpus[i] != NULL) {
+			ptirq_softirq_vm(ctx->vcpus[i]->vm);
+		}
+	}
+}
+
 void ptirq_intx_ack(struct acrn_vm *vm, uint8_t virt_pin,
 		enum ptirq_vpin_source vpin_src)
 {
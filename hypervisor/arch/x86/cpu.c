@@ -35,6 +35,9 @@ static uint64_t x86_arch_capabilities;
 #define VAPIC_FEATURE_POST_INTR			(1U << 4U)
 #define VAPIC_FEATURE_VX2APIC_MODE		(1U << 5U)
 
+#define EPT_FEATURE_ENABLE			(1U << 0U)
+#define EPT_FEATURE_AD				(1U << 1U)
+
 struct cpu_capability {
 	uint8_t apicv_features;
 	uint8_t ept_features;
@@ -100,7 +103,7 @@ static uint64_t get_address_mask(uint8_t limit)
 
 static void get_cpu_capabilities(void)
 {
-	uint32_t eax, unused;
+	uint32_t eax, ecx, edx, unused;
 	uint32_t family, model;
 
 	cpuid(CPUID_VENDORSTRING,
@@ -128,6 +131,14 @@ static void get_cpu_capabilities(void)
 		&boot_cpu_data.cpuid_leaves[FEAT_7_0_ECX],
 		&boot_cpu_data.cpuid_leaves[FEAT_7_0_EDX]);
 
+	if (cpu_has_cap(X86_FEATURE_XSAVE)) {
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 0U, &eax, &unused, &unused, &edx);
+		boot_cpu_data.xcr0_supported = ((uint64_t)edx << 32U) | (uint64_t)eax;
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 1U,
+			&boot_cpu_data.cpuid_leaves[FEAT_D_1_EAX], &unused, &ecx, &edx);
+		boot_cpu_data.xss_supported = ((uint64_t)edx << 32U) | (uint64_t)ecx;
+	}
+
 	cpuid(CPUID_MAX_EXTENDED_FUNCTION,
 		&boot_cpu_data.extended_cpuid_level,
 		&unused, &unused, &unused);
@@ -177,6 +188,31 @@ static void get_cpu_capabilities(void)
 #endif
 }
 
+/*
+ * Size of the XSAVE area save_vcpu_shared_state() needs for all the state
+ * components the guests could enable.
+ */
+static uint32_t xsave_area_size(void)
+{
+	uint32_t size = 0U;
+	uint32_t i, eax, ecx, unused;
+
+	if (cpu_has_cap(X86_FEATURE_XSAVE)) {
+		/* all XCR0 components, standard format */
+		cpuid_subleaf(CPUID_XSAVE_FEATURES, 0U, &unused, &unused, &ecx, &unused);
+		size = ecx;
+		/* plus the IA32_XSS ones, 64-byte aligned in the compacted format */
+		for (i = 0U; i < 64U; i++) {
+			if ((boot_cpu_data.xss_supported & (1UL << i)) != 0UL) {
+				cpuid_subleaf(CPUID_XSAVE_FEATURES, i, &eax, &unused, &unused, &unused);
+				size += eax + 63U;
+			}
+		}
+	}
+
+	return size;
+}
+
 /*
  * basic hardware capability check
  * we should supplement which feature/capability we must support
@@ -252,6 +288,11 @@ static int hardware_detect_support(void)
 		return -ENODEV;
 	}
 
+	if ((CONFIG_MAX_VCPUS_PER_PCPU > 1U) && (xsave_area_size() > XSAVE_AREA_SIZE)) {
+		pr_fatal("%s, XSAVE area of %u bytes too large\n", __func__, xsave_area_size());
+		return -ENODEV;
+	}
+
 	if (is_vmx_disabled()) {
 		pr_fatal("%s, VMX can not be enabled\n", __func__);
 		return -ENODEV;
@@ -710,6 +751,18 @@ void cpu_do_idle(void)
 	__asm __volatile("pause" ::: "memory");
 }
 
+/*
+ * @pre IRQs are disabled
+ *
+ * STI only enables interrupts after HLT is reached, so an interrupt which
+ * becomes pending in between still wakes the pcpu. Returns with IRQs
+ * disabled.
+ */
+void cpu_halt_until_interrupt(void)
+{
+	__asm __volatile("sti\n\thlt\n\tcli" ::: "memory");
+}
+
 void cpu_dead(uint16_t pcpu_id)
 {
 	/* For debug purposes, using a stack variable in the while loop enables
@@ -815,7 +868,13 @@ static void ept_cap_detect(void)
 		msr_val = msr_read(MSR_IA32_VMX_PROCBASED_CTLS2);
 
 		if (is_ctrl_setting_allowed(msr_val, VMX_PROCBASED_CTLS2_EPT)) {
-			cpu_caps.ept_features = 1U;
+			cpu_caps.ept_features = EPT_FEATURE_ENABLE;
+
+			/* SDM A.10: accessed and dirty flags for EPT */
+			msr_val = msr_read(MSR_IA32_VMX_EPT_VPID_CAP);
+			if ((msr_val & VMX_EPT_AD) != 0UL) {
+				cpu_caps.ept_features |= EPT_FEATURE_AD;
+			}
 		}
 	}
 }
@@ -870,7 +929,12 @@ static void cpu_cap_detect(void)
 
 bool is_ept_supported(void)
 {
-	return (cpu_caps.ept_features != 0U);
+	return ((cpu_caps.ept_features & EPT_FEATURE_ENABLE) != 0U);
+}
+
+bool is_ept_ad_supported(void)
+{
+	return ((cpu_caps.ept_features & EPT_FEATURE_AD) != 0U);
 }
 
 bool is_apicv_reg_virtualization_supported(void)
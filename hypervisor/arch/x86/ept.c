@@ -180,11 +180,195 @@ int ept_misconfig_vmexit_handler(__unused struct acrn_vcpu *vcpu)
 	return status;
 }
 
-void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
-	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+static void ept_flush_all_vcpus(struct acrn_vm *vm)
 {
 	uint16_t i;
 	struct acrn_vcpu *vcpu;
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	}
+}
+
+/*
+ * Request an EPT flush of all the vCPUs of the VM and wait for the ones
+ * running on other pCPUs to have done it. A vCPU not running, or sharing
+ * this pCPU, is in root mode and flushes before its next VM entry.
+ */
+static void ept_flush_all_vcpus_sync(struct acrn_vm *vm)
+{
+	uint16_t i, pcpu_id = get_cpu_id();
+	struct acrn_vcpu *vcpu;
+
+	ept_flush_all_vcpus(vm);
+
+	foreach_vcpu(i, vm, vcpu) {
+		if (vcpu->pcpu_id != pcpu_id) {
+			while ((atomic_load32(&vcpu->running) == 1U) &&
+					bitmap_test(ACRN_REQUEST_EPT_FLUSH, &vcpu->arch.pending_req)) {
+				pause_cpu();
+			}
+		}
+	}
+}
+
+/*
+ * Within an EPT batch, the flush of the first VM modified is deferred to
+ * ept_batch_end(). Others, rarely modified in the same batch, are flushed
+ * right away.
+ */
+static void ept_flush_request(struct acrn_vm *vm)
+{
+	uint16_t pcpu_id = get_cpu_id();
+
+	if (per_cpu(ept_batch, pcpu_id) != 0U) {
+		if (per_cpu(ept_batch_vm, pcpu_id) == NULL) {
+			per_cpu(ept_batch_vm, pcpu_id) = vm;
+		}
+		if (per_cpu(ept_batch_vm, pcpu_id) == vm) {
+			return;
+		}
+	}
+
+	ept_flush_all_vcpus(vm);
+}
+
+/*
+ * Merge back into large pages the Normal World EPT tables of
+ * [gpa, gpa + size) which hold a contiguous mapping again.
+ *
+ * Changing the page size of a live translation is unsafe: a re-split
+ * recycles the former table page while stale paging-structure cache
+ * entries still point at it, and on CPUs with the iTLB multihit erratum
+ * (CVE-2018-12207) it can hang the core. So all the vCPUs of the VM are
+ * held in root mode during the merge, and invalidate their EPT TLB before
+ * they resume, as the IOMMU does before this returns.
+ *
+ * The Secure World EPT references the Normal World PDPT entries, it would
+ * no longer match: nothing is merged while a Secure World is active.
+ */
+static void ept_coalesce(struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	uint16_t i, pcpu_id = get_cpu_id();
+	struct acrn_vcpu *vcpu;
+	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	const struct memory_ops *mem_ops = &vm->arch_vm.ept_mem_ops;
+	uint64_t start, end;
+
+	if ((vm->sworld_control.flag.active != 0UL) ||
+			!mmu_coalesce(pml4_page, gpa, size, mem_ops, true)) {
+		return;
+	}
+	/* one merge at a time, a concurrent one would give up anyway */
+	if (atomic_cmpxchg32(&vm->arch_vm.ept_quiesce, 0U, 1U) != 0U) {
+		return;
+	}
+
+	foreach_vcpu(i, vm, vcpu) {
+		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_QUIESCE);
+	}
+	foreach_vcpu(i, vm, vcpu) {
+		if (vcpu->pcpu_id != pcpu_id) {
+			while ((atomic_load32(&vcpu->running) == 1U) &&
+					bitmap_test(ACRN_REQUEST_EPT_QUIESCE, &vcpu->arch.pending_req)) {
+				pause_cpu();
+			}
+		}
+	}
+
+	(void)mmu_coalesce(pml4_page, gpa, size, mem_ops, false);
+	if (vm->iommu != NULL) {
+		start = gpa & PDPTE_MASK;
+		end = (gpa + size + PDPTE_SIZE - 1UL) & PDPTE_MASK;
+		iommu_flush_iotlb(vm->iommu, start, end - start);
+	}
+
+	atomic_store32(&vm->arch_vm.ept_quiesce, 0U);
+}
+
+/*
+ * Within an EPT batch, the IOTLB flush of the batch VM is deferred to
+ * ept_batch_end() as its EPT flush is, covering all the ranges modified.
+ */
+static void ept_iotlb_flush_request(const struct acrn_vm *vm, uint64_t gpa, uint64_t size)
+{
+	uint16_t pcpu_id = get_cpu_id();
+
+	if (vm->iommu == NULL) {
+		return;
+	}
+
+	if ((per_cpu(ept_batch, pcpu_id) != 0U) && (per_cpu(ept_batch_vm, pcpu_id) == vm)) {
+		if ((per_cpu(ept_batch_iotlb_end, pcpu_id) == 0UL) ||
+				(gpa < per_cpu(ept_batch_iotlb_start, pcpu_id))) {
+			per_cpu(ept_batch_iotlb_start, pcpu_id) = gpa;
+		}
+		if ((gpa + size) > per_cpu(ept_batch_iotlb_end, pcpu_id)) {
+			per_cpu(ept_batch_iotlb_end, pcpu_id) = gpa + size;
+		}
+	} else {
+		iommu_flush_iotlb(vm->iommu, gpa, size);
+	}
+}
+
+void ept_mr_coalesce(struct acrn_vm *vm, const uint64_t *pml4_page,
+		uint64_t gpa, uint64_t size)
+{
+	uint16_t pcpu_id = get_cpu_id();
+
+	if (pml4_page != vm->arch_vm.nworld_eptp) {
+		return;
+	}
+
+	if ((per_cpu(ept_batch, pcpu_id) != 0U) && (per_cpu(ept_batch_vm, pcpu_id) == vm)) {
+		if ((per_cpu(ept_batch_merge_end, pcpu_id) == 0UL) ||
+				(gpa < per_cpu(ept_batch_merge_start, pcpu_id))) {
+			per_cpu(ept_batch_merge_start, pcpu_id) = gpa;
+		}
+		if ((gpa + size) > per_cpu(ept_batch_merge_end, pcpu_id)) {
+			per_cpu(ept_batch_merge_end, pcpu_id) = gpa + size;
+		}
+	} else {
+		ept_coalesce(vm, gpa, size);
+	}
+}
+
+void ept_batch_begin(void)
+{
+	get_cpu_var(ept_batch)++;
+}
+
+void ept_batch_end(void)
+{
+	uint16_t pcpu_id = get_cpu_id();
+	struct acrn_vm *vm;
+	uint64_t start, end, iotlb_start, iotlb_end;
+
+	per_cpu(ept_batch, pcpu_id)--;
+	if (per_cpu(ept_batch, pcpu_id) == 0U) {
+		vm = (struct acrn_vm *)per_cpu(ept_batch_vm, pcpu_id);
+		iotlb_start = per_cpu(ept_batch_iotlb_start, pcpu_id);
+		iotlb_end = per_cpu(ept_batch_iotlb_end, pcpu_id);
+		start = per_cpu(ept_batch_merge_start, pcpu_id);
+		end = per_cpu(ept_batch_merge_end, pcpu_id);
+		per_cpu(ept_batch_vm, pcpu_id) = NULL;
+		per_cpu(ept_batch_iotlb_end, pcpu_id) = 0UL;
+		per_cpu(ept_batch_merge_end, pcpu_id) = 0UL;
+		if (vm != NULL) {
+			ept_flush_all_vcpus(vm);
+			if ((vm->iommu != NULL) && (iotlb_start < iotlb_end)) {
+				iommu_flush_iotlb(vm->iommu, iotlb_start, iotlb_end - iotlb_start);
+			}
+			if (start < end) {
+				ept_coalesce(vm, start, end - start);
+			}
+		}
+	}
+}
+
+void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
+	uint64_t hpa, uint64_t gpa, uint64_t size, uint64_t prot_orig)
+{
 	uint64_t prot = prot_orig;
 
 	dev_dbg(ACRN_DBG_EPT, "%s, vm[%d] hpa: 0x%016llx gpa: 0x%016llx size: 0x%016llx prot: 0x%016x\n",
@@ -200,18 +384,13 @@ void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page,
 
 	mmu_add(pml4_page, hpa, gpa, size, prot, &vm->arch_vm.ept_mem_ops);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	ept_flush_request(vm);
 }
 
 void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page,
 		uint64_t gpa, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
-
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
 
 	if ((prot_set & EPT_MT_MASK) != EPT_UNCACHED) {
@@ -220,23 +399,73 @@ void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page,
 
 	mmu_modify_or_del(pml4_page, gpa, size, prot_set, prot_clr, &vm->arch_vm.ept_mem_ops, MR_MODIFY);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
-	}
+	ept_flush_request(vm);
+	ept_iotlb_flush_request(vm, gpa, size);
 }
 /**
  * @pre [gpa,gpa+size) has been mapped into host physical memory region
  */
 void ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa, uint64_t size)
 {
-	struct acrn_vcpu *vcpu;
-	uint16_t i;
-
 	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
 
 	mmu_modify_or_del(pml4_page, gpa, size, 0UL, 0UL, &vm->arch_vm.ept_mem_ops, MR_DEL);
 
-	foreach_vcpu(i, vm, vcpu) {
-		vcpu_make_request(vcpu, ACRN_REQUEST_EPT_FLUSH);
+	ept_flush_request(vm);
+	ept_iotlb_flush_request(vm, gpa, size);
+}
+
+uint64_t ept_pointer(const struct acrn_vm *vm, void *pml4_page)
+{
+	uint64_t eptp = hva2hpa(pml4_page) | VMX_EPTP_PWL_4 | VMX_EPTP_MT_WB;
+
+	if (vm->arch_vm.ept_ad_enabled) {
+		eptp |= VMX_EPTP_AD_ENABLE_BIT;
+	}
+
+	return eptp;
+}
+
+/**
+ * @pre vm->arch_vm.ept_ad_enabled
+ */
+void ept_harvest_dirty(struct acrn_vm *vm, uint64_t gpa, uint64_t size,
+		ept_dirty_handler_t handler, void *data)
+{
+	uint64_t *pml4_page = (uint64_t *)vm->arch_vm.nworld_eptp;
+	uint64_t *pgentry, pg_size = 0UL;
+	uint64_t addr = gpa, gpa_end = gpa + size;
+	uint64_t base, next;
+	bool harvested = false;
+
+	dev_dbg(ACRN_DBG_EPT, "%s,vm[%d] gpa 0x%llx size 0x%llx\n", __func__, vm->vm_id, gpa, size);
+
+	while (addr < gpa_end) {
+		pgentry = lookup_address(pml4_page, addr, &pg_size, &vm->arch_vm.ept_mem_ops);
+		base = addr & ~(pg_size - 1UL);
+		next = base + pg_size;
+		/* a hole is skipped at once, whatever level it is missing at */
+		if ((pgentry != NULL) && ((*pgentry & EPT_DIRTY) != 0UL)) {
+			/*
+			 * A large page sticking out of the range keeps its
+			 * dirty flag, its pages outside the range are not
+			 * harvested yet.
+			 */
+			if ((base >= gpa) && (next <= gpa_end)) {
+				(void)bitmap_test_and_clear_lock(EPT_DIRTY_SHIFT, pgentry);
+				harvested = true;
+			}
+			handler(data, addr, ((next < gpa_end) ? next : gpa_end) - addr);
+		}
+		addr = next;
+	}
+
+	/*
+	 * Translations cached with the dirty flag set let writes through
+	 * without setting it again: they must be gone before the caller
+	 * relies on the harvest, a deferred flush is not enough.
+	 */
+	if (harvested) {
+		ept_flush_all_vcpus_sync(vm);
 	}
 }
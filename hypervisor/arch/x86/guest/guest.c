@@ -30,6 +30,8 @@ struct page_walk_info {
 
 	bool is_smap_on;
 	bool is_smep_on;
+
+	struct guest_walk *walk;	/* records the entries, if not NULL */
 };
 
 uint64_t vcpumask2pcpumask(struct acrn_vm *vm, uint64_t vdmask)
@@ -70,6 +72,16 @@ enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu)
 	}
 }
 
+static inline void guest_walk_record(struct guest_walk *walk, const void *entry,
+	uint64_t value)
+{
+	if (walk->num < GUEST_WALK_MAX_LEVELS) {
+		walk->entry[walk->num] = entry;
+		walk->value[walk->num] = value;
+		walk->num++;
+	}
+}
+
 /* TODO: Add code to check for Revserved bits, SMAP and PKE when do translation
  * during page walk */
 static int local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_walk_info *pw_info,
@@ -78,7 +90,7 @@ static int local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_walk_i
 	uint32_t i;
 	uint64_t index;
 	uint32_t shift;
-	void *base;
+	void *base, *entry_ptr;
 	uint64_t entry;
 	uint64_t addr, page_size;
 	int ret = 0;
@@ -110,9 +122,15 @@ static int local_gva2gpa_common(struct acrn_vcpu *vcpu, const struct page_walk_i
 			uint32_t *base32 = (uint32_t *)base;
 			/* 32bit entry */
 			entry = (uint64_t)(*(base32 + index));
+			entry_ptr = (void *)(base32 + index);
 		} else {
 			uint64_t *base64 = (uint64_t *)base;
 			entry = *(base64 + index);
+			entry_ptr = (void *)(base64 + index);
+		}
+
+		if (pw_info->walk != NULL) {
+			guest_walk_record(pw_info->walk, entry_ptr, entry);
 		}
 
 		/* check if the entry present */
@@ -237,6 +255,9 @@ static int local_gva2gpa_pae(struct acrn_vcpu *vcpu, struct page_walk_info *pw_i
 
 	index = (gva >> 30U) & 0x3UL;
 	entry = base[index];
+	if (pw_info->walk != NULL) {
+		guest_walk_record(pw_info->walk, &base[index], entry);
+	}
 
 	if ((entry & PAGE_PRESENT) == 0U) {
 		ret = -EFAULT;
@@ -269,8 +290,8 @@ out:
  * - Return -EFAULT for paging fault, and refer to err_code for paging fault
  *   error code.
  */
-int gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
-	uint32_t *err_code)
+static int local_gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
+	uint32_t *err_code, struct guest_walk *walk)
 {
 	enum vm_paging_mode pm = get_vcpu_paging_mode(vcpu);
 	struct page_walk_info pw_info;
@@ -281,6 +302,12 @@ int gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	}
 	*gpa = 0UL;
 
+	pw_info.walk = walk;
+	if (walk != NULL) {
+		walk->num = 0U;
+		walk->entry32 = (pm == PAGING_MODE_2_LEVEL);
+	}
+
 	pw_info.top_entry = exec_vmread(VMX_GUEST_CR3);
 	pw_info.level = (uint32_t)pm;
 	pw_info.is_write_access = ((*err_code & PAGE_FAULT_WR_FLAG) != 0U);
@@ -327,6 +354,44 @@ int gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
 	return ret;
 }
 
+int gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
+	uint32_t *err_code)
+{
+	return local_gva2gpa(vcpu, gva, gpa, err_code, NULL);
+}
+
+int gva2gpa_walk(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
+	uint32_t *err_code, struct guest_walk *walk)
+{
+	return local_gva2gpa(vcpu, gva, gpa, err_code, walk);
+}
+
+/*
+ * The accessed and dirty flags the CPU sets while the guest runs do not
+ * change the translation, so they are ignored.
+ */
+bool guest_walk_unchanged(const struct guest_walk *walk)
+{
+	uint32_t i;
+	uint64_t value;
+	bool ret = true;
+
+	for (i = 0U; i < walk->num; i++) {
+		if (walk->entry32) {
+			value = (uint64_t)(*(const volatile uint32_t *)walk->entry[i]);
+		} else {
+			value = *(const volatile uint64_t *)walk->entry[i];
+		}
+
+		if (((value ^ walk->value[i]) & ~(PAGE_ACCESSED | PAGE_DIRTY)) != 0UL) {
+			ret = false;
+			break;
+		}
+	}
+
+	return ret;
+}
+
 static inline uint32_t local_copy_gpa(struct acrn_vm *vm, void *h_ptr, uint64_t gpa,
 	uint32_t size, uint32_t fix_pg_size, bool cp_from_vm)
 {
@@ -703,6 +768,8 @@ int prepare_vm0_memmap_and_e820(struct acrn_vm *vm)
 		panic("Please configure VM0_ADDRESS_SPACE correctly!\n");
 	}
 
+	ept_batch_begin();
+
 	/* create real ept map for all ranges with UC */
 	ept_mr_add(vm, pml4_page,
 			e820_mem.mem_bottom, e820_mem.mem_bottom,
@@ -734,6 +801,8 @@ int prepare_vm0_memmap_and_e820(struct acrn_vm *vm)
 	 */
 	hv_hpa = get_hv_image_base();
 	ept_mr_del(vm, pml4_page, hv_hpa, CONFIG_HV_RAM_SIZE);
+
+	ept_batch_end();
 	return 0;
 }
 
@@ -322,7 +322,7 @@ static uint32_t get_vmcs_field(enum cpu_reg_name ident)
  * @pre ((reg <= CPU_REG_LAST) && (reg >= CPU_REG_FIRST))
  * @pre ((reg != CPU_REG_CR2) && (reg != CPU_REG_IDTR) && (reg != CPU_REG_GDTR))
  */
-static uint64_t vm_get_register(const struct acrn_vcpu *vcpu, enum cpu_reg_name reg)
+static uint64_t vm_get_register(struct acrn_vcpu *vcpu, enum cpu_reg_name reg)
 {
 	uint64_t reg_val = 0UL;
 	
@@ -534,7 +534,7 @@ static void vie_calc_bytereg(const struct instr_emul_vie *vie,
 	}
 }
 
-static uint8_t vie_read_bytereg(const struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie)
+static uint8_t vie_read_bytereg(struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie)
 {
 	int lhbr;
 	uint64_t val;
@@ -866,7 +866,7 @@ static int emulate_movx(struct acrn_vcpu *vcpu, const struct instr_emul_vie *vie
  *
  * It's only used by MOVS/STO
  */
-static void get_gva_si_nocheck(const struct acrn_vcpu *vcpu, uint8_t addrsize,
+static void get_gva_si_nocheck(struct acrn_vcpu *vcpu, uint8_t addrsize,
 		enum cpu_reg_name seg, uint64_t *gva)
 {
 	uint64_t val;
@@ -1584,12 +1584,18 @@ static int vmm_emulate_instruction(struct instr_emul_ctxt *ctxt)
 	return error;
 }
 
-static int vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu)
+/*
+ * Fetch the instruction bytes. If the instruction does not cross a page,
+ * the guest paging entries mapping it and its HV address are kept in the
+ * cache entry, so that the decode can be reused later.
+ */
+static int vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu,
+		struct instr_cache_entry *entry)
 {
 	uint64_t guest_rip_gva = vcpu_get_rip(vcpu);
-	uint32_t inst_len = vcpu->arch.inst_len;
+	uint32_t inst_len = vcpu_get_inst_len(vcpu);
 	uint32_t err_code;
-	uint64_t fault_addr;
+	uint64_t fault_addr, gpa, hpa;
 	int ret;
 
 	if ((inst_len > VIE_INST_SIZE) || (inst_len == 0U)) {
@@ -1606,8 +1612,25 @@ static int vie_init(struct instr_emul_vie *vie, struct acrn_vcpu *vcpu)
 	vie->segment_register = CPU_REG_LAST;
 
 	err_code = PAGE_FAULT_ID_FLAG;
-	ret = copy_from_gva(vcpu, vie->inst, guest_rip_gva,
+	entry->code = NULL;
+	if (((guest_rip_gva ^ (guest_rip_gva + inst_len - 1UL)) & PAGE_MASK) == 0UL) {
+		fault_addr = guest_rip_gva;
+		ret = gva2gpa_walk(vcpu, guest_rip_gva, &gpa, &err_code,
+				&entry->walk);
+		if (ret == 0) {
+			hpa = gpa2hpa(vcpu->vm, gpa);
+			if (hpa == INVALID_HPA) {
+				ret = -EINVAL;
+			} else {
+				entry->code = (const uint8_t *)hpa2hva(hpa);
+				(void)memcpy_s(vie->inst, inst_len,
+						entry->code, inst_len);
+			}
+		}
+	} else {
+		ret = copy_from_gva(vcpu, vie->inst, guest_rip_gva,
 				inst_len, &err_code, &fault_addr);
+	}
 	if (ret < 0) {
 		if (ret == -EFAULT) {
 			vcpu_inject_pf(vcpu, fault_addr, err_code);
@@ -2242,12 +2265,67 @@ static int instr_check_gva(struct acrn_vcpu *vcpu, struct instr_emul_ctxt *emul_
 	return 0;
 }
 
+static int64_t inst_cache_seq;
+
+/*
+ * Drop the cached decodes of a vCPU: on reset and on EPT changes, which
+ * may move the guest memory the cached HV addresses point to.
+ */
+void instr_cache_invalidate(struct acrn_vcpu *vcpu)
+{
+	vcpu->arch.inst_cache_gen = (uint64_t)atomic_xadd64(&inst_cache_seq, 1L) + 1UL;
+}
+
+/*
+ * Everything besides CR3 the instruction fetch translation depends on
+ */
+static uint64_t instr_cache_paging(struct acrn_vcpu *vcpu)
+{
+	uint64_t cpl = ((uint64_t)exec_vmread32(VMX_GUEST_SS_ATTR) >> 5U) & 0x3UL;
+
+	return (vcpu_get_cr0(vcpu) & (CR0_PE | CR0_WP | CR0_PG)) |
+		(vcpu_get_efer(vcpu) & (MSR_IA32_EFER_LMA_BIT | MSR_IA32_EFER_NXE_BIT)) |
+		((vcpu_get_cr4(vcpu) & (CR4_PSE | CR4_PAE | CR4_SMEP | CR4_SMAP)) << 32U) |
+		((uint64_t)vcpu->arch.cur_context << 60U) | (cpl << 62U);
+}
+
+static bool instr_cache_hit(struct acrn_vcpu *vcpu,
+		const struct instr_cache_entry *entry, uint64_t cr3,
+		uint64_t rip, uint64_t paging, uint32_t csar)
+{
+	uint8_t i;
+	bool hit;
+
+	hit = (entry->vcpu == vcpu) && (entry->gen == vcpu->arch.inst_cache_gen) &&
+		(entry->rip == rip) && (entry->cr3 == cr3) &&
+		(entry->paging == paging) && (entry->csar == csar) &&
+		(entry->vie.num_valid == vcpu_get_inst_len(vcpu)) &&
+		guest_walk_unchanged(&entry->walk);
+
+	/* the guest may have rewritten the instruction in place */
+	for (i = 0U; hit && (i < entry->vie.num_valid); i++) {
+		hit = (entry->code[i] == entry->vie.inst[i]);
+	}
+
+	return hit;
+}
+
+/*
+ * Decoding an MMIO access walks the guest page tables to fetch the
+ * instruction, then decodes it. Drivers access MMIO from a few places in
+ * loops, so the decode is cached per physical CPU, keyed by the vCPU,
+ * CR3, RIP and paging controls. A cached decode is only used while the
+ * guest paging entries that mapped the instruction and the instruction
+ * bytes are unchanged.
+ */
 int decode_instruction(struct acrn_vcpu *vcpu)
 {
 	struct instr_emul_ctxt *emul_ctxt;
+	struct instr_cache_entry *entry;
 	uint32_t csar;
 	int retval;
 	enum vm_cpu_mode cpu_mode;
+	uint64_t rip, cr3, paging;
 
 	emul_ctxt = &per_cpu(g_inst_ctxt, vcpu->pcpu_id);
 	if (emul_ctxt == NULL) {
@@ -2256,29 +2334,51 @@ int decode_instruction(struct acrn_vcpu *vcpu)
 	}
 	emul_ctxt->vcpu = vcpu;
 
-	retval = vie_init(&emul_ctxt->vie, vcpu);
-	if (retval < 0) {
-		if (retval != -EFAULT) {
-			pr_err("init vie failed @ 0x%016llx:",
-				vcpu_get_rip(vcpu));
-		}
-		return retval;
-	}
-
 	csar = exec_vmread32(VMX_GUEST_CS_ATTR);
-	get_guest_paging_info(vcpu, emul_ctxt, csar);
 	cpu_mode = get_vcpu_mode(vcpu);
+	rip = vcpu_get_rip(vcpu);
+	cr3 = exec_vmread(VMX_GUEST_CR3);
+	paging = instr_cache_paging(vcpu);
+	entry = &per_cpu(g_inst_cache, vcpu->pcpu_id).entries[
+		(rip ^ (rip >> 6U)) & (INSTR_CACHE_ENTRIES - 1U)];
+
+	if (instr_cache_hit(vcpu, entry, cr3, rip, paging, csar)) {
+		(void)memcpy_s(&emul_ctxt->vie, sizeof(struct instr_emul_vie),
+				&entry->vie, sizeof(struct instr_emul_vie));
+	} else {
+		entry->vcpu = NULL;
 
-	retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar),
-		&emul_ctxt->vie);
+		retval = vie_init(&emul_ctxt->vie, vcpu, entry);
+		if (retval < 0) {
+			if (retval != -EFAULT) {
+				pr_err("init vie failed @ 0x%016llx:", rip);
+			}
+			return retval;
+		}
 
-	if (retval != 0) {
-		pr_err("decode instruction failed @ 0x%016llx:",
-			vcpu_get_rip(vcpu));
-		vcpu_inject_ud(vcpu);
-		return -EFAULT;
+		retval = local_decode_instruction(cpu_mode, seg_desc_def32(csar),
+			&emul_ctxt->vie);
+
+		if (retval != 0) {
+			pr_err("decode instruction failed @ 0x%016llx:", rip);
+			vcpu_inject_ud(vcpu);
+			return -EFAULT;
+		}
+
+		if (entry->code != NULL) {
+			entry->vcpu = vcpu;
+			entry->gen = vcpu->arch.inst_cache_gen;
+			entry->cr3 = cr3;
+			entry->rip = rip;
+			entry->paging = paging;
+			entry->csar = csar;
+			(void)memcpy_s(&entry->vie, sizeof(struct instr_emul_vie),
+					&emul_ctxt->vie, sizeof(struct instr_emul_vie));
+		}
 	}
 
+	get_guest_paging_info(vcpu, emul_ctxt, csar);
+
 	/*
 	 * We do operand check in instruction decode phase and
 	 * inject exception accordingly. In late instruction
@@ -194,7 +194,29 @@ struct instr_emul_ctxt {
 	struct acrn_vcpu *vcpu;
 };
 
+/*
+ * Per physical CPU cache of decoded instructions, see decode_instruction()
+ */
+#define INSTR_CACHE_ENTRIES	8U
+
+struct instr_cache_entry {
+	const struct acrn_vcpu *vcpu;	/* owner, NULL if unused */
+	uint64_t gen;			/* owner's inst_cache_gen */
+	uint64_t cr3;
+	uint64_t rip;
+	uint64_t paging;		/* paging controls, CPL and world */
+	uint32_t csar;
+	const uint8_t *code;		/* HV address of the instruction */
+	struct guest_walk walk;		/* guest paging entries mapping it */
+	struct instr_emul_vie vie;	/* decoded instruction */
+};
+
+struct instr_cache {
+	struct instr_cache_entry entries[INSTR_CACHE_ENTRIES];
+};
+
 int32_t emulate_instruction(const struct acrn_vcpu *vcpu);
 int decode_instruction(struct acrn_vcpu *vcpu);
+void instr_cache_invalidate(struct acrn_vcpu *vcpu);
 
 #endif
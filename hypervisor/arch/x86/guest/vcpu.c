@@ -7,14 +7,19 @@
 #include <hypervisor.h>
 #include <schedule.h>
 #include <vm0_boot.h>
+#include "instr_emul.h"
 
 vm_sw_loader_t vm_sw_loader;
 
-inline uint64_t vcpu_get_gpreg(const struct acrn_vcpu *vcpu, uint32_t reg)
+inline uint64_t vcpu_get_gpreg(struct acrn_vcpu *vcpu, uint32_t reg)
 {
 	const struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
+	/* RSP is not saved on VM exit, but kept in the VMCS */
+	if (reg == CPU_REG_RSP) {
+		return vcpu_get_rsp(vcpu);
+	}
 	return ctx->guest_cpu_regs.longs[reg];
 }
 
@@ -23,7 +28,11 @@ inline void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val)
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
-	ctx->guest_cpu_regs.longs[reg] = val;
+	if (reg == CPU_REG_RSP) {
+		vcpu_set_rsp(vcpu, val);
+	} else {
+		ctx->guest_cpu_regs.longs[reg] = val;
+	}
 }
 
 inline uint64_t vcpu_get_rip(struct acrn_vcpu *vcpu)
@@ -43,11 +52,23 @@ inline void vcpu_set_rip(struct acrn_vcpu *vcpu, uint64_t val)
 	bitmap_set_lock(CPU_REG_RIP, &vcpu->reg_updated);
 }
 
+inline uint32_t vcpu_get_inst_len(struct acrn_vcpu *vcpu)
+{
+	if (bitmap_test_and_set_lock(VCPU_CACHED_INST_LEN,
+			&vcpu->reg_cached) == 0)
+		vcpu->arch.inst_len = exec_vmread32(VMX_EXIT_INSTR_LEN);
+	return vcpu->arch.inst_len;
+}
+
 inline uint64_t vcpu_get_rsp(struct acrn_vcpu *vcpu)
 {
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 
+	if (bitmap_test(CPU_REG_RSP, &vcpu->reg_updated) == 0 &&
+		bitmap_test_and_set_lock(CPU_REG_RSP,
+			&vcpu->reg_cached) == 0 && vcpu->launched)
+		ctx->guest_cpu_regs.regs.rsp = exec_vmread(VMX_GUEST_RSP);
 	return ctx->guest_cpu_regs.regs.rsp;
 }
 
@@ -76,6 +97,7 @@ inline void vcpu_set_efer(struct acrn_vcpu *vcpu, uint64_t val)
 	vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx.ia32_efer
 		= val;
 	bitmap_set_lock(CPU_REG_EFER, &vcpu->reg_updated);
+	bitmap_clear_lock(VCPU_CACHED_CPU_MODE, &vcpu->reg_cached);
 }
 
 inline uint64_t vcpu_get_rflags(struct acrn_vcpu *vcpu)
@@ -178,6 +200,20 @@ static void set_vcpu_mode(struct acrn_vcpu *vcpu, uint32_t cs_attr, uint64_t ia3
 	} else {
 		vcpu->arch.cpu_mode = CPU_MODE_REAL;
 	}
+	bitmap_set_lock(VCPU_CACHED_CPU_MODE, &vcpu->reg_cached);
+}
+
+/*
+ * Before launch, the mode set by set_vcpu_regs() is used, as the VMCS
+ * may not be loaded yet.
+ */
+enum vm_cpu_mode get_vcpu_mode(struct acrn_vcpu *vcpu)
+{
+	if (vcpu->launched &&
+		bitmap_test(VCPU_CACHED_CPU_MODE, &vcpu->reg_cached) == 0)
+		set_vcpu_mode(vcpu, exec_vmread32(VMX_GUEST_CS_ATTR),
+			vcpu_get_efer(vcpu), vcpu_get_cr0(vcpu));
+	return vcpu->arch.cpu_mode;
 }
 
 void set_vcpu_regs(struct acrn_vcpu *vcpu, struct acrn_vcpu_regs *vcpu_regs)
@@ -298,6 +334,59 @@ void set_ap_entry(struct acrn_vcpu *vcpu, uint64_t entry)
 	vcpu_set_rip(vcpu, 0UL);
 }
 
+static inline void fxsave(struct xsave_area *area)
+{
+	asm volatile("fxsave64 (%0)" : : "r" (area) : "memory");
+}
+
+static inline void fxrstor(const struct xsave_area *area)
+{
+	asm volatile("fxrstor64 (%0)" : : "r" (area));
+}
+
+static inline void xsave(struct xsave_area *area, uint64_t mask)
+{
+	asm volatile("xsave64 (%0)"
+			: : "r" (area), "a" ((uint32_t)mask), "d" ((uint32_t)(mask >> 32U))
+			: "memory");
+}
+
+static inline void xrstor(const struct xsave_area *area, uint64_t mask)
+{
+	asm volatile("xrstor64 (%0)"
+			: : "r" (area), "a" ((uint32_t)mask), "d" ((uint32_t)(mask >> 32U)));
+}
+
+static inline void xsaves(struct xsave_area *area, uint64_t mask)
+{
+	asm volatile("xsaves64 (%0)"
+			: : "r" (area), "a" ((uint32_t)mask), "d" ((uint32_t)(mask >> 32U))
+			: "memory");
+}
+
+static inline void xrstors(const struct xsave_area *area, uint64_t mask)
+{
+	asm volatile("xrstors64 (%0)"
+			: : "r" (area), "a" ((uint32_t)mask), "d" ((uint32_t)(mask >> 32U)));
+}
+
+/*
+ * Power-up values: XCR0 with x87 state only, MXCSR with all the exceptions
+ * masked, and an XSAVE header restoring the initial state of everything.
+ */
+static void init_vcpu_shared_state(struct acrn_vcpu *vcpu)
+{
+	struct shared_state *state = &vcpu->arch.shared_state;
+
+	state->xcr0 = 1UL;
+	/* MXCSR is at byte 24 of the legacy region */
+	state->xsave_area.legacy_region[3] = 0x1F80UL;
+	if (cpu_has_cap(X86_FEATURE_XSAVES)) {
+		/* XRSTORS requires the compacted format */
+		state->xsave_area.xcomp_bv = 1UL << 63U;
+	}
+}
+
 /***********************************************************************
  *
  *  @pre vm != NULL && rtn_vcpu_handle != NULL
@@ -337,7 +426,6 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
 	/* Initialize CPU ID for this VCPU */
 	vcpu->vcpu_id = vcpu_id;
 	vcpu->pcpu_id = pcpu_id;
-	per_cpu(ever_run_vcpu, pcpu_id) = vcpu;
 
 	/* Initialize the parent VM reference */
 	vcpu->vm = vm;
@@ -350,8 +438,6 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
 	 * needs revise.
 	 */
 
-	per_cpu(vcpu, pcpu_id) = vcpu;
-
 	pr_info("PCPU%d is working as VM%d VCPU%d, Role: %s",
 			vcpu->pcpu_id, vcpu->vm->vm_id, vcpu->vcpu_id,
 			is_vcpu_bsp(vcpu) ? "PRIMARY" : "SECONDARY");
@@ -364,6 +450,11 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
 	/* Initialize cur context */
 	vcpu->arch.cur_context = NORMAL_WORLD;
 
+	init_vcpu_shared_state(vcpu);
+
+	/* Don't pick up decodes cached for a previous vcpu at this address */
+	instr_cache_invalidate(vcpu);
+
 	/* Create per vcpu vlapic */
 	vlapic_create(vcpu);
 
@@ -377,6 +468,7 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
 	vcpu->launched = false;
 	vcpu->paused_cnt = 0U;
 	vcpu->running = 0;
+	vcpu->halted = 0U;
 	vcpu->arch.nr_sipi = 0;
 	vcpu->pending_pre_work = 0U;
 	vcpu->state = VCPU_INIT;
@@ -392,14 +484,22 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
  */
 int run_vcpu(struct acrn_vcpu *vcpu)
 {
-	uint32_t instlen, cs_attr;
-	uint64_t rip, ia32_efer, cr0;
+	uint32_t instlen;
 	struct run_context *ctx =
 		&vcpu->arch.contexts[vcpu->arch.cur_context].run_ctx;
 	int64_t status = 0;
 
+	/*
+	 * Only the guest state modified since the last VM exit is written
+	 * back. The RIP is advanced past the exiting instruction unless
+	 * vcpu_retain_rip() was called, which does not need RIP at all.
+	 */
+	instlen = vcpu->launched ? vcpu_get_inst_len(vcpu) : 0U;
 	if (bitmap_test_and_clear_lock(CPU_REG_RIP, &vcpu->reg_updated))
-		exec_vmwrite(VMX_GUEST_RIP, ctx->rip);
+		exec_vmwrite(VMX_GUEST_RIP, ctx->rip + (uint64_t)instlen);
+	else if (instlen != 0U)
+		exec_vmwrite(VMX_GUEST_RIP,
+			vcpu_get_rip(vcpu) + (uint64_t)instlen);
 	if (bitmap_test_and_clear_lock(CPU_REG_RSP, &vcpu->reg_updated))
 		exec_vmwrite(VMX_GUEST_RSP, ctx->guest_cpu_regs.regs.rsp);
 	if (bitmap_test_and_clear_lock(CPU_REG_EFER, &vcpu->reg_updated))
@@ -447,13 +547,7 @@ int run_vcpu(struct acrn_vcpu *vcpu)
 			}
 		}
 	} else {
-		/* This VCPU was already launched, check if the last guest
-		 * instruction needs to be repeated and resume VCPU accordingly
-		 */
-		instlen = vcpu->arch.inst_len;
-		rip = vcpu_get_rip(vcpu);
-		exec_vmwrite(VMX_GUEST_RIP, ((rip+(uint64_t)instlen) &
-				0xFFFFFFFFFFFFFFFFUL));
+		/* This VCPU was already launched, resume it */
 #ifdef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
@@ -462,18 +556,12 @@ int run_vcpu(struct acrn_vcpu *vcpu)
 		status = vmx_vmrun(ctx, VM_RESUME, ibrs_type);
 	}
 
+	/*
+	 * Guest state (RIP, RSP, EFER, CR0, CPU mode, instruction length...)
+	 * is read from the VMCS on demand by the vcpu_get_*() accessors.
+	 */
 	vcpu->reg_cached = 0UL;
 
-	cs_attr = exec_vmread32(VMX_GUEST_CS_ATTR);
-	ia32_efer = vcpu_get_efer(vcpu);
-	cr0 = vcpu_get_cr0(vcpu);
-	set_vcpu_mode(vcpu, cs_attr, ia32_efer, cr0);
-
-	/* Obtain current VCPU instruction length */
-	vcpu->arch.inst_len = exec_vmread32(VMX_EXIT_INSTR_LEN);
-
-	ctx->guest_cpu_regs.regs.rsp = exec_vmread(VMX_GUEST_RSP);
-
 	/* Obtain VM exit reason */
 	vcpu->arch.exit_reason = exec_vmread32(VMX_EXIT_REASON);
 
@@ -490,6 +578,66 @@ int run_vcpu(struct acrn_vcpu *vcpu)
 	return status;
 }
 
+void save_vcpu_shared_state(struct acrn_vcpu *vcpu)
+{
+	struct shared_state *state = &vcpu->arch.shared_state;
+	uint64_t xcr0_all = boot_cpu_data.xcr0_supported;
+
+	state->ia32_star = msr_read(MSR_IA32_STAR);
+	state->ia32_lstar = msr_read(MSR_IA32_LSTAR);
+	state->ia32_cstar = msr_read(MSR_IA32_CSTAR);
+	state->ia32_fmask = msr_read(MSR_IA32_FMASK);
+	state->ia32_kernel_gs_base = msr_read(MSR_IA32_KERNEL_GS_BASE);
+
+	if (cpu_has_cap(X86_FEATURE_XSAVE)) {
+		/*
+		 * Save every component, not only the ones the guest XCR0
+		 * enables: SSE registers are usable with XCR0[1] clear too.
+		 */
+		state->xcr0 = read_xcr(0);
+		if (state->xcr0 != xcr0_all) {
+			write_xcr(0, xcr0_all);
+		}
+		if (cpu_has_cap(X86_FEATURE_XSAVES)) {
+			state->ia32_xss = msr_read(MSR_IA32_XSS);
+			xsaves(&state->xsave_area, xcr0_all | state->ia32_xss);
+		} else {
+			xsave(&state->xsave_area, xcr0_all);
+		}
+	} else {
+		fxsave(&state->xsave_area);
+	}
+}
+
+void load_vcpu_shared_state(const struct acrn_vcpu *vcpu)
+{
+	const struct shared_state *state = &vcpu->arch.shared_state;
+	uint64_t xcr0_all = boot_cpu_data.xcr0_supported;
+
+	msr_write(MSR_IA32_STAR, state->ia32_star);
+	msr_write(MSR_IA32_LSTAR, state->ia32_lstar);
+	msr_write(MSR_IA32_CSTAR, state->ia32_cstar);
+	msr_write(MSR_IA32_FMASK, state->ia32_fmask);
+	msr_write(MSR_IA32_KERNEL_GS_BASE, state->ia32_kernel_gs_base);
+
+	if (cpu_has_cap(X86_FEATURE_XSAVE)) {
+		if (read_xcr(0) != xcr0_all) {
+			write_xcr(0, xcr0_all);
+		}
+		if (cpu_has_cap(X86_FEATURE_XSAVES)) {
+			msr_write(MSR_IA32_XSS, state->ia32_xss);
+			xrstors(&state->xsave_area, xcr0_all | state->ia32_xss);
+		} else {
+			xrstor(&state->xsave_area, xcr0_all);
+		}
+		if (state->xcr0 != xcr0_all) {
+			write_xcr(0, state->xcr0);
+		}
+	} else {
+		fxrstor(&state->xsave_area);
+	}
+}
+
 int shutdown_vcpu(__unused struct acrn_vcpu *vcpu)
 {
 	/* TODO : Implement VCPU shutdown sequence */
@@ -503,7 +651,13 @@ int shutdown_vcpu(__unused struct acrn_vcpu *vcpu)
 void offline_vcpu(struct acrn_vcpu *vcpu)
 {
 	vlapic_free(vcpu);
-	per_cpu(ever_run_vcpu, vcpu->pcpu_id) = NULL;
+	if (per_cpu(ever_run_vcpu, vcpu->pcpu_id) == vcpu) {
+		per_cpu(ever_run_vcpu, vcpu->pcpu_id) = NULL;
+	}
+	if (per_cpu(vcpu, vcpu->pcpu_id) == vcpu) {
+		per_cpu(vcpu, vcpu->pcpu_id) = NULL;
+	}
+	detach_vcpu_from_pcpu(vcpu);
 	free_pcpu(vcpu->pcpu_id);
 	vcpu->state = VCPU_OFFLINE;
 }
@@ -528,6 +682,7 @@ void reset_vcpu(struct acrn_vcpu *vcpu)
 	vcpu->launched = false;
 	vcpu->paused_cnt = 0U;
 	vcpu->running = 0;
+	vcpu->halted = 0U;
 	vcpu->arch.nr_sipi = 0;
 	vcpu->pending_pre_work = 0U;
 
@@ -542,6 +697,7 @@ void reset_vcpu(struct acrn_vcpu *vcpu)
 			sizeof(struct run_context));
 	}
 	vcpu->arch.cur_context = NORMAL_WORLD;
+	instr_cache_invalidate(vcpu);
 
 	vlapic = vcpu_vlapic(vcpu);
 	vlapic_reset(vlapic);
@@ -559,6 +715,8 @@ void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state)
 	get_schedule_lock(vcpu->pcpu_id);
 	vcpu->prev_state = vcpu->state;
 	vcpu->state = new_state;
+	/* off the runqueue either way, resume_vcpu() puts it back */
+	atomic_store32(&vcpu->halted, 0U);
 
 	if (atomic_load32(&vcpu->running) == 1U) {
 		remove_vcpu_from_runqueue(vcpu);
@@ -589,6 +747,41 @@ void resume_vcpu(struct acrn_vcpu *vcpu)
 	release_schedule_lock(vcpu->pcpu_id);
 }
 
+void halt_vcpu(struct acrn_vcpu *vcpu)
+{
+	get_schedule_lock(vcpu->pcpu_id);
+	/*
+	 * Publish halted before checking pending_req: vcpu_make_request()
+	 * sets pending_req before checking halted, so either the event is
+	 * seen here or the waker sees halted. The swap is a full barrier.
+	 */
+	(void)atomic_swap32(&vcpu->halted, 1U);
+	if ((vcpu->state == VCPU_RUNNING) && (vcpu->arch.pending_req == 0UL)) {
+		remove_vcpu_from_runqueue(vcpu);
+		make_reschedule_request(vcpu);
+	} else {
+		atomic_store32(&vcpu->halted, 0U);
+	}
+	release_schedule_lock(vcpu->pcpu_id);
+}
+
+bool wake_vcpu(struct acrn_vcpu *vcpu)
+{
+	bool woken = false;
+
+	if (atomic_load32(&vcpu->halted) == 1U) {
+		get_schedule_lock(vcpu->pcpu_id);
+		if (atomic_swap32(&vcpu->halted, 0U) == 1U) {
+			add_vcpu_to_runqueue(vcpu);
+			make_reschedule_request(vcpu);
+			woken = true;
+		}
+		release_schedule_lock(vcpu->pcpu_id);
+	}
+
+	return woken;
+}
+
 void schedule_vcpu(struct acrn_vcpu *vcpu)
 {
 	vcpu->state = VCPU_RUNNING;
@@ -600,7 +793,10 @@ void schedule_vcpu(struct acrn_vcpu *vcpu)
 	release_schedule_lock(vcpu->pcpu_id);
 }
 
-/* help function for vcpu create */
+/* help function for vcpu create
+ *
+ * @pre pcpu_id has been reserved by allocate_pcpu() or set_pcpu_used()
+ */
 int prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 {
 	int ret = 0;
@@ -611,7 +807,7 @@ int prepare_vcpu(struct acrn_vm *vm, uint16_t pcpu_id)
 		return ret;
 	}
 
-	set_pcpu_used(pcpu_id);
+	attach_vcpu_to_pcpu(vcpu);
 
 	INIT_LIST_HEAD(&vcpu->run_list);
 
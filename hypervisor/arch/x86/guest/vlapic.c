@@ -495,10 +495,14 @@ vlapic_set_intr_ready(struct acrn_vlapic *vlapic, uint32_t vector, bool level)
 			 *    record this request as ACRN_REQUEST_EVENT,then
 			 *    will pick up the interrupt from PIR and inject
 			 *    it to vCPU in next vmentry.
+			 * 3. If target vCPU is parked by guest HLT, put it
+			 *    back to run as in case 2.
 			 */
 			bitmap_set_lock(ACRN_REQUEST_EVENT,
 				&vlapic->vcpu->arch.pending_req);
-			vlapic_post_intr(vlapic->vcpu->pcpu_id);
+			if (!wake_vcpu(vlapic->vcpu)) {
+				vlapic_post_intr(vlapic->vcpu->pcpu_id);
+			}
 			return 0;
 		}
 		return pending_intr;
@@ -2322,6 +2326,27 @@ apicv_pending_intr(const struct acrn_vlapic *vlapic)
 	return 0;
 }
 
+/*
+ * With virtual-interrupt delivery, a vector already moved from the PIR into
+ * RVI is no longer seen by apicv_pending_intr(), yet the CPU delivers it at
+ * VM entry when it beats the vPPR.
+ *
+ * @pre vlapic belongs to the vcpu of the current VMCS
+ */
+bool vlapic_apicv_rvi_pending(const struct acrn_vlapic *vlapic)
+{
+	uint32_t rvi, ppr;
+	bool ret = false;
+
+	if (is_apicv_intr_delivery_supported()) {
+		rvi = (uint32_t)exec_vmread16(VMX_GUEST_INTR_STATUS) & 0xFFU;
+		ppr = vlapic->apic_page.ppr.v;
+		ret = ((rvi & 0xF0U) > (ppr & 0xF0U));
+	}
+
+	return ret;
+}
+
 /* Update the VMX_EOI_EXIT according to related tmr */
 #define	EOI_STEP_LEN	(64U)
 #define	TMR_STEP_LEN	(32U)
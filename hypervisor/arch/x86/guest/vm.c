@@ -86,6 +86,8 @@ int create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 #endif
 	vm->hw.created_vcpus = 0U;
 	vm->emul_mmio_regions = 0U;
+	spinlock_init(&vm->posted_ioreq.lock);
+	spinlock_init(&vm->doorbell.lock);
 
 	/* gpa_lowtop are used for system start up */
 	vm->hw.gpa_lowtop = 0UL;
@@ -111,6 +113,7 @@ int create_vm(struct vm_description *vm_desc, struct acrn_vm **rtn_vm)
 	} else {
 		/* populate UOS vm fields according to vm_desc */
 		vm->sworld_control.flag.supported = vm_desc->sworld_supported;
+		vm->arch_vm.ept_ad_enabled = vm_desc->dirty_logging;
 		if (vm->sworld_control.flag.supported != 0UL) {
 			struct memory_ops *ept_mem_ops = &vm->arch_vm.ept_mem_ops;
 			ept_mr_add(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
@@ -363,11 +366,14 @@ int prepare_vm(uint16_t pcpu_id)
 
 		mptable_build(vm);
 
+		set_pcpu_used(vm_desc->vm_pcpu_ids[0]);
 		prepare_vcpu(vm, vm_desc->vm_pcpu_ids[0]);
 
 		/* Prepare the AP for vm */
-		for (i = 1U; i < vm_desc->vm_hw_num_cores; i++)
+		for (i = 1U; i < vm_desc->vm_hw_num_cores; i++) {
+			set_pcpu_used(vm_desc->vm_pcpu_ids[i]);
 			prepare_vcpu(vm, vm_desc->vm_pcpu_ids[i]);
+		}
 
 		if (vm_sw_loader == NULL) {
 			vm_sw_loader = general_sw_loader;
@@ -404,6 +410,7 @@ static int prepare_vm0(void)
 
 	/* Allocate all cpus to vm0 at the beginning */
 	for (i = 0U; i < vm0_desc.vm_hw_num_cores; i++) {
+		set_pcpu_used(i);
 		err = prepare_vcpu(vm, i);
 		if (err != 0) {
 			return err;
@@ -128,6 +128,21 @@ int vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 			(uint16_t)param2);
 		break;
 
+	case HC_SET_POSTED_IOREQ_RANGE:
+		/* param1: vmid */
+		ret = hcall_set_posted_ioreq_range(vm, (uint16_t)param1, param2);
+		break;
+
+	case HC_SET_DOORBELL:
+		/* param1: vmid */
+		ret = hcall_set_doorbell(vm, (uint16_t)param1, param2);
+		break;
+
+	case HC_SET_DOORBELL_BUFFER:
+		/* param1: vmid */
+		ret = hcall_set_doorbell_buffer(vm, (uint16_t)param1, param2);
+		break;
+
 	case HC_VM_SET_MEMORY_REGIONS:
 		ret = hcall_set_vm_memory_regions(vm, param1);
 		break;
@@ -136,6 +151,14 @@ int vmcall_vmexit_handler(struct acrn_vcpu *vcpu)
 		ret = hcall_write_protect_page(vm, (uint16_t)param1, param2);
 		break;
 
+	case HC_VM_WRITE_PROTECT_PAGES:
+		ret = hcall_write_protect_pages(vm, (uint16_t)param1, param2);
+		break;
+
+	case HC_VM_GET_DIRTY_LOG:
+		ret = hcall_get_dirty_log(vm, (uint16_t)param1, param2);
+		break;
+
 	/*
 	 * Don't do MSI remapping and make the pmsi_data equal to vmsi_data
 	 * This is a temporary solution before this hypercall is removed from SOS
@@ -197,19 +197,28 @@ hv_emulate_pio(const struct acrn_vcpu *vcpu, struct io_request *io_req)
 	uint32_t idx;
 	struct acrn_vm *vm = vcpu->vm;
 	struct pio_request *pio_req = &io_req->reqs.pio;
-	struct vm_io_handler_desc *handler;
+	struct vm_io_handler_desc *handler = NULL;
 
 	port = (uint16_t)pio_req->address;
 	size = (uint16_t)pio_req->size;
 	mask = 0xFFFFFFFFU >> (32U - 8U * size);
 
-	for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
-		handler = &(vm->arch_vm.emul_pio[idx]);
-
-		if ((port < handler->port_start) || (port >= handler->port_end)) {
-			continue;
+	if (port < EMUL_PIO_MAP_PORTS) {
+		idx = vm->arch_vm.emul_pio_map[port];
+		if (idx != 0U) {
+			handler = &(vm->arch_vm.emul_pio[idx - 1U]);
+		}
+	} else {
+		for (idx = 0U; idx < EMUL_PIO_IDX_MAX; idx++) {
+			if ((port >= vm->arch_vm.emul_pio[idx].port_start) &&
+					(port < vm->arch_vm.emul_pio[idx].port_end)) {
+				handler = &(vm->arch_vm.emul_pio[idx]);
+				break;
+			}
 		}
+	}
 
+	if (handler != NULL) {
 		if (pio_req->direction == REQUEST_WRITE) {
 			if (handler->io_write != NULL) {
 				handler->io_write(vm, port, size, pio_req->value & mask);
@@ -222,7 +231,6 @@ hv_emulate_pio(const struct acrn_vcpu *vcpu, struct io_request *io_req)
 			pr_dbg("IO read on port %04x, data %08x", port, pio_req->value);
 		}
 		status = 0;
-		break;
 	}
 
 	return status;
@@ -242,33 +250,51 @@ static int32_t
 hv_emulate_mmio(struct acrn_vcpu *vcpu, struct io_request *io_req)
 {
 	int status = -ENODEV;
-	uint16_t idx;
-	uint64_t address, size;
+	uint16_t idx, lo, hi, mid;
+	uint64_t address, size, base, end;
+	struct acrn_vm *vm = vcpu->vm;
 	struct mmio_request *mmio_req = &io_req->reqs.mmio;
-	struct mem_io_node *mmio_handler = NULL;
+	struct mem_io_node *mmio_handler;
 
 	address = mmio_req->address;
 	size = mmio_req->size;
 
-	for (idx = 0U; idx < vcpu->vm->emul_mmio_regions; idx++) {
-		uint64_t base, end;
-
-		mmio_handler = &(vcpu->vm->emul_mmio[idx]);
-		base = mmio_handler->range_start;
-		end = mmio_handler->range_end;
-
-		if (((address + size) <= base) || (address >= end)) {
-			continue;
-		} else if (!((address >= base) && ((address + size) <= end))) {
-			pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
-			return -EIO;
-		} else {
-			/* Handle this MMIO operation */
-			if (mmio_handler->read_write != NULL) {
-				status = mmio_handler->read_write(io_req, mmio_handler->handler_private_data);
-				break;
+	/* Accesses of a vcpu tend to hit the same region again */
+	idx = vcpu->last_mmio_idx;
+	if ((idx >= vm->emul_mmio_regions) || (address < vm->emul_mmio[idx].range_start) ||
+			(address >= vm->emul_mmio[idx].range_end)) {
+		/* Find the last region starting below the end of the access */
+		lo = 0U;
+		hi = vm->emul_mmio_regions;
+		while (lo < hi) {
+			mid = (lo + hi) >> 1U;
+			if (vm->emul_mmio[mid].range_start < (address + size)) {
+				lo = mid + 1U;
+			} else {
+				hi = mid;
 			}
 		}
+
+		/* As regions do not overlap, it is the only candidate */
+		if ((lo == 0U) || (vm->emul_mmio[lo - 1U].range_end <= address)) {
+			return -ENODEV;
+		}
+		idx = lo - 1U;
+		vcpu->last_mmio_idx = idx;
+	}
+
+	mmio_handler = &(vm->emul_mmio[idx]);
+	base = mmio_handler->range_start;
+	end = mmio_handler->range_end;
+
+	if (!((address >= base) && ((address + size) <= end))) {
+		pr_fatal("Err MMIO, address:0x%llx, size:%x", address, size);
+		status = -EIO;
+	} else if (mmio_handler->read_write != NULL) {
+		/* Handle this MMIO operation */
+		status = mmio_handler->read_write(io_req, mmio_handler->handler_private_data);
+	} else {
+		/* no handler, leave it to VHM */
 	}
 
 	return status;
@@ -321,11 +347,23 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 		/*
 		 * No handler from HV side, search from VHM in Dom0
 		 *
-		 * ACRN insert request to VHM and inject upcall.
+		 * Doorbell writes only set a pending bit for SOS, and writes to
+		 * posted ranges are queued to VHM, both without pausing the
+		 * vcpu. Otherwise (or if the posted ring is full) ACRN insert
+		 * request to VHM, inject upcall and wait.
 		 */
-		status = acrn_insert_request_wait(vcpu, io_req);
-
+		status = acrn_ring_doorbell(vcpu, io_req);
+		if (status != 0) {
+			status = acrn_insert_request_posted(vcpu, io_req);
+		}
 		if (status != 0) {
+			status = acrn_insert_request_wait(vcpu, io_req);
+			if (status == 0) {
+				status = IOREQ_PENDING;
+			}
+		}
+
+		if (status < 0) {
 			/* here for both IO & MMIO, the direction, address,
 			 * size definition is same
 			 */
@@ -334,8 +372,6 @@ emulate_io(struct acrn_vcpu *vcpu, struct io_request *io_req)
 				"addr = 0x%llx, size=%lu", __func__,
 				pio_req->direction, io_req->type,
 				pio_req->address, pio_req->size);
-		} else {
-			status = IOREQ_PENDING;
 		}
 #endif
 	}
@@ -439,6 +475,26 @@ void setup_io_bitmap(struct acrn_vm *vm)
 	}
 }
 
+/*
+ * Rebuild the port-to-handler map from emul_pio[]. Where ranges overlap, the
+ * handler with the lowest index wins as when emul_pio[] was scanned in order.
+ */
+static void build_emul_pio_map(struct acrn_vm *vm)
+{
+	uint32_t idx, port, end;
+	const struct vm_io_handler_desc *handler;
+
+	(void)memset(vm->arch_vm.emul_pio_map, 0U, sizeof(vm->arch_vm.emul_pio_map));
+
+	for (idx = EMUL_PIO_IDX_MAX; idx > 0U; idx--) {
+		handler = &(vm->arch_vm.emul_pio[idx - 1U]);
+		end = min((uint32_t)handler->port_end, EMUL_PIO_MAP_PORTS);
+		for (port = handler->port_start; port < end; port++) {
+			vm->arch_vm.emul_pio_map[port] = (uint8_t)idx;
+		}
+	}
+}
+
 /**
  * @brief Register a port I/O handler
  *
@@ -459,6 +515,8 @@ void register_io_emulation_handler(struct acrn_vm *vm, uint32_t pio_idx,
 	vm->arch_vm.emul_pio[pio_idx].port_end = range->base + range->len;
 	vm->arch_vm.emul_pio[pio_idx].io_read = io_read_fn_ptr;
 	vm->arch_vm.emul_pio[pio_idx].io_write = io_write_fn_ptr;
+
+	build_emul_pio_map(vm);
 }
 
 /**
@@ -480,6 +538,7 @@ int register_mmio_emulation_handler(struct acrn_vm *vm,
 	uint64_t end, void *handler_private_data)
 {
 	int status = -EINVAL;
+	uint16_t i, pos;
 	struct mem_io_node *mmio_node;
 
 	if ((vm->hw.created_vcpus > 0U) && vm->hw.vcpu_array[0].launched) {
@@ -494,7 +553,22 @@ int register_mmio_emulation_handler(struct acrn_vm *vm,
 			pr_err("the emulated mmio region is out of range");
 			return status;
 		}
-		mmio_node = &(vm->emul_mmio[vm->emul_mmio_regions]);
+
+		/* Keep the regions sorted so that they can be binary searched */
+		pos = vm->emul_mmio_regions;
+		while ((pos > 0U) && (vm->emul_mmio[pos - 1U].range_start > start)) {
+			pos--;
+		}
+		if (((pos > 0U) && (vm->emul_mmio[pos - 1U].range_end > start)) ||
+				((pos < vm->emul_mmio_regions) && (vm->emul_mmio[pos].range_start < end))) {
+			pr_err("mmio region [0x%llx, 0x%llx) overlaps with another one", start, end);
+			return status;
+		}
+		for (i = vm->emul_mmio_regions; i > pos; i--) {
+			vm->emul_mmio[i] = vm->emul_mmio[i - 1U];
+		}
+
+		mmio_node = &(vm->emul_mmio[pos]);
 		/* Fill in information for this node */
 		mmio_node->read_write = read_write;
 		mmio_node->handler_private_data = handler_private_data;
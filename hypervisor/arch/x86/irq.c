@@ -394,7 +394,10 @@ void partition_mode_dispatch_interrupt(struct intr_excp_ctx *ctx)
 	vcpu = per_cpu(vcpu, get_cpu_id());
 	if (vr < VECTOR_FIXED_START) {
 		send_lapic_eoi();
-		vlapic_intr_edge(vcpu, vr);
+		/* the vcpu of this pcpu may not have run yet */
+		if (vcpu != NULL) {
+			vlapic_intr_edge(vcpu, vr);
+		}
 	} else {
 		dispatch_interrupt(ctx);
 	}
@@ -171,12 +171,10 @@ void invept(const struct acrn_vcpu *vcpu)
 	struct invept_desc desc = {0};
 
 	if (cpu_has_vmx_ept_cap(VMX_EPT_INVEPT_SINGLE_CONTEXT)) {
-		desc.eptp = hva2hpa(vcpu->vm->arch_vm.nworld_eptp) |
-				(3UL << 3U) | 6UL;
+		desc.eptp = ept_pointer(vcpu->vm, vcpu->vm->arch_vm.nworld_eptp);
 		local_invept(INVEPT_TYPE_SINGLE_CONTEXT, desc);
 		if (vcpu->vm->sworld_control.flag.active != 0UL) {
-			desc.eptp = hva2hpa(vcpu->vm->arch_vm.sworld_eptp)
-				| (3UL << 3U) | 6UL;
+			desc.eptp = ept_pointer(vcpu->vm, vcpu->vm->arch_vm.sworld_eptp);
 			local_invept(INVEPT_TYPE_SINGLE_CONTEXT, desc);
 		}
 	} else if (cpu_has_vmx_ept_cap(VMX_EPT_INVEPT_GLOBAL_CONTEXT)) {
@@ -49,6 +49,68 @@ static void split_large_page(uint64_t *pte, enum _page_table_level level,
 	/* TODO: flush the TLB */
 }
 
+/*
+ * Try to collapse the next level page table referenced by pgentry back into a
+ * single large page. It succeeds only when all the entries of that table are
+ * present leaf entries, map contiguous physical addresses starting at a
+ * properly aligned base, and carry identical attributes -- i.e. the reverse
+ * of split_large_page.
+ *
+ * With check_only, only report whether the table could be collapsed.
+ *
+ * The table page goes back to its static pool slot and is cleared by
+ * get_pd_page/get_pt_page as soon as the range is split again, so see
+ * mmu_coalesce for what the caller must guarantee.
+ */
+static bool try_merge_large_page(uint64_t *pgentry, enum _page_table_level level,
+		const struct memory_ops *mem_ops, bool check_only)
+{
+	uint64_t *pbase;
+	uint64_t ref_paddr, ref_prot, paddrinc, large_size;
+	uint64_t i;
+
+	switch (level) {
+	case IA32E_PDPT:
+		pbase = pdpte_page_vaddr(*pgentry);
+		paddrinc = PDE_SIZE;
+		large_size = PDPTE_SIZE;
+		break;
+	case IA32E_PD:
+		pbase = pde_page_vaddr(*pgentry);
+		paddrinc = PTE_SIZE;
+		large_size = PDE_SIZE;
+		break;
+	default:
+		panic("invalid paging table level: %d", level);
+	}
+
+	ref_paddr = pbase[0] & PDE_PFN_MASK;
+	ref_prot = pbase[0] & ~PDE_PFN_MASK;
+	if ((mem_ops->pgentry_present(pbase[0]) == 0UL) || !mem_aligned_check(ref_paddr, large_size)) {
+		return false;
+	}
+	/*
+	 * A PD can only be merged when all its PDEs are large pages already;
+	 * a PTE with bit 7 set is not something split_large_page produced.
+	 */
+	if ((level == IA32E_PDPT) != ((ref_prot & PAGE_PSE) != 0UL)) {
+		return false;
+	}
+
+	for (i = 1UL; i < PTRS_PER_PTE; i++) {
+		if (pbase[i] != ((ref_paddr + (i * paddrinc)) | ref_prot)) {
+			return false;
+		}
+	}
+
+	if (!check_only) {
+		dev_dbg(ACRN_DBG_MMU, "%s, paddr: 0x%llx, pbase: 0x%llx\n", __func__, ref_paddr, pbase);
+		set_pgentry(pgentry, ref_paddr | ref_prot | PAGE_PSE);
+	}
+
+	return true;
+}
+
 static inline void local_modify_or_del_pte(uint64_t *pte,
 		uint64_t prot_set, uint64_t prot_clr, uint32_t type)
 {
@@ -371,7 +433,60 @@ void mmu_add(uint64_t *pml4_page, uint64_t paddr_base, uint64_t vaddr_base, uint
 	}
 }
 
+/*
+ * Collapse back into large pages the page tables covering
+ * [vaddr_base, vaddr_base + size) which hold a mapping split_large_page
+ * could have produced, PDs first and then PDPTs. With check_only, nothing
+ * is changed.
+ *
+ * @pre nothing walks these page tables meanwhile, neither through memory
+ * nor through the paging-structure caches, and the caller invalidates
+ * those caches before the range can be split again.
+ *
+ * @return true if some table was merged (or, with check_only, could be)
+ */
+bool mmu_coalesce(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size,
+		const struct memory_ops *mem_ops, bool check_only)
+{
+	uint64_t vaddr = vaddr_base & PDE_MASK;
+	uint64_t vaddr_end = vaddr_base + size;
+	uint64_t *pml4e, *pdpte, *pde;
+	bool merged = false;
+
+	while (vaddr < vaddr_end) {
+		pml4e = pml4e_offset(pml4_page, vaddr);
+		if (mem_ops->pgentry_present(*pml4e) == 0UL) {
+			vaddr = (vaddr & PML4E_MASK) + PML4E_SIZE;
+			continue;
+		}
+		pdpte = pdpte_offset(pml4e, vaddr);
+		if ((mem_ops->pgentry_present(*pdpte) == 0UL) || (pdpte_large(*pdpte) != 0UL)) {
+			vaddr = (vaddr & PDPTE_MASK) + PDPTE_SIZE;
+			continue;
+		}
+		pde = pde_offset(pdpte, vaddr);
+		if ((mem_ops->pgentry_present(*pde) != 0UL) && (pde_large(*pde) == 0UL)) {
+			if (try_merge_large_page(pde, IA32E_PD, mem_ops, check_only)) {
+				merged = true;
+			}
+		}
+		vaddr = (vaddr & PDE_MASK) + PDE_SIZE;
+
+		/* done with this PD, try to merge it as well */
+		if (((vaddr & ~PDPTE_MASK) == 0UL) || (vaddr >= vaddr_end)) {
+			if (try_merge_large_page(pdpte, IA32E_PDPT, mem_ops, check_only)) {
+				merged = true;
+			}
+		}
+	}
+
+	return merged;
+}
+
 /**
+ * If addr is not mapped, NULL is returned and *pg_size is set to the size
+ * the missing entry would map.
+ *
  * @pre (pml4_page != NULL) && (pg_size != NULL)
  */
 uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr, uint64_t *pg_size, const struct memory_ops *mem_ops)
@@ -380,11 +495,13 @@ uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr, uint64_t *pg_size,
 
 	pml4e = pml4e_offset(pml4_page, addr);
 	if (mem_ops->pgentry_present(*pml4e) == 0UL) {
+		*pg_size = PML4E_SIZE;
 		return NULL;
 	}
 
 	pdpte = pdpte_offset(pml4e, addr);
 	if (mem_ops->pgentry_present(*pdpte) == 0UL) {
+		*pg_size = PDPTE_SIZE;
 		return NULL;
 	} else if (pdpte_large(*pdpte) != 0UL) {
 		*pg_size = PDPTE_SIZE;
@@ -393,6 +510,7 @@ uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr, uint64_t *pg_size,
 
 	pde = pde_offset(pdpte, addr);
 	if (mem_ops->pgentry_present(*pde) == 0UL) {
+		*pg_size = PDE_SIZE;
 		return NULL;
 	} else if (pde_large(*pde) != 0UL) {
 		*pg_size = PDE_SIZE;
@@ -401,6 +519,7 @@ uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr, uint64_t *pg_size,
 
 	pte = pte_offset(pde, addr);
 	if (mem_ops->pgentry_present(*pte) == 0UL) {
+		*pg_size = PTE_SIZE;
 		return NULL;
 	} else {
 		*pg_size = PTE_SIZE;
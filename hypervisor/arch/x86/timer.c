@@ -29,58 +29,124 @@ static void tsc_deadline_handler(__unused uint32_t irq, __unused void *data)
 	fire_softirq(SOFTIRQ_TIMER);
 }
 
+/*
+ * @pre cpu_timer->lock is held
+ */
 static inline void update_physical_timer(struct per_cpu_timers *cpu_timer)
 {
-	struct hv_timer *timer = NULL;
+	/* the earliest deadline is at the heap root */
+	if (cpu_timer->nr_timers != 0U) {
+		/* it is okay to program a expired time. Delaying the interrupt
+		 * by the slack lets timers expiring within it share it.
+		 */
+		msr_write(MSR_IA32_TSC_DEADLINE, cpu_timer->heap[0]->fire_tsc +
+				us_to_ticks(CONFIG_TIMER_SLACK_US));
+	}
+}
 
-	/* find the next event timer */
-	if (!list_empty(&cpu_timer->timer_list)) {
-		timer = list_entry((&cpu_timer->timer_list)->next,
-			struct hv_timer, node);
+static inline void heap_set(struct per_cpu_timers *cpu_timer, uint32_t idx,
+			struct hv_timer *timer)
+{
+	cpu_timer->heap[idx] = timer;
+	timer->heap_idx = idx;
+}
+
+/* move the timer at idx towards the root till its parent fires earlier */
+static void heap_sift_up(struct per_cpu_timers *cpu_timer, uint32_t idx)
+{
+	struct hv_timer *timer = cpu_timer->heap[idx];
+	uint32_t i = idx, parent;
 
-		/* it is okay to program a expired time */
-		msr_write(MSR_IA32_TSC_DEADLINE, timer->fire_tsc);
+	while (i > 0U) {
+		parent = (i - 1U) >> 1U;
+		if (cpu_timer->heap[parent]->fire_tsc <= timer->fire_tsc) {
+			break;
+		}
+		heap_set(cpu_timer, i, cpu_timer->heap[parent]);
+		i = parent;
 	}
+	heap_set(cpu_timer, i, timer);
 }
 
-static void local_add_timer(struct per_cpu_timers *cpu_timer,
-			struct hv_timer *timer,
-			bool *need_update)
+/* move the timer at idx towards the leaves till its children fire later */
+static void heap_sift_down(struct per_cpu_timers *cpu_timer, uint32_t idx)
 {
-	struct list_head *pos, *prev;
-	struct hv_timer *tmp;
-	uint64_t tsc = timer->fire_tsc;
-
-	prev = &cpu_timer->timer_list;
-	list_for_each(pos, &cpu_timer->timer_list) {
-		tmp = list_entry(pos, struct hv_timer, node);
-		if (tmp->fire_tsc < tsc) {
-			prev = &tmp->node;
+	struct hv_timer *timer = cpu_timer->heap[idx];
+	uint32_t i = idx, child;
+
+	while (((i << 1U) + 1U) < cpu_timer->nr_timers) {
+		child = (i << 1U) + 1U;
+		if (((child + 1U) < cpu_timer->nr_timers) &&
+			(cpu_timer->heap[child + 1U]->fire_tsc < cpu_timer->heap[child]->fire_tsc)) {
+			child++;
 		}
-		else {
+		if (timer->fire_tsc <= cpu_timer->heap[child]->fire_tsc) {
 			break;
 		}
+		heap_set(cpu_timer, i, cpu_timer->heap[child]);
+		i = child;
 	}
+	heap_set(cpu_timer, i, timer);
+}
 
-	list_add(&timer->node, prev);
+/*
+ * @pre cpu_timer->lock is held
+ */
+static int local_add_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer,
+			bool *need_update)
+{
+	if (cpu_timer->nr_timers >= MAX_TIMERS_PER_CPU) {
+		return -ENOMEM;
+	}
+
+	timer->cpu_timer = cpu_timer;
+	heap_set(cpu_timer, cpu_timer->nr_timers, timer);
+	cpu_timer->nr_timers++;
+	heap_sift_up(cpu_timer, timer->heap_idx);
 
 	if (need_update != NULL) {
-		/* update the physical timer if we're on the timer_list head */
-		*need_update = (prev == &cpu_timer->timer_list);
+		/* update the physical timer if we're on the heap root */
+		*need_update = (timer->heap_idx == 0U);
 	}
+
+	return 0;
+}
+
+/*
+ * @pre cpu_timer->lock is held
+ * @pre timer->cpu_timer == cpu_timer
+ */
+static void local_del_timer(struct per_cpu_timers *cpu_timer,
+			struct hv_timer *timer)
+{
+	uint32_t idx = timer->heap_idx;
+	struct hv_timer *last;
+
+	cpu_timer->nr_timers--;
+	if (idx != cpu_timer->nr_timers) {
+		/* fill the hole with the last timer, which may go either way */
+		last = cpu_timer->heap[cpu_timer->nr_timers];
+		heap_set(cpu_timer, idx, last);
+		heap_sift_up(cpu_timer, idx);
+		heap_sift_down(cpu_timer, last->heap_idx);
+	}
+	cpu_timer->heap[cpu_timer->nr_timers] = NULL;
+	timer->cpu_timer = NULL;
 }
 
 int add_timer(struct hv_timer *timer)
 {
 	struct per_cpu_timers *cpu_timer;
 	uint16_t pcpu_id;
-	bool need_update;
+	bool need_update = false;
+	int ret;
 
 	if ((timer == NULL) || (timer->func == NULL) || (timer->fire_tsc == 0UL)) {
 		return -EINVAL;
 	}
 
-	ASSERT(list_empty(&timer->node), "add timer again!\n");
+	ASSERT(timer->cpu_timer == NULL, "add timer again!\n");
 
 	/* limit minimal periodic timer cycle period */
 	if (timer->mode == TICK_MODE_PERIODIC) {
@@ -90,11 +156,17 @@ int add_timer(struct hv_timer *timer)
 
 	pcpu_id  = get_cpu_id();
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	local_add_timer(cpu_timer, timer, &need_update);
-
+	spinlock_obtain(&cpu_timer->lock);
+	ret = local_add_timer(cpu_timer, timer, &need_update);
 	if (need_update) {
 		update_physical_timer(cpu_timer);
 	}
+	spinlock_release(&cpu_timer->lock);
+
+	if (ret != 0) {
+		pr_err("%s: too many timers on cpu%hu", __func__, pcpu_id);
+		return ret;
+	}
 
 	TRACE_2L(TRACE_TIMER_ACTION_ADDED, timer->fire_tsc, 0UL);
 	return 0;
@@ -103,8 +175,16 @@ int add_timer(struct hv_timer *timer)
 
 void del_timer(struct hv_timer *timer)
 {
-	if ((timer != NULL) && !list_empty(&timer->node)) {
-		list_del_init(&timer->node);
+	struct per_cpu_timers *cpu_timer;
+
+	if ((timer != NULL) && (timer->cpu_timer != NULL)) {
+		cpu_timer = timer->cpu_timer;
+		spinlock_obtain(&cpu_timer->lock);
+		/* the timer may have expired meanwhile */
+		if (timer->cpu_timer == cpu_timer) {
+			local_del_timer(cpu_timer, timer);
+		}
+		spinlock_release(&cpu_timer->lock);
 	}
 }
 
@@ -113,7 +193,8 @@ static void init_percpu_timer(uint16_t pcpu_id)
 	struct per_cpu_timers *cpu_timer;
 
 	cpu_timer = &per_cpu(cpu_timers, pcpu_id);
-	INIT_LIST_HEAD(&cpu_timer->timer_list);
+	spinlock_init(&cpu_timer->lock);
+	cpu_timer->nr_timers = 0U;
 }
 
 static void init_tsc_deadline_timer(void)
@@ -133,7 +214,6 @@ static void timer_softirq(uint16_t pcpu_id)
 {
 	struct per_cpu_timers *cpu_timer;
 	struct hv_timer *timer;
-	struct list_head *pos, *n;
 	int tries = MAX_TIMER_ACTIONS;
 	uint64_t current_tsc = rdtsc();
 
@@ -146,19 +226,23 @@ static void timer_softirq(uint16_t pcpu_id)
 	 * inside func(), it will infinitely loop here, because new added timer
 	 * already passed due to previously func()'s delay.
 	 */
-	list_for_each_safe(pos, n, &cpu_timer->timer_list) {
-		timer = list_entry(pos, struct hv_timer, node);
+	spinlock_obtain(&cpu_timer->lock);
+	while (cpu_timer->nr_timers != 0U) {
+		timer = cpu_timer->heap[0];
 		/* timer expried */
 		tries--;
 		if ((timer->fire_tsc <= current_tsc) && (tries > 0)) {
-			del_timer(timer);
+			local_del_timer(cpu_timer, timer);
 
+			/* func() may add or delete timers */
+			spinlock_release(&cpu_timer->lock);
 			run_timer(timer);
+			spinlock_obtain(&cpu_timer->lock);
 
-			if (timer->mode == TICK_MODE_PERIODIC) {
+			if ((timer->mode == TICK_MODE_PERIODIC) && (timer->cpu_timer == NULL)) {
 				/* update periodic timer fire tsc */
 				timer->fire_tsc += timer->period_in_cycle;
-				local_add_timer(cpu_timer, timer, NULL);
+				(void)local_add_timer(cpu_timer, timer, NULL);
 			}
 		} else {
 			break;
@@ -167,6 +251,7 @@ static void timer_softirq(uint16_t pcpu_id)
 
 	/* update nearest timer */
 	update_physical_timer(cpu_timer);
+	spinlock_release(&cpu_timer->lock);
 }
 
 void timer_init(void)
@@ -216,6 +216,8 @@ static void load_world_ctx(struct acrn_vcpu *vcpu, const struct ext_context *ext
 	bitmap_set_lock(CPU_REG_RFLAGS, &vcpu->reg_updated);
 	bitmap_set_lock(CPU_REG_RSP, &vcpu->reg_updated);
 	bitmap_set_lock(CPU_REG_RIP, &vcpu->reg_updated);
+	/* CS and CR0 of the other world */
+	bitmap_clear_lock(VCPU_CACHED_CPU_MODE, &vcpu->reg_cached);
 
 	/* VMCS Execution field */
 	exec_vmwrite64(VMX_TSC_OFFSET_FULL, ext_ctx->tsc_offset);
@@ -282,16 +284,14 @@ void switch_world(struct acrn_vcpu *vcpu, int next_world)
 	if (next_world == NORMAL_WORLD) {
 		/* load EPTP for next world */
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.nworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			ept_pointer(vcpu->vm, vcpu->vm->arch_vm.nworld_eptp));
 
 #ifndef CONFIG_L1D_FLUSH_VMENTRY_ENABLED
 		cpu_l1d_flush();
 #endif
 	} else {
 		exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vcpu->vm->arch_vm.sworld_eptp) |
-			(3UL << 3U) | 0x6UL);
+			ept_pointer(vcpu->vm, vcpu->vm->arch_vm.sworld_eptp));
 	}
 
 	/* Update world index */
@@ -404,7 +404,7 @@ static bool init_secure_world_env(struct acrn_vcpu *vcpu,
 				uint64_t base_hpa,
 				uint32_t size)
 {
-	vcpu->arch.inst_len = 0U;
+	vcpu_retain_rip(vcpu);
 	vcpu->arch.contexts[SECURE_WORLD].run_ctx.rip = entry_gpa;
 	vcpu->arch.contexts[SECURE_WORLD].run_ctx.guest_cpu_regs.regs.rsp =
 		TRUSTY_EPT_REBASE_GPA + size;
@@ -459,7 +459,7 @@ bool initialize_trusty(struct acrn_vcpu *vcpu, uint64_t param)
 	trusty_base_hpa = vm->sworld_control.sworld_memory.base_hpa;
 
 	exec_vmwrite64(VMX_EPT_POINTER_FULL,
-			hva2hpa(vm->arch_vm.sworld_eptp) | (3UL << 3U) | 0x6UL);
+			ept_pointer(vm, vm->arch_vm.sworld_eptp));
 
 	/* save Normal World context */
 	save_world_ctx(vcpu, &vcpu->arch.contexts[NORMAL_WORLD].ext_ctx);
@@ -5,6 +5,7 @@
  */
 
 #include <hypervisor.h>
+#include "guest/instr_emul.h"
 
 #define EXCEPTION_ERROR_CODE_VALID  8U
 
@@ -95,15 +96,13 @@ void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid)
 {
 	bitmap_set_lock(eventid, &vcpu->arch.pending_req);
 	/*
-	 * if current hostcpu is not the target vcpu's hostcpu, we need
-	 * to invoke IPI to wake up target vcpu
+	 * A vcpu parked by guest HLT is put back to the runqueue, and the
+	 * reschedule request already kicks its pcpu.
 	 *
-	 * TODO: Here we just compare with cpuid, since cpuid currently is
-	 *  global under pCPU / vCPU 1:1 mapping. If later we enabled vcpu
-	 *  scheduling, we need change here to determine it target vcpu is
-	 *  VMX non-root or root mode
+	 * Otherwise, if current hostcpu is not the target vcpu's hostcpu, we
+	 * need to invoke IPI to kick the target vcpu out of non-root mode.
 	 */
-	if (get_cpu_id() != vcpu->pcpu_id) {
+	if (!wake_vcpu(vcpu) && (get_cpu_id() != vcpu->pcpu_id)) {
 		send_single_ipi(vcpu->pcpu_id, VECTOR_NOTIFY_VCPU);
 	}
 }
@@ -346,6 +345,29 @@ int interrupt_window_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+int hlt_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	uint32_t guest_state;
+
+	/* HLT right after STI: the interrupt shadow ends with HLT skipped */
+	guest_state = exec_vmread32(VMX_GUEST_INTERRUPTIBILITY_INFO);
+	if ((guest_state & (uint32_t)HV_ARCH_VCPU_BLOCKED_BY_STI) != 0U) {
+		exec_vmwrite32(VMX_GUEST_INTERRUPTIBILITY_INFO,
+			guest_state & ~(uint32_t)HV_ARCH_VCPU_BLOCKED_BY_STI);
+	}
+
+	/*
+	 * Park the vcpu and leave the pcpu to other vcpus or to idle. Any
+	 * event made for it by vcpu_make_request() puts it back to run.
+	 * An interrupt already in RVI would not wake it up.
+	 */
+	if (!vcpu_pending_request(vcpu) && !vlapic_apicv_rvi_pending(vcpu_vlapic(vcpu))) {
+		halt_vcpu(vcpu);
+	}
+
+	return 0;
+}
+
 int32_t external_interrupt_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	uint32_t intr_info;
@@ -399,9 +421,19 @@ int acrn_handle_pending_request(struct acrn_vcpu *vcpu)
 		return -EFAULT;
 	}
 
+	if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_QUIESCE,
+						pending_req_bits)) {
+		while (atomic_load32(&vcpu->vm->arch_vm.ept_quiesce) != 0U) {
+			pause_cpu();
+		}
+		invept(vcpu);
+		instr_cache_invalidate(vcpu);
+	}
+
 	if (bitmap_test_and_clear_lock(ACRN_REQUEST_EPT_FLUSH,
 						pending_req_bits)) {
 		invept(vcpu);
+		instr_cache_invalidate(vcpu);
 	}
 
 	if (bitmap_test_and_clear_lock(ACRN_REQUEST_VPID_FLUSH,
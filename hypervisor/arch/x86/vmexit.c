@@ -6,16 +6,11 @@
 
 #include <hypervisor.h>
 
-/*
- * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
- * there are 65 Basic Exit Reasons.
- */
-#define NR_VMX_EXIT_REASONS	65U
-
 static int unhandled_vmexit_handler(struct acrn_vcpu *vcpu);
 static int xsetbv_vmexit_handler(struct acrn_vcpu *vcpu);
 static int wbinvd_vmexit_handler(struct acrn_vcpu *vcpu);
 static int preemption_timeout_handler(struct acrn_vcpu *vcpu);
+static int pause_vmexit_handler(struct acrn_vcpu *vcpu);
 
 /* VM Dispatch table for Exit condition handling */
 static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
@@ -44,7 +39,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_GETSEC] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_HLT] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = hlt_vmexit_handler},
 	[VMX_EXIT_REASON_INVD] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_INVLPG] = {
@@ -99,7 +94,7 @@ static const struct vm_exit_dispatch dispatch_table[NR_VMX_EXIT_REASONS] = {
 	[VMX_EXIT_REASON_MONITOR] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_PAUSE] = {
-		.handler = unhandled_vmexit_handler},
+		.handler = pause_vmexit_handler},
 	[VMX_EXIT_REASON_ENTRY_FAILURE_MACHINE_CHECK] = {
 		.handler = unhandled_vmexit_handler},
 	[VMX_EXIT_REASON_TPR_BELOW_THRESHOLD] = {
@@ -229,6 +224,29 @@ int vmexit_handler(struct acrn_vcpu *vcpu)
 	return ret;
 }
 
+#ifdef HV_DEBUG
+/*
+ * Charge the VMCS accesses done on this pcpu since the previous VM exit
+ * was handled to the VM exit just handled: the write back of guest state
+ * at VM entry, the reads after VM exit and the ones of the handler.
+ */
+void vmexit_account_vmcs(uint16_t pcpu_id, uint32_t basic_exit_reason)
+{
+	struct vmexit_vmcs_stat *stat;
+	uint64_t reads = per_cpu(vmcs_reads, pcpu_id);
+	uint64_t writes = per_cpu(vmcs_writes, pcpu_id);
+
+	if (basic_exit_reason < NR_VMX_EXIT_REASONS) {
+		stat = &per_cpu(vmexit_vmcs, pcpu_id)[basic_exit_reason];
+		stat->exits++;
+		stat->vmreads += reads - per_cpu(vmcs_reads_charged, pcpu_id);
+		stat->vmwrites += writes - per_cpu(vmcs_writes_charged, pcpu_id);
+	}
+	per_cpu(vmcs_reads_charged, pcpu_id) = reads;
+	per_cpu(vmcs_writes_charged, pcpu_id) = writes;
+}
+#endif
+
 static int unhandled_vmexit_handler(struct acrn_vcpu *vcpu)
 {
 	pr_fatal("Error: Unhandled VM exit condition from guest at 0x%016llx ",
@@ -372,6 +390,17 @@ static int wbinvd_vmexit_handler(struct acrn_vcpu *vcpu)
 	return 0;
 }
 
+/*
+ * PAUSE-loop exiting: the guest is spinning, likely on a lock held by a
+ * vcpu which is preempted. Let the other vcpus of this pcpu run.
+ */
+static int pause_vmexit_handler(struct acrn_vcpu *vcpu)
+{
+	yield_vcpu(vcpu);
+
+	return 0;
+}
+
 #define HV_ARCH_X64_PREEMTION_TIMER_EXPIRY 40 /*timeout is 40ms*/
 static int preemption_timeout_handler(struct acrn_vcpu *vcpu)
 {
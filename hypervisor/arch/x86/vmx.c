@@ -18,6 +18,12 @@ extern struct efi_context* efi_ctx;
 #define PROTECTED_MODE_CODE_SEG_AR	(0xc09bU)
 #define DR7_INIT_VALUE			(0x400UL)
 #define LDTR_AR				(0x0082U) /* LDT, type must be 2, refer to SDM Vol3 26.3.1.2 */
+
+/* PAUSE-loop exiting: max cycles between two PAUSEs of one spin loop, and
+ * cycles a guest may spin before the loop exits
+ */
+#define PLE_GAP				(128U)
+#define PLE_WINDOW			(4096U)
 #define TR_AR				(0x008bU) /* TSS (busy), refer to SDM Vol3 26.3.1.2 */
 
 static uint64_t cr0_host_mask;
@@ -101,8 +107,10 @@ void exec_vmxon_instr(uint16_t pcpu_id)
 	vmxon_region_pa = hva2hpa(vmxon_region_va);
 	exec_vmxon(&vmxon_region_pa);
 
-	vmcs_pa = hva2hpa(vcpu->arch.vmcs);
-	exec_vmptrld(&vmcs_pa);
+	if (vcpu != NULL) {
+		vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+		exec_vmptrld(&vmcs_pa);
+	}
 }
 
 static inline void exec_vmxoff(void)
@@ -113,11 +121,17 @@ static inline void exec_vmxoff(void)
 void vmx_off(uint16_t pcpu_id)
 {
 
-	struct acrn_vcpu *vcpu = get_ever_run_vcpu(pcpu_id);
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
 	uint64_t vmcs_pa;
+	uint16_t i;
 
-	vmcs_pa = hva2hpa(vcpu->arch.vmcs);
-	exec_vmclear((void *)&vmcs_pa);
+	/* All the VMCSs of the vcpus sharing this pcpu may be active on it */
+	for (i = 0U; i < CONFIG_MAX_VCPUS_PER_PCPU; i++) {
+		if (ctx->vcpus[i] != NULL) {
+			vmcs_pa = hva2hpa(ctx->vcpus[i]->arch.vmcs);
+			exec_vmclear((void *)&vmcs_pa);
+		}
+	}
 
 	exec_vmxoff();
 }
@@ -166,6 +180,9 @@ uint64_t exec_vmread64(uint32_t field_full)
 		: "=a" (value)
 		: "d"(field_full)
 		: "cc");
+#ifdef HV_DEBUG
+	get_cpu_var(vmcs_reads)++;
+#endif
 
 	return value;
 }
@@ -194,6 +211,9 @@ void exec_vmwrite64(uint32_t field_full, uint64_t value)
 		"vmwrite %%rax, %%rdx "
 		: : "a" (value), "d"(field_full)
 		: "cc");
+#ifdef HV_DEBUG
+	get_cpu_var(vmcs_writes)++;
+#endif
 }
 
 void exec_vmwrite32(uint32_t field, uint32_t value)
@@ -450,6 +470,7 @@ void vmx_write_cr0(struct acrn_vcpu *vcpu, uint64_t cr0)
 
 	/* clear read cache, next time read should from VMCS */
 	bitmap_clear_lock(CPU_REG_CR0, &vcpu->reg_cached);
+	bitmap_clear_lock(VCPU_CACHED_CPU_MODE, &vcpu->reg_cached);
 
 	pr_dbg("VMM: Try to write %016llx, allow to write 0x%016llx to CR0",
 		cr0, cr0_vmx);
@@ -821,6 +842,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	 */
 	value32 &= ~VMX_PROCBASED_CTLS_INVLPG;
 
+	/*
+	 * On a pcpu shared with other vcpus, guest HLT exits and parks the
+	 * vcpu so the others can run. Otherwise the guest halts the pcpu
+	 * itself, without exit.
+	 */
+	if (is_pcpu_shared(vcpu->pcpu_id)) {
+		value32 |= VMX_PROCBASED_CTLS_HLT;
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS: 0x%x ", value32);
 
@@ -862,6 +892,15 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 
 	value32 |= VMX_PROCBASED_CTLS2_WBINVD;
 
+	/* Yield a shared pcpu when the guest spins on a lock */
+	if (is_pcpu_shared(vcpu->pcpu_id) &&
+		(((msr_read(MSR_IA32_VMX_PROCBASED_CTLS2) >> 32U) &
+			VMX_PROCBASED_CTLS2_PAUSE_LOOP) != 0UL)) {
+		value32 |= VMX_PROCBASED_CTLS2_PAUSE_LOOP;
+		exec_vmwrite32(VMX_PLE_GAP, PLE_GAP);
+		exec_vmwrite32(VMX_PLE_WINDOW, PLE_WINDOW);
+	}
+
 	exec_vmwrite32(VMX_PROC_VM_EXEC_CONTROLS2, value32);
 	pr_dbg("VMX_PROC_VM_EXEC_CONTROLS2: 0x%x ", value32);
 
@@ -891,11 +930,8 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 		}
 	}
 
-	/* Load EPTP execution control
-	 * TODO: introduce API to make this data driven based
-	 * on VMX_EPT_VPID_CAP
-	 */
-	value64 = hva2hpa(vm->arch_vm.nworld_eptp) | (3UL << 3U) | 6UL;
+	/* Load EPTP execution control */
+	value64 = ept_pointer(vm, vm->arch_vm.nworld_eptp);
 	exec_vmwrite64(VMX_EPT_POINTER_FULL, value64);
 	pr_dbg("VMX_EPT_POINTER: 0x%016llx ", value64);
 
@@ -960,7 +996,7 @@ static void init_exec_ctrl(struct acrn_vcpu *vcpu)
 	exec_vmwrite(VMX_CR3_TARGET_3, 0UL);
 }
 
-static void init_entry_ctrl(const struct acrn_vcpu *vcpu)
+static void init_entry_ctrl(struct acrn_vcpu *vcpu)
 {
 	uint32_t value32;
 
@@ -1072,6 +1108,7 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 
 	/* Load VMCS pointer */
 	exec_vmptrld((void *)&vmcs_pa);
+	per_cpu(ever_run_vcpu, vcpu->pcpu_id) = vcpu;
 
 	/* Initialize the Virtual Machine Control Structure (VMCS) */
 	init_host_state();
@@ -1082,6 +1119,27 @@ void init_vmcs(struct acrn_vcpu *vcpu)
 	init_exit_ctrl(vcpu);
 }
 
+/**
+ * @brief Make the VMCS of \p vcpu current on its pcpu
+ *
+ * Used when switching between vcpus sharing a pcpu.
+ *
+ * @pre vcpu != NULL && vcpu->pcpu_id == get_cpu_id()
+ */
+void load_vmcs(struct acrn_vcpu *vcpu)
+{
+	uint64_t vmcs_pa;
+
+	vmcs_pa = hva2hpa(vcpu->arch.vmcs);
+	exec_vmptrld((void *)&vmcs_pa);
+	per_cpu(ever_run_vcpu, vcpu->pcpu_id) = vcpu;
+
+	/* avoid the new vcpu using branch predictions trained by the previous one */
+	if (ibrs_type == IBRS_RAW) {
+		msr_write(MSR_IA32_PRED_CMD, PRED_SET_IBPB);
+	}
+}
+
 #ifndef CONFIG_PARTITION_MODE
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu)
 {
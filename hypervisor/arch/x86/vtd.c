@@ -104,6 +104,10 @@ struct dmar_drhd_rt {
 	uint16_t cap_fault_reg_offset;
 	uint16_t ecap_iotlb_offset;
 	uint32_t fault_state[IOMMU_FAULT_REGISTER_STATE_NUM]; /* 32bit registers */
+
+	/* invalidation queue, used when DMA_GCMD_QIE is set in gcmd */
+	uint32_t qi_tail;  /* next descriptor written by sw */
+	uint32_t qi_head;  /* last head read from hw, next descriptor fetched */
 };
 
 struct dmar_root_entry {
@@ -129,8 +133,24 @@ struct context_table {
 	struct page buses[CONFIG_IOMMU_BUS_NUM];
 };
 
+struct dmar_qi_desc {
+	uint64_t lower;
+	uint64_t upper;
+};
+
+/* one page of invalidation queue per dmar unit, IQA_REG.QS = 0 */
+#define DMAR_QI_NUM	((uint32_t)(PAGE_SIZE / sizeof(struct dmar_qi_desc)))
+/* more page-selective IOTLB descriptors are replaced by a domain-selective one */
+#define DMAR_QI_BATCH	16U
+
+#define DMAR_QI_PENDING	0U
+#define DMAR_QI_DONE	1U
+
 static struct page root_tables[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
 static struct context_table ctx_tables[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
+static struct page qi_queues[CONFIG_MAX_IOMMU_NUM] __aligned(PAGE_SIZE);
+/* written by the wait descriptor queued by each pCPU */
+static volatile uint32_t qi_wait_status[CONFIG_MAX_PCPU_NUM];
 
 static inline uint8_t* get_root_table(uint32_t dmar_index)
 {
@@ -142,6 +162,11 @@ static inline uint8_t* get_ctx_table(uint32_t dmar_index, uint8_t bus_no)
 	return ctx_tables[dmar_index].buses[bus_no].contents;
 }
 
+static inline struct dmar_qi_desc *get_qi_queue(uint32_t dmar_index)
+{
+	return (struct dmar_qi_desc *)qi_queues[dmar_index].contents;
+}
+
 bool iommu_snoop_supported(struct acrn_vm *vm)
 {
 	bool ret;
@@ -392,6 +417,94 @@ static void dmar_disable_translation(struct dmar_drhd_rt *dmar_unit)
 	spinlock_release(&(dmar_unit->lock));
 }
 
+static void dmar_enable_qi(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status;
+
+	if (iommu_ecap_qi(dmar_unit->ecap) == 0U) {
+		return;
+	}
+
+	spinlock_obtain(&(dmar_unit->lock));
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
+		dmar_unit->qi_tail = 0U;
+		dmar_unit->qi_head = 0U;
+		iommu_write64(dmar_unit, DMAR_IQT_REG, 0UL);
+		iommu_write64(dmar_unit, DMAR_IQA_REG, hva2hpa(get_qi_queue(dmar_unit->index)) & ~DMA_IQA_QS_MASK);
+
+		dmar_unit->gcmd |= DMA_GCMD_QIE;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		/* 32-bit register */
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_QIES, false, &status);
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
+static void dmar_disable_qi(struct dmar_drhd_rt *dmar_unit)
+{
+	uint32_t status;
+	/* variable start isn't used when built as release version */
+	__unused uint64_t start = rdtsc();
+
+	spinlock_obtain(&(dmar_unit->lock));
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+		/* let the hardware fetch the descriptors queued */
+		while (iommu_read64(dmar_unit, DMAR_IQH_REG) != iommu_read64(dmar_unit, DMAR_IQT_REG)) {
+			ASSERT(((rdtsc() - start) < CYCLES_PER_MS), "DMAR QI Timeout!");
+			pause_cpu();
+		}
+
+		dmar_unit->gcmd &= ~DMA_GCMD_QIE;
+		iommu_write32(dmar_unit, DMAR_GCMD_REG, dmar_unit->gcmd);
+		/* 32-bit register */
+		dmar_wait_completion(dmar_unit, DMAR_GSTS_REG, DMA_GSTS_QIES, true, &status);
+	}
+	spinlock_release(&(dmar_unit->lock));
+}
+
+/*
+ * Queue num invalidation descriptors followed by a wait descriptor, then
+ * wait until the hardware has processed them. The lock is only held while
+ * queueing: each pCPU polls its own status word in memory, not a register.
+ */
+static void dmar_qi_submit(struct dmar_drhd_rt *dmar_unit, const struct dmar_qi_desc *descs, uint32_t num)
+{
+	struct dmar_qi_desc *queue = get_qi_queue(dmar_unit->index);
+	uint16_t pcpu_id = get_cpu_id();
+	uint32_t i, tail;
+	/* variable start isn't used when built as release version */
+	__unused uint64_t start = rdtsc();
+
+	qi_wait_status[pcpu_id] = DMAR_QI_PENDING;
+
+	spinlock_obtain(&(dmar_unit->lock));
+	tail = dmar_unit->qi_tail;
+	/* room for the num + 1 descriptors, one slot always stays empty */
+	while (((dmar_unit->qi_head + DMAR_QI_NUM - tail - 1U) % DMAR_QI_NUM) < (num + 1U)) {
+		dmar_unit->qi_head = (uint32_t)(iommu_read64(dmar_unit, DMAR_IQH_REG) >> DMAR_IQ_SHIFT);
+		ASSERT(((rdtsc() - start) < CYCLES_PER_MS), "DMAR QI Timeout!");
+		pause_cpu();
+	}
+
+	for (i = 0U; i < num; i++) {
+		queue[tail] = descs[i];
+		tail = (tail + 1U) % DMAR_QI_NUM;
+	}
+	queue[tail].lower = DMA_QI_WAIT_DESC | DMA_QI_WAIT_SW | DMA_QI_WAIT_FN | dma_qi_wait_data(DMAR_QI_DONE);
+	queue[tail].upper = hva2hpa((void *)&qi_wait_status[pcpu_id]);
+	tail = (tail + 1U) % DMAR_QI_NUM;
+
+	dmar_unit->qi_tail = tail;
+	iommu_write64(dmar_unit, DMAR_IQT_REG, (uint64_t)tail << DMAR_IQ_SHIFT);
+	spinlock_release(&(dmar_unit->lock));
+
+	start = rdtsc();
+	while (qi_wait_status[pcpu_id] != DMAR_QI_DONE) {
+		ASSERT(((rdtsc() - start) < CYCLES_PER_MS), "DMAR QI Timeout!");
+		pause_cpu();
+	}
+}
+
 static int dmar_register_hrhd(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(ACRN_DBG_IOMMU, "Register dmar uint [%d] @0x%llx", dmar_unit->index, dmar_unit->drhd->reg_base_addr);
@@ -444,6 +557,12 @@ static int dmar_register_hrhd(struct dmar_drhd_rt *dmar_unit)
 
 	dmar_disable_translation(dmar_unit);
 
+	/* the queue starts from scratch, even if left enabled by firmware */
+	if ((iommu_read32(dmar_unit, DMAR_GSTS_REG) & DMA_GSTS_QIES) != 0U) {
+		dmar_unit->gcmd |= DMA_GCMD_QIE;
+		dmar_disable_qi(dmar_unit);
+	}
+
 	return 0;
 }
 
@@ -491,6 +610,8 @@ static void dmar_write_buffer_flush(struct dmar_drhd_rt *dmar_unit)
 }
 
 /*
+ * Register-based invalidation, only when the invalidation queue is disabled.
+ *
  * did: domain id
  * sid: source id
  * fm: function mask
@@ -527,11 +648,6 @@ static void dmar_invalid_context_cache(struct dmar_drhd_rt *dmar_unit,
 	dev_dbg(ACRN_DBG_IOMMU, "cc invalidation granularity %d", dma_ccmd_get_caig_32(status));
 }
 
-static void dmar_invalid_context_cache_global(struct dmar_drhd_rt *dmar_unit)
-{
-	dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
-}
-
 static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t address, uint8_t am,
 			       bool hint, enum dmar_iirg_type iirg)
 {
@@ -575,14 +691,93 @@ static void dmar_invalid_iotlb(struct dmar_drhd_rt *dmar_unit, uint16_t did, uin
 	}
 }
 
-/* Invalidate IOTLB globally,
+/* Invalidate the context cache and the IOTLB globally,
  * all iotlb entries are invalidated,
  * all PASID-cache entries are invalidated,
  * all paging-structure-cache entries are invalidated.
  */
-static void dmar_invalid_iotlb_global(struct dmar_drhd_rt *dmar_unit)
+static void dmar_invalid_global(struct dmar_drhd_rt *dmar_unit)
+{
+	struct dmar_qi_desc descs[2];
+
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+		descs[0].lower = DMA_QI_CONTEXT_DESC | DMA_QI_CONTEXT_GLOBAL_INVL;
+		descs[0].upper = 0UL;
+		descs[1].lower = DMA_QI_IOTLB_DESC | DMA_QI_IOTLB_GLOBAL_INVL | DMA_QI_IOTLB_DR | DMA_QI_IOTLB_DW;
+		descs[1].upper = 0UL;
+		dmar_qi_submit(dmar_unit, descs, 2U);
+	} else {
+		dmar_invalid_context_cache(dmar_unit, 0U, 0U, 0U, DMAR_CIRG_GLOBAL);
+		dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	}
+}
+
+/* Invalidate the context cache of device sid and the IOTLB of its domain did,
+ * after its context entry changed.
+ */
+static void dmar_invalid_device(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint16_t sid)
+{
+	struct dmar_qi_desc descs[2];
+
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) != 0U) {
+		descs[0].lower = DMA_QI_CONTEXT_DESC | DMA_QI_CONTEXT_DEVICE_INVL | dma_qi_did(did) | dma_qi_sid(sid);
+		descs[0].upper = 0UL;
+		descs[1].lower = DMA_QI_IOTLB_DESC | DMA_QI_IOTLB_DOMAIN_INVL | DMA_QI_IOTLB_DR | DMA_QI_IOTLB_DW |
+				dma_qi_did(did);
+		descs[1].upper = 0UL;
+		dmar_qi_submit(dmar_unit, descs, 2U);
+	} else {
+		dmar_invalid_context_cache(dmar_unit, did, sid, 0U, DMAR_CIRG_DEVICE);
+		dmar_invalid_iotlb(dmar_unit, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+	}
+}
+
+/* Invalidate the IOTLB of [gpa, gpa + size) in domain did */
+static void dmar_invalid_iotlb_range(struct dmar_drhd_rt *dmar_unit, uint16_t did, uint64_t gpa, uint64_t size)
 {
-	dmar_invalid_iotlb(dmar_unit, 0U, 0UL, 0U, false, DMAR_IIRG_GLOBAL);
+	struct dmar_qi_desc descs[DMAR_QI_BATCH];
+	uint64_t addr = round_page_down(gpa);
+	uint64_t end = round_page_up(gpa + size);
+	uint16_t am, align;
+	uint16_t mamv = iommu_cap_max_amask_val(dmar_unit->cap);
+	uint32_t num = 0U;
+
+	if ((dmar_unit->gcmd & DMA_GCMD_QIE) == 0U) {
+		/* a single handshake rather than one per page */
+		dmar_invalid_iotlb(dmar_unit, did, 0UL, 0U, false, DMAR_IIRG_DOMAIN);
+		return;
+	}
+
+	if (iommu_cap_pgsel_inv(dmar_unit->cap) != 0U) {
+		/* cover the range with naturally aligned power-of-2 blocks */
+		while ((addr < end) && (num < DMAR_QI_BATCH)) {
+			am = fls64((end - addr) >> PAGE_SHIFT);
+			align = ffs64(addr >> PAGE_SHIFT);
+			if (align < am) {
+				am = align;
+			}
+			if (mamv < am) {
+				am = mamv;
+			}
+
+			descs[num].lower = DMA_QI_IOTLB_DESC | DMA_QI_IOTLB_PAGE_INVL | DMA_QI_IOTLB_DR | DMA_QI_IOTLB_DW |
+					dma_qi_did(did);
+			descs[num].upper = addr | dma_iotlb_invl_addr_am((uint8_t)am);
+			num++;
+			addr += (PAGE_SIZE << am);
+		}
+	}
+
+	if (addr < end) {
+		descs[0].lower = DMA_QI_IOTLB_DESC | DMA_QI_IOTLB_DOMAIN_INVL | DMA_QI_IOTLB_DR | DMA_QI_IOTLB_DW |
+				dma_qi_did(did);
+		descs[0].upper = 0UL;
+		num = 1U;
+	}
+
+	if (num != 0U) {
+		dmar_qi_submit(dmar_unit, descs, num);
+	}
 }
 
 static void dmar_set_root_table(struct dmar_drhd_rt *dmar_unit)
@@ -784,14 +979,15 @@ static void dmar_enable(struct dmar_drhd_rt *dmar_unit)
 {
 	dev_dbg(ACRN_DBG_IOMMU, "enable dmar uint [0x%x]", dmar_unit->drhd->reg_base_addr);
 	dmar_write_buffer_flush(dmar_unit);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
+	dmar_enable_qi(dmar_unit);
+	dmar_invalid_global(dmar_unit);
 	dmar_enable_translation(dmar_unit);
 }
 
 static void dmar_disable(struct dmar_drhd_rt *dmar_unit)
 {
 	dmar_disable_translation(dmar_unit);
+	dmar_disable_qi(dmar_unit);
 	dmar_fault_event_mask(dmar_unit);
 }
 
@@ -801,8 +997,7 @@ static void dmar_suspend(struct dmar_drhd_rt *dmar_unit)
 
 	/* flush */
 	dmar_write_buffer_flush(dmar_unit);
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
+	dmar_invalid_global(dmar_unit);
 
 	dmar_disable(dmar_unit);
 
@@ -975,8 +1170,7 @@ static int remove_iommu_device(const struct iommu_domain *domain, uint16_t segme
 
 	/* if caching mode is present, need to invalidate translation cache */
 	/* if(cap_caching_mode(dmar_unit->cap)) { */
-	dmar_invalid_context_cache_global(dmar_unit);
-	dmar_invalid_iotlb_global(dmar_unit);
+	dmar_invalid_device(dmar_unit, dom_id, (uint16_t)(((uint16_t)bus << 8U) | devfun));
 	/* } */
 	return 0;
 }
@@ -1078,6 +1272,21 @@ int unassign_iommu_device(const struct iommu_domain *domain, uint8_t bus, uint8_
 	return 0;
 }
 
+void iommu_flush_iotlb(const struct iommu_domain *domain, uint64_t gpa, uint64_t size)
+{
+	struct dmar_info *info = get_dmar_info();
+	struct dmar_drhd_rt *dmar_unit;
+	uint32_t i;
+
+	for (i = 0U; i < info->drhd_count; i++) {
+		dmar_unit = &dmar_drhd_units[i];
+		/* enabling translation invalidates everything anyway */
+		if (!dmar_unit->drhd->ignore && ((dmar_unit->gcmd & DMA_GCMD_TE) != 0U)) {
+			dmar_invalid_iotlb_range(dmar_unit, vmid_to_domainid(domain->vm_id), gpa, size);
+		}
+	}
+}
+
 void enable_iommu(void)
 {
 	if (!iommu_page_walk_coherent) {
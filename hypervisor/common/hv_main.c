@@ -74,6 +74,7 @@ void vcpu_thread(struct acrn_vcpu *vcpu)
 		/* Dispatch handler */
 		ret = vmexit_handler(vcpu);
 		basic_exit_reason = vcpu->arch.exit_reason & 0xFFFFU;
+		vmexit_account_vmcs(vcpu->pcpu_id, basic_exit_reason);
 		if (ret < 0) {
 			pr_fatal("dispatch VM exit handler failed for reason"
 				" %d, ret = %d!", basic_exit_reason, ret);
@@ -120,8 +120,14 @@ int32_t hcall_create_vm(struct acrn_vm *vm, uint64_t param)
 
 	(void)memset(&vm_desc, 0U, sizeof(vm_desc));
 	vm_desc.sworld_supported = ((cv.vm_flag & (SECURE_WORLD_ENABLED)) != 0U);
+	vm_desc.dirty_logging = ((cv.vm_flag & (DIRTY_LOGGING_ENABLED)) != 0U);
 	(void)memcpy_s(&vm_desc.GUID[0], 16U, &cv.GUID[0], 16U);
-	ret = create_vm(&vm_desc, &target_vm);
+	if (vm_desc.dirty_logging && !is_ept_ad_supported()) {
+		pr_err("%s: no EPT accessed/dirty flags for dirty logging\n", __func__);
+		ret = -ENODEV;
+	} else {
+		ret = create_vm(&vm_desc, &target_vm);
+	}
 
 	if (ret != 0) {
 		dev_dbg(ACRN_DBG_HYCALL, "HCALL: Create VM failed");
@@ -467,7 +473,8 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param
  * The function will return -1 if the target VM does not exist.
  *
  * @param vmid ID of the VM
- * @param vcpu_id vcpu ID of the requestor
+ * @param vcpu_id vcpu ID of the requestor, or the slot index of a posted
+ *                request
  *
  * @return 0 on success, non-zero on error.
  */
@@ -485,6 +492,12 @@ int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
 	dev_dbg(ACRN_DBG_HYCALL, "[%d] NOTIFY_FINISH for vcpu %d",
 			vmid, vcpu_id);
 
+	if ((vcpu_id >= VHM_REQUEST_POSTED_BASE) && (vcpu_id < VHM_REQUEST_MAX)) {
+		/* completion of a posted request, nobody is waiting for it */
+		complete_posted_ioreq(target_vm, vcpu_id);
+		return 0;
+	}
+
 	if (vcpu_id >= CONFIG_MAX_VCPUS_PER_VM) {
 		pr_err("%s, failed to get VCPU %d context from VM %d\n",
 			__func__, vcpu_id, target_vm->vm_id);
@@ -497,6 +510,128 @@ int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id)
 	return 0;
 }
 
+/**
+ * @brief add or remove a posted ioreq range
+ *
+ * Writes falling in a posted ioreq range are delivered to SOS without pausing
+ * the issuing vcpu of the target VM.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_posted_ioreq_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_ioreq_range(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_posted_ioreq_range range;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&range, 0U, sizeof(range));
+
+	if (copy_from_gpa(vm, &range, param, sizeof(range)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EFAULT;
+	}
+
+	return set_posted_ioreq_range(target_vm, &range);
+}
+
+/**
+ * @brief add or remove a doorbell
+ *
+ * Writes hitting a doorbell of the target VM are signaled to SOS through the
+ * doorbell pending buffer, without pausing the issuing vcpu.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_doorbell
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_doorbell(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct acrn_doorbell db;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&db, 0U, sizeof(db));
+
+	if (copy_from_gpa(vm, &db, param, sizeof(db)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EFAULT;
+	}
+
+	return set_doorbell(target_vm, &db);
+}
+
+/**
+ * @brief set the doorbell pending buffer
+ *
+ * Set the buffer in which the pending bits of the doorbells of the target VM
+ * are reported to SOS.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_doorbell_buffer
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_doorbell_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	uint64_t hpa;
+	struct acrn_set_doorbell_buffer dbbuf;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&dbbuf, 0U, sizeof(dbbuf));
+
+	if (copy_from_gpa(vm, &dbbuf, param, sizeof(dbbuf)) != 0) {
+		pr_err("%s: Unable copy param to vm\n", __func__);
+		return -EFAULT;
+	}
+
+	dev_dbg(ACRN_DBG_HYCALL, "[%d] SET DOORBELL BUFFER=0x%p",
+			vmid, dbbuf.buf);
+
+	/* the buffer shall not cross a page boundary */
+	if ((dbbuf.buf & PAGE_MASK) != ((dbbuf.buf +
+			sizeof(struct acrn_doorbell_buffer) - 1UL) & PAGE_MASK)) {
+		return -EINVAL;
+	}
+
+	hpa = gpa2hpa(vm, dbbuf.buf);
+	if (hpa == INVALID_HPA) {
+		pr_err("%s,vm[%hu] gpa 0x%llx,GPA is unmapping.",
+			__func__, vm->vm_id, dbbuf.buf);
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&target_vm->doorbell.lock);
+	target_vm->doorbell.buf = (struct acrn_doorbell_buffer *)hpa2hva(hpa);
+	(void)memset((void *)target_vm->doorbell.buf, 0U,
+			sizeof(struct acrn_doorbell_buffer));
+	spinlock_release(&target_vm->doorbell.lock);
+
+	return 0;
+}
+
 /**
  *@pre Pointer vm shall point to VM0
  */
@@ -568,6 +703,7 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 		/* create gpa to hpa EPT mapping */
 		ept_mr_add(target_vm, pml4_page, hpa,
 				region->gpa, region->size, prot);
+		ept_mr_coalesce(target_vm, pml4_page, region->gpa, region->size);
 	} else {
 		ept_mr_del(target_vm, pml4_page,
 				region->gpa, region->size);
@@ -576,6 +712,9 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 	return 0;
 }
 
+/* regions copied from the guest at once by hcall_set_vm_memory_regions */
+#define MR_COPY_NUM	16U
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -589,10 +728,10 @@ static int32_t set_vm_memory_region(struct acrn_vm *vm,
 int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 {
 	struct set_regions set_regions;
-	struct vm_memory_region region;
+	struct vm_memory_region regions[MR_COPY_NUM];
 	struct acrn_vm *target_vm;
-	uint32_t idx;
-
+	uint32_t idx, i, num;
+	int32_t ret = 0;
 
 	(void)memset((void *)&set_regions, 0U, sizeof(set_regions));
 
@@ -611,24 +750,34 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param)
 		return -EFAULT;
 	}
 
+	/* one EPT flush for all the regions */
+	ept_batch_begin();
 	idx = 0U;
-	while (idx < set_regions.mr_num) {
-		int ret;
+	while ((idx < set_regions.mr_num) && (ret == 0)) {
+		num = set_regions.mr_num - idx;
+		if (num > MR_COPY_NUM) {
+			num = MR_COPY_NUM;
+		}
 
-		if (copy_from_gpa(vm, &region,
-			set_regions.regions_gpa + idx * sizeof(region),
-			sizeof(region)) != 0) {
+		if (copy_from_gpa(vm, regions,
+			set_regions.regions_gpa + idx * sizeof(regions[0]),
+			num * sizeof(regions[0])) != 0) {
 			pr_err("%s: Copy region entry fail from vm\n", __func__);
-			return -EFAULT;
+			ret = -EFAULT;
+			break;
 		}
 
-		ret = set_vm_memory_region(vm, target_vm, &region);
-		if (ret < 0) {
-			return ret;
+		for (i = 0U; i < num; i++) {
+			ret = set_vm_memory_region(vm, target_vm, &regions[i]);
+			if (ret < 0) {
+				break;
+			}
 		}
-		idx++;
+		idx += num;
 	}
-	return 0;
+	ept_batch_end();
+
+	return ret;
 }
 
 /**
@@ -701,6 +850,174 @@ int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_
 	return write_protect_page(target_vm, &wp);
 }
 
+/* pages copied from the guest at once by hcall_write_protect_pages */
+#define WP_COPY_NUM	32U
+
+/**
+ * @pre Pointer vm shall point to VM0
+ */
+int32_t hcall_write_protect_pages(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct wp_pages pages;
+	struct wp_data wp[WP_COPY_NUM];
+	int32_t result[WP_COPY_NUM];
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint32_t idx, i, num;
+	int32_t ret = 0;
+
+	if (target_vm == NULL) {
+		return -EINVAL;
+	}
+
+	if (is_vm0(target_vm)) {
+		pr_err("%s: Targeting to service vm", __func__);
+		return -EINVAL;
+	}
+
+	(void)memset((void *)&pages, 0U, sizeof(pages));
+
+	if (copy_from_gpa(vm, &pages, param, sizeof(pages)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -EFAULT;
+	}
+
+	/* one EPT flush for all the pages */
+	ept_batch_begin();
+	idx = 0U;
+	while (idx < pages.num) {
+		num = pages.num - idx;
+		if (num > WP_COPY_NUM) {
+			num = WP_COPY_NUM;
+		}
+
+		if (copy_from_gpa(vm, wp, pages.wp_gpa + idx * sizeof(wp[0]),
+				num * sizeof(wp[0])) != 0) {
+			pr_err("%s: Unable copy wp entries from vm\n", __func__);
+			ret = -EFAULT;
+			break;
+		}
+
+		for (i = 0U; i < num; i++) {
+			result[i] = write_protect_page(target_vm, &wp[i]);
+			if (result[i] != 0) {
+				ret = -EINVAL;
+			}
+		}
+
+		if ((pages.result_gpa != 0UL) && (copy_to_gpa(vm, result,
+				pages.result_gpa + idx * sizeof(result[0]),
+				num * sizeof(result[0])) != 0)) {
+			pr_err("%s: Unable copy results to vm\n", __func__);
+			ret = -EFAULT;
+			break;
+		}
+		idx += num;
+	}
+	ept_batch_end();
+
+	return ret;
+}
+
+/* 64-bit dirty bitmap words copied to the guest at once by hcall_get_dirty_log */
+#define DIRTY_LOG_COPY_NUM	64U
+#define DIRTY_LOG_WINDOW_PAGES	(DIRTY_LOG_COPY_NUM * 64UL)
+
+struct dirty_log_ctx {
+	struct acrn_vm *vm;
+	struct acrn_dirty_log log;
+	uint64_t nr_pages;
+	/* window of the bitmap held in bitmap[], in DIRTY_LOG_WINDOW_PAGES */
+	uint64_t window;
+	uint64_t bitmap[DIRTY_LOG_COPY_NUM];
+	int32_t ret;
+};
+
+static void dirty_log_copy_window(struct dirty_log_ctx *ctx)
+{
+	uint64_t first = ctx->window * DIRTY_LOG_COPY_NUM;
+	uint64_t num = ((ctx->nr_pages + 63UL) >> 6U) - first;
+
+	if (num > DIRTY_LOG_COPY_NUM) {
+		num = DIRTY_LOG_COPY_NUM;
+	}
+
+	if ((ctx->ret == 0) && (copy_to_gpa(ctx->vm, ctx->bitmap,
+			ctx->log.bitmap_gpa + (first * sizeof(uint64_t)),
+			(uint32_t)(num * sizeof(uint64_t))) != 0)) {
+		pr_err("%s: Unable copy dirty bitmap to vm\n", __func__);
+		ctx->ret = -EFAULT;
+	}
+
+	(void)memset((void *)ctx->bitmap, 0U, sizeof(ctx->bitmap));
+	ctx->window++;
+}
+
+static void dirty_log_set(void *data, uint64_t gpa, uint64_t size)
+{
+	struct dirty_log_ctx *ctx = (struct dirty_log_ctx *)data;
+	uint64_t page = (gpa - ctx->log.gpa) >> PAGE_SHIFT;
+	uint64_t end = page + (size >> PAGE_SHIFT);
+	uint64_t idx;
+
+	while (page < end) {
+		/* the reports come in ascending gpa order */
+		while ((page / DIRTY_LOG_WINDOW_PAGES) > ctx->window) {
+			dirty_log_copy_window(ctx);
+		}
+
+		idx = page % DIRTY_LOG_WINDOW_PAGES;
+		if (((idx & 0x3fUL) == 0UL) && ((end - page) >= 64UL)) {
+			ctx->bitmap[idx >> 6U] = ~0UL;
+			page += 64UL;
+		} else {
+			ctx->bitmap[idx >> 6U] |= 1UL << (idx & 0x3fUL);
+			page++;
+		}
+	}
+}
+
+/**
+ * @pre Pointer vm shall point to VM0
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param)
+{
+	struct dirty_log_ctx ctx;
+	struct acrn_vm *target_vm = get_vm_from_vmid(vmid);
+	uint64_t gpa_end;
+
+	if ((target_vm == NULL) || is_vm0(target_vm)) {
+		return -EINVAL;
+	}
+
+	if (!target_vm->arch_vm.ept_ad_enabled) {
+		pr_err("%s: dirty logging not enabled for vm%d\n", __func__, vmid);
+		return -ENODEV;
+	}
+
+	(void)memset((void *)&ctx, 0U, sizeof(ctx));
+	if (copy_from_gpa(vm, &ctx.log, param, sizeof(ctx.log)) != 0) {
+		pr_err("%s: Unable copy param from vm\n", __func__);
+		return -EFAULT;
+	}
+
+	gpa_end = ctx.log.gpa + ctx.log.size;
+	if (!mem_aligned_check(ctx.log.gpa, PAGE_SIZE) || !mem_aligned_check(ctx.log.size, PAGE_SIZE) ||
+			(ctx.log.size == 0UL) || (gpa_end < ctx.log.gpa) ||
+			(gpa_end > target_vm->arch_vm.ept_mem_ops.info->ept.top_address_space)) {
+		pr_err("%s: invalid range [0x%llx, 0x%llx)\n", __func__, ctx.log.gpa, gpa_end);
+		return -EINVAL;
+	}
+
+	ctx.vm = vm;
+	ctx.nr_pages = ctx.log.size >> PAGE_SHIFT;
+	ept_harvest_dirty(target_vm, ctx.log.gpa, ctx.log.size, dirty_log_set, &ctx);
+	while ((ctx.window * DIRTY_LOG_WINDOW_PAGES) < ctx.nr_pages) {
+		dirty_log_copy_window(&ctx);
+	}
+
+	return ctx.ret;
+}
+
 /**
  * @brief translate guest physical address to host physical address
  *
@@ -71,6 +71,10 @@ void reset_vm_ioreqs(struct acrn_vm *vm)
 	for (i = 0U; i < VHM_REQUEST_MAX; i++) {
 		atomic_store32(&req_buf->req_queue[i].processed, REQ_STATE_FREE);
 	}
+
+	spinlock_obtain(&vm->posted_ioreq.lock);
+	vm->posted_ioreq.next_slot = 0U;
+	spinlock_release(&vm->posted_ioreq.lock);
 }
 
 static bool has_complete_ioreq(struct acrn_vcpu *vcpu)
@@ -96,22 +100,28 @@ static bool has_complete_ioreq(struct acrn_vcpu *vcpu)
  *
  * @param pcpu_id The physical cpu id of vcpu whose IO request to be checked
  *
- * @return None
+ * @return true if a vcpu on \p pcpu_id polls for completion, false otherwise
  */
-void handle_complete_ioreq(uint16_t pcpu_id)
+bool handle_complete_ioreq(uint16_t pcpu_id)
 {
-	struct acrn_vcpu *vcpu = get_ever_run_vcpu(pcpu_id);
-	struct acrn_vm *vm;
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	struct acrn_vcpu *vcpu;
+	bool polling = false;
+	uint16_t i;
 
-	if (vcpu != NULL) {
-		vm = vcpu->vm;
-		if (vm->sw.is_completion_polling) {
+	/* any of the vcpus sharing this pcpu may be waiting for a completion */
+	for (i = 0U; i < CONFIG_MAX_VCPUS_PER_PCPU; i++) {
+		vcpu = ctx->vcpus[i];
+		if ((vcpu != NULL) && vcpu->vm->sw.is_completion_polling) {
+			polling = true;
 			if (has_complete_ioreq(vcpu)) {
 				/* we have completed ioreq pending */
 				emulate_io_post(vcpu);
 			}
 		}
 	}
+
+	return polling;
 }
 
 /**
@@ -146,6 +156,8 @@ int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request
 	if (vcpu->vm->sw.is_completion_polling) {
 		vhm_req->completion_polling = 1U;
 	}
+	vhm_req->posted = 0U;
+	vhm_req->vcpu = cur;
 
 	/* pause vcpu, wait for VHM to handle the MMIO request.
 	 * TODO: when pause_vcpu changed to switch vcpu out directlly, we
@@ -167,3 +179,322 @@ int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request
 
 	return 0;
 }
+
+/**
+ * @pre vm->posted_ioreq.lock is held
+ */
+static bool is_posted_ioreq(const struct acrn_vm *vm, const struct io_request *io_req)
+{
+	const struct posted_ioreq_range *range;
+	uint64_t address, size;
+	uint16_t i;
+	bool ret = false;
+
+	/* the direction, address and size fields of PIO & MMIO are the same */
+	if (io_req->reqs.pio.direction == REQUEST_WRITE) {
+		address = io_req->reqs.pio.address;
+		size = io_req->reqs.pio.size;
+
+		for (i = 0U; i < vm->posted_ioreq.num_ranges; i++) {
+			range = &vm->posted_ioreq.ranges[i];
+			if ((range->type == io_req->type) && (address >= range->start) &&
+					((address + size) <= range->end)) {
+				ret = true;
+				break;
+			}
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Deliver \p io_req to SOS as a posted request without suspending
+ * \p vcpu
+ *
+ * The request is put in the next slot of the posted request ring of the VM.
+ * A slot can be reused once VHM or DM has moved it to COMPLETE or FREE.
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the write
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ */
+int32_t acrn_insert_request_posted(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct acrn_vm *vm = vcpu->vm;
+	union vhm_request_buffer *req_buf;
+	struct vhm_request *vhm_req = NULL;
+	uint32_t state;
+	uint16_t cur;
+	int32_t ret;
+
+	req_buf = (union vhm_request_buffer *)vm->sw.io_shared_page;
+	if (req_buf == NULL) {
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&vm->posted_ioreq.lock);
+	if (!is_posted_ioreq(vm, io_req)) {
+		ret = -ENODEV;
+	} else {
+		cur = VHM_REQUEST_POSTED_BASE + vm->posted_ioreq.next_slot;
+		vhm_req = &req_buf->req_queue[cur];
+		state = atomic_load32(&vhm_req->processed);
+
+		if ((state != REQ_STATE_FREE) && (state != REQ_STATE_COMPLETE)) {
+			/* ring is full, let the caller fall back to a blocking request */
+			ret = -EBUSY;
+		} else {
+			vm->posted_ioreq.next_slot =
+				(vm->posted_ioreq.next_slot + 1U) % VHM_REQUEST_POSTED_NUM;
+
+			vhm_req->type = io_req->type;
+			(void)memcpy_s(&vhm_req->reqs, sizeof(union vhm_io_request),
+				&io_req->reqs, sizeof(union vhm_io_request));
+			vhm_req->completion_polling = 0U;
+			vhm_req->posted = 1U;
+			vhm_req->vcpu = vcpu->vcpu_id;
+
+			/* Marking the request PENDING hands it over to VHM */
+			atomic_store32(&vhm_req->processed, REQ_STATE_PENDING);
+			ret = 0;
+		}
+	}
+	spinlock_release(&vm->posted_ioreq.lock);
+
+	if (ret == 0) {
+		acrn_print_request(vcpu->vcpu_id, vhm_req);
+		fire_vhm_interrupt();
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Release a slot of the posted request ring
+ *
+ * @param vm The VM owning the slot
+ * @param slot Index of the slot in the request buffer
+ *
+ * @pre slot >= VHM_REQUEST_POSTED_BASE && slot < VHM_REQUEST_MAX
+ */
+void complete_posted_ioreq(struct acrn_vm *vm, uint16_t slot)
+{
+	union vhm_request_buffer *req_buf;
+	struct vhm_request *vhm_req;
+
+	req_buf = (union vhm_request_buffer *)vm->sw.io_shared_page;
+	vhm_req = &req_buf->req_queue[slot];
+	if (atomic_load32(&vhm_req->processed) == REQ_STATE_COMPLETE) {
+		atomic_store32(&vhm_req->processed, REQ_STATE_FREE);
+	}
+}
+
+/**
+ * @brief Add or remove a posted I/O request range of a VM
+ *
+ * @param vm The VM whose posted ranges are to be changed
+ * @param range The range and the operation
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p range is invalid or is not registered (on removal)
+ * @retval -ENOMEM No more ranges can be registered
+ */
+int32_t set_posted_ioreq_range(struct acrn_vm *vm, const struct acrn_posted_ioreq_range *range)
+{
+	struct posted_ioreq_info *info = &vm->posted_ioreq;
+	uint16_t i;
+	int32_t ret = -EINVAL;
+
+	if (((range->type != REQ_PORTIO) && (range->type != REQ_MMIO)) ||
+			(range->end <= range->start)) {
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&info->lock);
+	for (i = 0U; i < info->num_ranges; i++) {
+		if ((info->ranges[i].type == range->type) &&
+				(info->ranges[i].start == range->start) &&
+				(info->ranges[i].end == range->end)) {
+			break;
+		}
+	}
+
+	if (range->op == POSTED_IOREQ_ASSIGN) {
+		if (i < info->num_ranges) {
+			/* already registered */
+			ret = 0;
+		} else if (info->num_ranges >= POSTED_IOREQ_RANGE_MAX) {
+			ret = -ENOMEM;
+		} else {
+			info->ranges[i].type = range->type;
+			info->ranges[i].start = range->start;
+			info->ranges[i].end = range->end;
+			info->num_ranges++;
+			ret = 0;
+		}
+	} else if (range->op == POSTED_IOREQ_DEASSIGN) {
+		if (i < info->num_ranges) {
+			/* keep the table dense by moving the last entry here */
+			info->num_ranges--;
+			info->ranges[i] = info->ranges[info->num_ranges];
+			ret = 0;
+		}
+	} else {
+		/* invalid operation */
+	}
+	spinlock_release(&info->lock);
+
+	dev_dbg(ACRN_DBG_IOREQUEST, "vm%hu posted range op=%u type=%u [0x%llx, 0x%llx) ret=%d",
+		vm->vm_id, range->op, range->type, range->start, range->end, ret);
+
+	return ret;
+}
+
+static bool doorbell_hit(const struct doorbell *db, const struct io_request *io_req)
+{
+	bool ret = false;
+
+	if (db->type == io_req->type) {
+		if (io_req->type == REQ_PORTIO) {
+			const struct pio_request *pio_req = &io_req->reqs.pio;
+
+			/* value is the whole EAX, only its low size bytes are written */
+			ret = (pio_req->direction == REQUEST_WRITE) &&
+				(pio_req->address == db->addr) && (pio_req->size == db->len) &&
+				(!db->datamatch ||
+				(((uint64_t)pio_req->value & ((1UL << (db->len * 8U)) - 1UL)) == db->data));
+		} else {
+			const struct mmio_request *mmio_req = &io_req->reqs.mmio;
+
+			ret = (mmio_req->direction == REQUEST_WRITE) &&
+				(mmio_req->address == db->addr) && (mmio_req->size == db->len) &&
+				(!db->datamatch || (mmio_req->value == db->data));
+		}
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Signal SOS if \p io_req hits a doorbell of the VM
+ *
+ * The pending bit of the doorbell is set in the buffer shared with SOS before
+ * the upcall is raised. Several hits before SOS fetches the bitmap are
+ * coalesced into one, which is fine for a doorbell.
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ */
+int32_t acrn_ring_doorbell(struct acrn_vcpu *vcpu, const struct io_request *io_req)
+{
+	struct doorbell_info *info = &vcpu->vm->doorbell;
+	uint16_t i;
+	int32_t ret = -ENODEV;
+
+	/* fast path for VMs without any doorbell */
+	if (info->num == 0U) {
+		return -ENODEV;
+	}
+
+	spinlock_obtain(&info->lock);
+	if (info->buf != NULL) {
+		for (i = 0U; i < info->num; i++) {
+			if (doorbell_hit(&info->doorbells[i], io_req)) {
+				bitmap_set_lock(info->doorbells[i].id,
+					&info->buf->pending[info->doorbells[i].id >> 6U]);
+				ret = 0;
+				break;
+			}
+		}
+	}
+	spinlock_release(&info->lock);
+
+	if (ret == 0) {
+		fire_vhm_interrupt();
+	}
+
+	return ret;
+}
+
+/**
+ * @brief Add or remove a doorbell of a VM
+ *
+ * @param vm The VM whose doorbells are to be changed
+ * @param db The doorbell and the operation
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p db is invalid or is not registered (on removal)
+ * @retval -EBUSY Another doorbell with the same ID or address exists
+ * @retval -ENOMEM No more doorbells can be registered
+ */
+int32_t set_doorbell(struct acrn_vm *vm, const struct acrn_doorbell *db)
+{
+	struct doorbell_info *info = &vm->doorbell;
+	struct doorbell entry;
+	uint16_t i;
+	int32_t ret = -EINVAL;
+
+	if ((db->id >= ACRN_DOORBELL_MAX) || ((db->len != 1U) && (db->len != 2U) &&
+			(db->len != 4U) && (db->len != 8U))) {
+		return -EINVAL;
+	}
+
+	entry.type = ((db->flags & DOORBELL_FLAG_PIO) != 0U) ? REQ_PORTIO : REQ_MMIO;
+	entry.len = db->len;
+	entry.addr = db->addr;
+	entry.datamatch = ((db->flags & DOORBELL_FLAG_DATAMATCH) != 0U);
+	entry.data = entry.datamatch ? db->data : 0UL;
+	entry.id = (uint16_t)db->id;
+
+	if ((entry.type == REQ_PORTIO) && ((entry.len > 4U) || (entry.addr > 0xFFFFUL))) {
+		return -EINVAL;
+	}
+
+	spinlock_obtain(&info->lock);
+	for (i = 0U; i < info->num; i++) {
+		if ((info->doorbells[i].type == entry.type) &&
+				(info->doorbells[i].addr == entry.addr) &&
+				(info->doorbells[i].len == entry.len) &&
+				(info->doorbells[i].datamatch == entry.datamatch) &&
+				(info->doorbells[i].data == entry.data)) {
+			break;
+		}
+	}
+
+	if ((db->flags & DOORBELL_FLAG_DEASSIGN) == 0U) {
+		if (i < info->num) {
+			ret = -EBUSY;
+		} else if (info->num >= ACRN_DOORBELL_MAX) {
+			ret = -ENOMEM;
+		} else {
+			ret = 0;
+			for (i = 0U; i < info->num; i++) {
+				if (info->doorbells[i].id == entry.id) {
+					ret = -EBUSY;
+					break;
+				}
+			}
+			if (ret == 0) {
+				info->doorbells[info->num] = entry;
+				info->num++;
+			}
+		}
+	} else {
+		if (i < info->num) {
+			/* keep the table dense by moving the last entry here */
+			info->num--;
+			info->doorbells[i] = info->doorbells[info->num];
+			ret = 0;
+		}
+	}
+	spinlock_release(&info->lock);
+
+	dev_dbg(ACRN_DBG_IOREQUEST, "vm%hu doorbell flags=0x%x addr=0x%llx len=%u id=%u ret=%d",
+		vm->vm_id, db->flags, db->addr, db->len, db->id, ret);
+
+	return ret;
+}
@@ -6,8 +6,18 @@
 
 #include <hypervisor.h>
 #include <schedule.h>
+#include <softirq.h>
 
 static unsigned long pcpu_used_bitmap;
+static spinlock_t pcpu_alloc_lock = { .head = 0U, .tail = 0U, };
+
+static void slice_timer_handler(void *data)
+{
+	struct sched_context *ctx = (struct sched_context *)data;
+
+	bitmap_set_lock(SLICE_EXPIRED, &ctx->flags);
+	bitmap_set_lock(NEED_RESCHEDULE, &ctx->flags);
+}
 
 void init_scheduler(void)
 {
@@ -22,6 +32,11 @@ void init_scheduler(void)
 		INIT_LIST_HEAD(&ctx->runqueue);
 		ctx->flags = 0UL;
 		ctx->curr_vcpu = NULL;
+		ctx->nr_vcpus = 0U;
+		ctx->exclusive = false;
+		(void)memset((void *)ctx->vcpus, 0U, sizeof(ctx->vcpus));
+		initialize_timer(&ctx->slice_timer, slice_timer_handler, ctx,
+			0UL, TICK_MODE_ONESHOT, 0UL);
 	}
 }
 
@@ -37,27 +52,111 @@ void release_schedule_lock(uint16_t pcpu_id)
 	spinlock_release(&ctx->scheduler_lock);
 }
 
+/**
+ * @brief Reserve a pCPU for a new vCPU
+ *
+ * A free pCPU is preferred. Otherwise the least loaded pCPU which is not
+ * dedicated to VM0 or a partition and hosts less than
+ * CONFIG_MAX_VCPUS_PER_PCPU vCPUs is shared.
+ *
+ * @return ID of the reserved pCPU, or INVALID_CPU_ID if none is available.
+ */
 uint16_t allocate_pcpu(void)
 {
-	uint16_t i;
+	uint16_t i, pcpu_id = INVALID_CPU_ID;
+	struct sched_context *ctx;
 
+	spinlock_obtain(&pcpu_alloc_lock);
 	for (i = 0U; i < phys_cpu_num; i++) {
-		if (bitmap_test_and_set_lock(i, &pcpu_used_bitmap) == 0) {
-			return i;
+		if (!bitmap_test(i, &pcpu_used_bitmap)) {
+			pcpu_id = i;
+			break;
 		}
 	}
 
-	return INVALID_CPU_ID;
+	if (pcpu_id == INVALID_CPU_ID) {
+		for (i = 0U; i < phys_cpu_num; i++) {
+			ctx = &per_cpu(sched_ctx, i);
+			if (!ctx->exclusive && (ctx->nr_vcpus < CONFIG_MAX_VCPUS_PER_PCPU) &&
+					((pcpu_id == INVALID_CPU_ID) ||
+					(ctx->nr_vcpus < per_cpu(sched_ctx, pcpu_id).nr_vcpus))) {
+				pcpu_id = i;
+			}
+		}
+	}
+
+	if (pcpu_id != INVALID_CPU_ID) {
+		per_cpu(sched_ctx, pcpu_id).nr_vcpus++;
+		bitmap_set_lock(pcpu_id, &pcpu_used_bitmap);
+	}
+	spinlock_release(&pcpu_alloc_lock);
+
+	return pcpu_id;
 }
 
+/**
+ * @brief Dedicate \p pcpu_id to a vCPU of VM0 or of a partition
+ */
 void set_pcpu_used(uint16_t pcpu_id)
 {
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+
+	spinlock_obtain(&pcpu_alloc_lock);
+	ctx->nr_vcpus++;
+	ctx->exclusive = true;
 	bitmap_set_lock(pcpu_id, &pcpu_used_bitmap);
+	spinlock_release(&pcpu_alloc_lock);
 }
 
+/**
+ * @brief Release the reservation of one vCPU on \p pcpu_id
+ */
 void free_pcpu(uint16_t pcpu_id)
 {
-	bitmap_clear_lock(pcpu_id, &pcpu_used_bitmap);
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+
+	spinlock_obtain(&pcpu_alloc_lock);
+	if (ctx->nr_vcpus > 0U) {
+		ctx->nr_vcpus--;
+	}
+	if (ctx->nr_vcpus == 0U) {
+		ctx->exclusive = false;
+		bitmap_clear_lock(pcpu_id, &pcpu_used_bitmap);
+	}
+	spinlock_release(&pcpu_alloc_lock);
+}
+
+/**
+ * @brief Record \p vcpu in the vCPUs of the pCPU reserved for it
+ */
+void attach_vcpu_to_pcpu(struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	uint16_t i;
+
+	spinlock_obtain(&pcpu_alloc_lock);
+	for (i = 0U; i < CONFIG_MAX_VCPUS_PER_PCPU; i++) {
+		if (ctx->vcpus[i] == NULL) {
+			ctx->vcpus[i] = vcpu;
+			break;
+		}
+	}
+	spinlock_release(&pcpu_alloc_lock);
+}
+
+void detach_vcpu_from_pcpu(const struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	uint16_t i;
+
+	spinlock_obtain(&pcpu_alloc_lock);
+	for (i = 0U; i < CONFIG_MAX_VCPUS_PER_PCPU; i++) {
+		if (ctx->vcpus[i] == vcpu) {
+			ctx->vcpus[i] = NULL;
+			break;
+		}
+	}
+	spinlock_release(&pcpu_alloc_lock);
 }
 
 void add_vcpu_to_runqueue(struct acrn_vcpu *vcpu)
@@ -82,20 +181,80 @@ void remove_vcpu_from_runqueue(struct acrn_vcpu *vcpu)
 	spinlock_release(&ctx->runqueue_lock);
 }
 
+/*
+ * Round-robin: the head of the runqueue runs. When its time slice expires it
+ * is moved to the tail, so the next runnable vCPU gets the pCPU.
+ */
 static struct acrn_vcpu *select_next_vcpu(uint16_t pcpu_id)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
 	struct acrn_vcpu *vcpu = NULL;
+	bool rotate = (bitmap_test_and_clear_lock(SLICE_EXPIRED, &ctx->flags) != 0);
 
 	spinlock_obtain(&ctx->runqueue_lock);
 	if (!list_empty(&ctx->runqueue)) {
 		vcpu = get_first_item(&ctx->runqueue, struct acrn_vcpu, run_list);
+		if (rotate && (vcpu == ctx->curr_vcpu) && (ctx->runqueue.next != ctx->runqueue.prev)) {
+			list_del(&vcpu->run_list);
+			list_add_tail(&vcpu->run_list, &ctx->runqueue);
+			vcpu = get_first_item(&ctx->runqueue, struct acrn_vcpu, run_list);
+		}
 	}
 	spinlock_release(&ctx->runqueue_lock);
 
 	return vcpu;
 }
 
+/*
+ * Arm the slice timer of this pCPU if another vCPU is waiting to run, stop it
+ * otherwise. A slice already running goes on unless \p switched, i.e. a new
+ * vCPU got the pCPU. Called on the pCPU owning \p ctx.
+ */
+static void update_slice_timer(struct sched_context *ctx, bool switched)
+{
+	bool contended;
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	contended = !list_empty(&ctx->runqueue) && (ctx->runqueue.next != ctx->runqueue.prev);
+	spinlock_release(&ctx->runqueue_lock);
+
+	if (!contended) {
+		del_timer(&ctx->slice_timer);
+	} else if (switched || !timer_is_active(&ctx->slice_timer)) {
+		del_timer(&ctx->slice_timer);
+		ctx->slice_timer.fire_tsc = rdtsc() + (CONFIG_SCHED_TIME_SLICE_MS * CYCLES_PER_MS);
+		(void)add_timer(&ctx->slice_timer);
+	}
+}
+
+/**
+ * @brief Whether vCPUs may have to share \p pcpu_id
+ */
+bool is_pcpu_shared(uint16_t pcpu_id)
+{
+	return (CONFIG_MAX_VCPUS_PER_PCPU > 1U) && !per_cpu(sched_ctx, pcpu_id).exclusive;
+}
+
+/**
+ * @brief Give the rest of the time slice of \p vcpu to the next runnable vCPU
+ *
+ * No-op if no other vCPU is waiting to run on its pCPU.
+ */
+void yield_vcpu(const struct acrn_vcpu *vcpu)
+{
+	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
+	bool contended;
+
+	spinlock_obtain(&ctx->runqueue_lock);
+	contended = !list_empty(&ctx->runqueue) && (ctx->runqueue.next != ctx->runqueue.prev);
+	spinlock_release(&ctx->runqueue_lock);
+
+	if (contended) {
+		bitmap_set_lock(SLICE_EXPIRED, &ctx->flags);
+		make_reschedule_request(vcpu);
+	}
+}
+
 void make_reschedule_request(const struct acrn_vcpu *vcpu)
 {
 	struct sched_context *ctx = &per_cpu(sched_ctx, vcpu->pcpu_id);
@@ -123,12 +282,17 @@ static void context_switch_out(struct acrn_vcpu *vcpu)
 	/* cancel event(int, gp, nmi and exception) injection */
 	cancel_event_injection(vcpu);
 
-	atomic_store32(&vcpu->running, 0U);
-	/* do prev vcpu context switch out */
-	/* For now, we don't need to invalid ept.
-	 * But if we have more than one vcpu on one pcpu,
-	 * we need add ept invalid operation here.
+	/* do prev vcpu context switch out
+	 * Each vcpu has its own VPID and its EPTP in its own VMCS, so the
+	 * TLB entries of different vcpus are tagged apart and no EPT or VPID
+	 * invalidation is needed when switching between them. SPEC_CTRL is
+	 * kept in the run_context at each VM exit already.
 	 */
+	if (is_pcpu_shared(vcpu->pcpu_id)) {
+		save_vcpu_shared_state(vcpu);
+	}
+
+	atomic_store32(&vcpu->running, 0U);
 }
 
 static void context_switch_in(struct acrn_vcpu *vcpu)
@@ -142,12 +306,16 @@ static void context_switch_in(struct acrn_vcpu *vcpu)
 	}
 
 	atomic_store32(&vcpu->running, 1U);
-	/* FIXME:
-	 * Now, we don't need to load new vcpu VMCS because
-	 * we only do switch between vcpu loop and idle loop.
-	 * If we have more than one vcpu on on pcpu, need to
-	 * add VMCS load operation here.
-	 */
+	per_cpu(vcpu, vcpu->pcpu_id) = vcpu;
+
+	if (is_pcpu_shared(vcpu->pcpu_id)) {
+		load_vcpu_shared_state(vcpu);
+	}
+
+	/* A vcpu not launched yet gets its VMCS loaded by init_vmcs() */
+	if (vcpu->launched && (get_ever_run_vcpu(vcpu->pcpu_id) != vcpu)) {
+		load_vmcs(vcpu);
+	}
 }
 
 void make_pcpu_offline(uint16_t pcpu_id)
@@ -170,6 +338,8 @@ int need_offline(uint16_t pcpu_id)
 void default_idle(void)
 {
 	uint16_t pcpu_id = get_cpu_id();
+	struct sched_context *ctx = &per_cpu(sched_ctx, pcpu_id);
+	bool polling;
 
 	while (1) {
 		if (get_cpu_id() == BOOT_CPU_ID) {
@@ -182,9 +352,22 @@ void default_idle(void)
 			cpu_dead(pcpu_id);
 		} else {
 			CPU_IRQ_ENABLE();
-			handle_complete_ioreq(pcpu_id);
-			cpu_do_idle();
+			/* timers of halted vcpus, e.g. vlapic timer, wake them up */
+			do_softirq();
+			polling = handle_complete_ioreq(pcpu_id);
 			CPU_IRQ_DISABLE();
+
+			/*
+			 * Only halt the pcpu when nothing can be missed: all
+			 * other wakeups come with an interrupt.
+			 */
+			if (polling || (per_cpu(softirq_pending, pcpu_id) != 0UL) ||
+					bitmap_test(NEED_RESCHEDULE, &ctx->flags) ||
+					bitmap_test(NEED_OFFLINE, &ctx->flags)) {
+				cpu_do_idle();
+			} else {
+				cpu_halt_until_interrupt();
+			}
 		}
 	}
 }
@@ -234,6 +417,7 @@ void schedule(void)
 
 	get_schedule_lock(pcpu_id);
 	next = select_next_vcpu(pcpu_id);
+	update_slice_timer(&per_cpu(sched_ctx, pcpu_id), prev != next);
 
 	if (prev == next) {
 		release_schedule_lock(pcpu_id);
@@ -4,6 +4,7 @@
  * SPDX-License-Identifier: BSD-3-Clause
  */
 #include <acrn_common.h>
+#include <io.h>
 
 #define CAT__(A,B) A ## B
 #define CAT_(A,B) CAT__(A,B)
@@ -11,3 +12,5 @@
 typedef int CAT_(CTA_DummyType,__LINE__)[(expr) ? 1 : -1]
 
 CTASSERT(sizeof(struct vhm_request) == (4096U/VHM_REQUEST_MAX));
+CTASSERT(CONFIG_MAX_VCPUS_PER_VM <= VHM_REQUEST_POSTED_BASE);
+CTASSERT(EMUL_PIO_IDX_MAX < 0xFFU);
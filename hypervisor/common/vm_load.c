@@ -122,7 +122,7 @@ int general_sw_loader(struct acrn_vm *vm)
 	/* calculate the kernel entry point */
 	zeropage = (struct zero_page *)sw_kernel->kernel_src_addr;
 	kernel_entry_offset = (uint32_t)(zeropage->hdr.setup_sects + 1U) * 512U;
-	if (vcpu->arch.cpu_mode == CPU_MODE_64BIT) {
+	if (get_vcpu_mode(vcpu) == CPU_MODE_64BIT) {
 		/* 64bit entry is the 512bytes after the start */
 		kernel_entry_offset += 512U;
 	}
@@ -218,8 +218,7 @@ static void profiling_disable_pmu(void)
 static int profiling_sbuf_put_variable(struct shared_buf *sbuf,
 					uint8_t *data, uint32_t size)
 {
-	uint32_t remaining_space, offset, next_tail;
-	void *to;
+	uint32_t offset;
 
 	/*
 	 * 1. check for null pointers and non-zero size
@@ -246,46 +245,18 @@ static int profiling_sbuf_put_variable(struct shared_buf *sbuf,
 		return 0;
 	}
 
-	if (sbuf->tail >= sbuf->head) {
-		remaining_space = sbuf->size - (sbuf->tail - sbuf->head);
-	} else {
-		remaining_space = sbuf->head - sbuf->tail;
-	}
-
-	if (size >= remaining_space) {
-		/* Only (remaining_space - 1) can be written to sbuf.
-		 * Since if the next_tail equals head, then it is assumed
-		 * that buffer is empty, not full
-		 */
+	offset = sbuf_reserve(sbuf, size);
+	if (offset == SBUF_NO_SPACE) {
+		/* the failed reservation still has to be committed */
+		sbuf_commit(sbuf);
 		dev_dbg(ACRN_DBG_PROFILING,
 		"Not enough space to write data! Returning without writing");
 		return 0;
 	}
 
-	next_tail = sbuf_next_ptr(sbuf->tail, size, sbuf->size);
-	dev_dbg(ACRN_DBG_PROFILING, "sbuf->tail: %llu, next_tail: %llu",
-		sbuf->tail, next_tail);
-
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-	if (next_tail < sbuf->tail) { /* wrap-around */
-		dev_dbg(ACRN_DBG_PROFILING, "wrap-around condition!");
-		offset = sbuf->size - sbuf->tail;
-		(void)memcpy_s(to, offset, data, offset);
-
-		/* 2nd part */
-		to = (void *)sbuf + SBUF_HEAD_SIZE;
-
-		if ((size - offset) > 0U) {
-			(void)memcpy_s(to, size - offset,
-				data + offset, size - offset);
-		}
-	} else {
-		dev_dbg(ACRN_DBG_PROFILING, "non-wrap-around!");
-		(void)memcpy_s(to, size, data, size);
-	}
-
-	sbuf->tail = next_tail;
+	/* splits the sample if it wraps around the buffer */
+	sbuf_copy_in(sbuf, offset, data, size);
+	sbuf_commit(sbuf);
 
 	return (int)size;
 }
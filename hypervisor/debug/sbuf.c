@@ -43,53 +43,101 @@ uint32_t sbuf_get(struct shared_buf *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len)
+{
+	uint32_t start = 0U, head, used, drop;
+	bool reserved = false;
+
+	(void)atomic_inc_return(&sbuf->nr_reserved);
+
+	while (!reserved) {
+		start = sbuf->reserve_tail;
+		head = sbuf->head;
+		used = (start >= head) ? (start - head) : (sbuf->size - (head - start));
+
+		/* at least one byte stays free, tail == head means empty */
+		if (len >= (sbuf->size - used)) {
+			/* accumulate overrun count if necessary */
+			sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
+
+			/*
+			 * Overwriting drops whole elements, so it keeps the
+			 * records of ele_size multiples intact only.
+			 */
+			if (((sbuf->flags & OVERWRITE_EN) == 0U) ||
+					((len % sbuf->ele_size) != 0U)) {
+				return SBUF_NO_SPACE;
+			}
+			drop = (len - (sbuf->size - used)) + sbuf->ele_size;
+			/* the consumer may move head meanwhile */
+			(void)atomic_cmpxchg32(&sbuf->head, head,
+					sbuf_next_ptr(head, drop, sbuf->size));
+		} else {
+			reserved = (atomic_cmpxchg32(&sbuf->reserve_tail, start,
+					sbuf_next_ptr(start, len, sbuf->size)) == start);
+		}
+	}
+
+	return start;
+}
+
+void sbuf_copy_in(struct shared_buf *sbuf, uint32_t offset,
+		const uint8_t *data, uint32_t len)
+{
+	uint32_t first = sbuf->size - offset;
+
+	if (len <= first) {
+		(void)memcpy_s(sbuf_data(sbuf, offset), len, data, len);
+	} else {
+		(void)memcpy_s(sbuf_data(sbuf, offset), first, data, first);
+		(void)memcpy_s(sbuf_data(sbuf, 0U), len - first, data + first, len - first);
+	}
+}
+
+void sbuf_commit(struct shared_buf *sbuf)
+{
+	uint32_t tail;
+
+	/*
+	 * Nested producers ran to completion before the outer one resumes,
+	 * so when no reservation is left, everything up to reserve_tail is
+	 * filled. A nested producer may publish between reading tail and
+	 * reserve_tail here, then the cmpxchg fails and is retried, so tail
+	 * never moves back.
+	 */
+	if (atomic_dec_return(&sbuf->nr_reserved) == 0) {
+		do {
+			tail = sbuf->tail;
+		} while (atomic_cmpxchg32(&sbuf->tail, tail, sbuf->reserve_tail) != tail);
+	}
+}
+
 /**
- * The high caller should guarantee each time there must have
- * sbuf->ele_size data can be write form data and this function
- * should guarantee execution atomically.
+ * Put one element of sbuf->ele_size bytes to \p sbuf.
  *
  * flag:
  * If OVERWRITE_EN set, buf can store (ele_num - 1) elements at most.
- * Should use lock to guarantee that only one read or write at
- * the same time.
+ * The oldest element is dropped when it is full.
  * if OVERWRITE_EN not set, buf can store (ele_num - 1) elements
  * at most. Shouldn't modify the sbuf->head.
  *
  * return:
  * ele_size:	write succeeded.
  * 0:		no write, buf is full
- * negative:	failed.
  */
 
 uint32_t sbuf_put(struct shared_buf *sbuf, uint8_t *data)
 {
-	void *to;
-	uint32_t next_tail;
-	bool trigger_overwrite = false;
-
-	next_tail = sbuf_next_ptr(sbuf->tail, sbuf->ele_size, sbuf->size);
-	/* if this write would trigger overrun */
-	if (next_tail == sbuf->head) {
-		/* accumulate overrun count if necessary */
-		sbuf->overrun_cnt += sbuf->flags & OVERRUN_CNT_EN;
-		if ((sbuf->flags & OVERWRITE_EN) == 0U) {
-			/* if not enable over write, return here. */
-			return 0;
-		}
-		trigger_overwrite = true;
-	}
+	uint32_t offset, ret = 0U;
 
-	to = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->tail;
-
-	(void)memcpy_s(to, sbuf->ele_size, data, sbuf->ele_size);
-
-	if (trigger_overwrite) {
-		sbuf->head = sbuf_next_ptr(sbuf->head,
-				sbuf->ele_size, sbuf->size);
+	offset = sbuf_reserve(sbuf, sbuf->ele_size);
+	if (offset != SBUF_NO_SPACE) {
+		sbuf_copy_in(sbuf, offset, data, sbuf->ele_size);
+		ret = sbuf->ele_size;
 	}
-	sbuf->tail = next_tail;
+	sbuf_commit(sbuf);
 
-	return sbuf->ele_size;
+	return ret;
 }
 
 int sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
@@ -99,6 +147,13 @@ int sbuf_share_setup(uint16_t pcpu_id, uint32_t sbuf_id, uint64_t *hva)
 		return -EINVAL;
 	}
 
+	if (hva != NULL) {
+		struct shared_buf *sbuf = (struct shared_buf *)hva;
+
+		/* no producer can use it yet */
+		sbuf->nr_reserved = 0;
+		sbuf->reserve_tail = sbuf->tail;
+	}
 	per_cpu(sbuf, pcpu_id)[sbuf_id] = hva;
 	pr_info("%s share sbuf for pCPU[%u] with sbuf_id[%u] setup successfully",
 			__func__, pcpu_id, sbuf_id);
@@ -29,6 +29,8 @@ static int shell_show_cpu_int(__unused int argc, __unused char **argv);
 static int shell_show_ptdev_info(__unused int argc, __unused char **argv);
 static int shell_show_vioapic_info(int argc, char **argv);
 static int shell_show_ioapic_info(__unused int argc, __unused char **argv);
+static int shell_show_heap_info(__unused int argc, __unused char **argv);
+static int shell_show_vmexit_info(__unused int argc, __unused char **argv);
 static int shell_loglevel(int argc, char **argv);
 static int shell_cpuid(int argc, char **argv);
 static int shell_trigger_crash(int argc, char **argv);
@@ -96,6 +98,18 @@ static struct shell_cmd shell_cmds[] = {
 		.help_str	= SHELL_CMD_IOAPIC_HELP,
 		.fcn		= shell_show_ioapic_info,
 	},
+	{
+		.str		= SHELL_CMD_HEAP,
+		.cmd_param	= SHELL_CMD_HEAP_PARAM,
+		.help_str	= SHELL_CMD_HEAP_HELP,
+		.fcn		= shell_show_heap_info,
+	},
+	{
+		.str		= SHELL_CMD_VMEXIT,
+		.cmd_param	= SHELL_CMD_VMEXIT_PARAM,
+		.help_str	= SHELL_CMD_VMEXIT_HELP,
+		.fcn		= shell_show_vmexit_info,
+	},
 	{
 		.str		= SHELL_CMD_LOG_LVL,
 		.cmd_param	= SHELL_CMD_LOG_LVL_PARAM,
@@ -1188,6 +1202,114 @@ static int shell_show_ioapic_info(__unused int argc, __unused char **argv)
 	return err;
 }
 
+static void get_heap_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	struct heap_stats stats;
+	size_t len, size = str_max;
+	uint32_t c;
+
+	get_heap_stats(&stats);
+
+	len = snprintf(str, size, "\r\nHeap: %u buffers of %u bytes, %u used (%u cached), %u free"
+			"\r\nFree extents: %u, largest %u buffers"
+			"\r\nmalloc: %llu, cache hits: %llu, failures: %llu, free: %llu"
+			"\r\n\r\nCLASS SIZE\tCACHED",
+			stats.total_buffs, stats.buff_size, stats.used_buffs, stats.cached_buffs,
+			stats.total_buffs - stats.used_buffs,
+			stats.free_extents, stats.largest_free_extent,
+			stats.allocs, stats.cache_hits, stats.failures, stats.frees);
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (c = 0U; c < MALLOC_NR_SIZE_CLASSES; c++) {
+		len = snprintf(str, size, "\r\n%u\t\t%u", stats.class_size[c], stats.class_cached[c]);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int shell_show_heap_info(__unused int argc, __unused char **argv)
+{
+	get_heap_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+	return 0;
+}
+
+/**
+ * @brief Get the VMCS accesses per VM exit reason, summed over all pCPUs.
+ *
+ * It's for debug only.
+ *
+ * @param[in]	str_max	The max size of the string containing the info
+ * @param[inout]	str_arg	Pointer to the output info
+ */
+static void get_vmexit_info(char *str_arg, size_t str_max)
+{
+	char *str = str_arg;
+	uint16_t pcpu_id;
+	uint32_t reason;
+	uint64_t exits, vmreads, vmwrites;
+	const struct vmexit_vmcs_stat *stat;
+	size_t len, size = str_max;
+
+	len = snprintf(str, size, "\r\nREASON\tEXITS\t\tVMREAD\t\tVMWRITE"
+			"\t\tVMREAD/EXIT\tVMWRITE/EXIT");
+	if (len >= size) {
+		goto overflow;
+	}
+	size -= len;
+	str += len;
+
+	for (reason = 0U; reason < NR_VMX_EXIT_REASONS; reason++) {
+		exits = 0UL;
+		vmreads = 0UL;
+		vmwrites = 0UL;
+		for (pcpu_id = 0U; pcpu_id < phys_cpu_num; pcpu_id++) {
+			stat = &per_cpu(vmexit_vmcs, pcpu_id)[reason];
+			exits += stat->exits;
+			vmreads += stat->vmreads;
+			vmwrites += stat->vmwrites;
+		}
+		if (exits == 0UL) {
+			continue;
+		}
+
+		len = snprintf(str, size, "\r\n%u\t%-16llu%-16llu%-16llu%-16llu%llu",
+			reason, exits, vmreads, vmwrites,
+			vmreads / exits, vmwrites / exits);
+		if (len >= size) {
+			goto overflow;
+		}
+		size -= len;
+		str += len;
+	}
+	snprintf(str, size, "\r\n");
+	return;
+
+overflow:
+	printf("buffer size could not be enough! please check!\n");
+}
+
+static int shell_show_vmexit_info(__unused int argc, __unused char **argv)
+{
+	get_vmexit_info(shell_log_buf, SHELL_LOG_BUF_SIZE);
+	shell_puts(shell_log_buf);
+	return 0;
+}
+
 static int shell_loglevel(int argc, char **argv)
 {
 	char str[MAX_STR_SIZE] = {0};
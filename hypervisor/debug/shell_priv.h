@@ -78,6 +78,14 @@ struct shell {
 #define SHELL_CMD_VIOAPIC_PARAM		"<vm id>"
 #define SHELL_CMD_VIOAPIC_HELP		"show vioapic info"
 
+#define SHELL_CMD_HEAP			"heap"
+#define SHELL_CMD_HEAP_PARAM		NULL
+#define SHELL_CMD_HEAP_HELP		"show heap usage and fragmentation"
+
+#define SHELL_CMD_VMEXIT		"vmexit"
+#define SHELL_CMD_VMEXIT_PARAM		NULL
+#define SHELL_CMD_VMEXIT_HELP		"show VMREAD/VMWRITE count per VM exit reason"
+
 #define SHELL_CMD_LOG_LVL		"loglevel"
 #define SHELL_CMD_LOG_LVL_PARAM		"[<console_loglevel> [<mem_loglevel> " \
 					"[npk_loglevel]]]"
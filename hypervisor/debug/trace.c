@@ -45,65 +45,90 @@ static inline bool trace_check(uint16_t cpu_id)
 	return true;
 }
 
-static inline void trace_put(uint16_t cpu_id, uint32_t evid, uint32_t n_data, struct trace_entry *entry)
+/*
+ * Reserve the next entry of the trace buffer of cpu_id, to be filled in place
+ * and published by trace_commit(). Returns NULL if the buffer is full.
+ */
+static inline struct trace_entry *trace_reserve(uint16_t cpu_id, uint32_t evid, uint32_t n_data)
 {
 	struct shared_buf *sbuf = (struct shared_buf *)
 				per_cpu(sbuf, cpu_id)[ACRN_TRACE];
+	struct trace_entry *entry = NULL;
+	uint32_t offset;
+
+	offset = sbuf_reserve(sbuf, sbuf->ele_size);
+	if (offset != SBUF_NO_SPACE) {
+		entry = (struct trace_entry *)sbuf_data(sbuf, offset);
+		entry->tsc = rdtsc();
+		entry->id = evid;
+		entry->n_data = (uint8_t)n_data;
+		entry->cpu = (uint8_t)cpu_id;
+	}
 
-	entry->tsc = rdtsc();
-	entry->id = evid;
-	entry->n_data = (uint8_t)n_data;
-	entry->cpu = (uint8_t)cpu_id;
-	(void)sbuf_put(sbuf, (uint8_t *)entry);
+	return entry;
+}
+
+static inline void trace_commit(uint16_t cpu_id)
+{
+	sbuf_commit((struct shared_buf *)per_cpu(sbuf, cpu_id)[ACRN_TRACE]);
 }
 
 void TRACE_2L(uint32_t evid, uint64_t e, uint64_t f)
 {
-	struct trace_entry entry;
+	struct trace_entry *entry;
 	uint16_t cpu_id = get_cpu_id();
 
 	if (!trace_check(cpu_id)) {
 		return;
 	}
 
-	entry.payload.fields_64.e = e;
-	entry.payload.fields_64.f = f;
-	trace_put(cpu_id, evid, 2U, &entry);
+	entry = trace_reserve(cpu_id, evid, 2U);
+	if (entry != NULL) {
+		entry->payload.fields_64.e = e;
+		entry->payload.fields_64.f = f;
+	}
+	trace_commit(cpu_id);
 }
 
 void TRACE_4I(uint32_t evid, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
 {
-	struct trace_entry entry;
+	struct trace_entry *entry;
 	uint16_t cpu_id = get_cpu_id();
 
 	if (!trace_check(cpu_id)) {
 		return;
 	}
 
-	entry.payload.fields_32.a = a;
-	entry.payload.fields_32.b = b;
-	entry.payload.fields_32.c = c;
-	entry.payload.fields_32.d = d;
-	trace_put(cpu_id, evid, 4U, &entry);
+	entry = trace_reserve(cpu_id, evid, 4U);
+	if (entry != NULL) {
+		entry->payload.fields_32.a = a;
+		entry->payload.fields_32.b = b;
+		entry->payload.fields_32.c = c;
+		entry->payload.fields_32.d = d;
+	}
+	trace_commit(cpu_id);
 }
 
 void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uint8_t b1, uint8_t b2)
 {
-	struct trace_entry entry;
+	struct trace_entry *entry;
 	uint16_t cpu_id = get_cpu_id();
 
 	if (!trace_check(cpu_id)) {
 		return;
 	}
 
-	entry.payload.fields_8.a1 = a1;
-	entry.payload.fields_8.a2 = a2;
-	entry.payload.fields_8.a3 = a3;
-	entry.payload.fields_8.a4 = a4;
-	entry.payload.fields_8.b1 = b1;
-	entry.payload.fields_8.b2 = b2;
-	/* payload.fields_8.b3/b4 not used, but is put in trace buf */
-	trace_put(cpu_id, evid, 8U, &entry);
+	entry = trace_reserve(cpu_id, evid, 8U);
+	if (entry != NULL) {
+		entry->payload.fields_8.a1 = a1;
+		entry->payload.fields_8.a2 = a2;
+		entry->payload.fields_8.a3 = a3;
+		entry->payload.fields_8.a4 = a4;
+		entry->payload.fields_8.b1 = b1;
+		entry->payload.fields_8.b2 = b2;
+		/* payload.fields_8.b3/b4 not used, but is put in trace buf */
+	}
+	trace_commit(cpu_id);
 }
 
 #define TRACE_ENTER TRACE_16STR(TRACE_FUNC_ENTER, __func__)
@@ -111,7 +136,7 @@ void TRACE_6C(uint32_t evid, uint8_t a1, uint8_t a2, uint8_t a3, uint8_t a4, uin
 
 static inline void TRACE_16STR(uint32_t evid, const char name[])
 {
-	struct trace_entry entry;
+	struct trace_entry *entry;
 	uint16_t cpu_id = get_cpu_id();
 	size_t len, i;
 
@@ -119,15 +144,18 @@ static inline void TRACE_16STR(uint32_t evid, const char name[])
 		return;
 	}
 
-	entry.payload.fields_64.e = 0UL;
-	entry.payload.fields_64.f = 0UL;
+	entry = trace_reserve(cpu_id, evid, 16U);
+	if (entry != NULL) {
+		entry->payload.fields_64.e = 0UL;
+		entry->payload.fields_64.f = 0UL;
 
-	len = strnlen_s(name, 20U);
-	len = (len > 16U) ? 16U : len;
-	for (i = 0U; i < len; i++) {
-		entry.payload.str[i] = name[i];
-	}
+		len = strnlen_s(name, 20U);
+		len = (len > 16U) ? 16U : len;
+		for (i = 0U; i < len; i++) {
+			entry->payload.str[i] = name[i];
+		}
 
-	entry.payload.str[15] = 0;
-	trace_put(cpu_id, evid, 16U, &entry);
+		entry->payload.str[15] = 0;
+	}
+	trace_commit(cpu_id);
 }
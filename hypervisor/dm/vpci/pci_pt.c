@@ -121,6 +121,7 @@ static void vdev_pt_remap_bar(struct pci_vdev *vdev, uint32_t idx,
 {
 	struct acrn_vm *vm = vdev->vpci->vm;
 
+	ept_batch_begin();
 	if (vdev->bar[idx].base != 0UL) {
 		ept_mr_del(vm, (uint64_t *)vm->arch_vm.nworld_eptp,
 			vdev->bar[idx].base,
@@ -135,6 +136,7 @@ static void vdev_pt_remap_bar(struct pci_vdev *vdev, uint32_t idx,
 			vdev->bar[idx].size,
 			EPT_WR | EPT_RD | EPT_UNCACHED);
 	}
+	ept_batch_end();
 }
 
 static void vdev_pt_cfgwrite_bar(struct pci_vdev *vdev, uint32_t offset,
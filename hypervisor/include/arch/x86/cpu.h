@@ -241,7 +241,8 @@ extern spinlock_t trampoline_spinlock;
 #define	FEAT_8000_0001_ECX	5U     /* CPUID[8000_0001].ECX */
 #define	FEAT_8000_0001_EDX	6U     /* CPUID[8000_0001].EDX */
 #define	FEAT_8000_0008_EBX	7U     /* CPUID[8000_0008].EAX */
-#define	FEATURE_WORDS		8U
+#define	FEAT_D_1_EAX		8U     /* CPUID[EAX=0DH,ECX=1].EAX */
+#define	FEATURE_WORDS		9U
 /**
  *The invalid cpu_id (INVALID_CPU_ID) is error
  *code for error handling, this means that
@@ -284,6 +285,8 @@ struct cpuinfo_x86 {
 	uint32_t cpuid_level;
 	uint32_t extended_cpuid_level;
 	uint64_t physical_address_mask;
+	uint64_t xcr0_supported;	/* state components XCR0 can enable */
+	uint64_t xss_supported;		/* state components IA32_XSS can enable */
 	uint32_t cpuid_leaves[FEATURE_WORDS];
 	char model_name[64];
 	struct cpu_state_info state_info;
@@ -309,12 +312,14 @@ extern struct cpuinfo_x86 boot_cpu_data;
 
 /* Function prototypes */
 void cpu_do_idle(void);
+void cpu_halt_until_interrupt(void);
 void cpu_dead(uint16_t pcpu_id);
 void trampoline_start16(void);
 bool is_apicv_reg_virtualization_supported(void);
 bool is_apicv_intr_delivery_supported(void);
 bool is_apicv_posted_intr_supported(void);
 bool is_ept_supported(void);
+bool is_ept_ad_supported(void);
 bool cpu_has_cap(uint32_t bit);
 void load_cpu_state_data(void);
 void bsp_boot_init(void);
@@ -525,6 +530,15 @@ msr_write(uint32_t reg_num, uint64_t value64)
 	cpu_msr_write(reg_num, value64);
 }
 
+static inline uint64_t
+read_xcr(int reg)
+{
+	uint32_t low, high;
+
+	asm volatile("xgetbv" : "=a" (low), "=d" (high) : "c" (reg));
+	return ((uint64_t)high << 32U) | (uint64_t)low;
+}
+
 static inline void
 write_xcr(int reg, uint64_t val)
 {
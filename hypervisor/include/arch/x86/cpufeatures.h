@@ -80,6 +80,9 @@
 #define X86_FEATURE_L1D_FLUSH	((FEAT_7_0_EDX << 5U) + 28U)
 #define X86_FEATURE_ARCH_CAP	((FEAT_7_0_EDX << 5U) + 29U)
 
+/* Intel-defined CPU features, CPUID level 0x0000000D, sub-leaf 1 (EAX)*/
+#define X86_FEATURE_XSAVES	((FEAT_D_1_EAX << 5U) +  3U)
+
 /* Intel-defined CPU features, CPUID level 0x80000001 (EDX)*/
 #define X86_FEATURE_NX		((FEAT_8000_0001_EDX << 5U) + 20U)
 #define X86_FEATURE_PAGE1GB	((FEAT_8000_0001_EDX << 5U) + 26U)
@@ -48,6 +48,7 @@
 #define ACRN_REQUEST_EPT_FLUSH      5U
 #define ACRN_REQUEST_TRP_FAULT      6U
 #define ACRN_REQUEST_VPID_FLUSH    7U /* flush vpid tlb */
+#define ACRN_REQUEST_EPT_QUIESCE   8U /* stay in root mode while the EPT is merged */
 
 #define E820_MAX_ENTRIES    32U
 
@@ -114,6 +115,26 @@ uint64_t vcpumask2pcpumask(struct acrn_vm *vm, uint64_t vdmask);
 
 int gva2gpa(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa, uint32_t *err_code);
 
+/* Guest paging structure entries a translation went through */
+#define GUEST_WALK_MAX_LEVELS	4U
+struct guest_walk {
+	uint32_t num;
+	bool entry32;		/* 32-bit paging entries */
+	const void *entry[GUEST_WALK_MAX_LEVELS];	/* HV address */
+	uint64_t value[GUEST_WALK_MAX_LEVELS];
+};
+
+/**
+ * @brief Translate a GVA like gva2gpa() and record the guest paging entries
+ *
+ * As long as guest_walk_unchanged() returns true for the recorded walk, and
+ * the EPT mappings of the paging structures did not change, translating the
+ * same GVA with the same CR3 and paging controls gives the same GPA.
+ */
+int gva2gpa_walk(struct acrn_vcpu *vcpu, uint64_t gva, uint64_t *gpa,
+	uint32_t *err_code, struct guest_walk *walk);
+bool guest_walk_unchanged(const struct guest_walk *walk);
+
 enum vm_paging_mode get_vcpu_paging_mode(struct acrn_vcpu *vcpu);
 
 void init_e820(void);
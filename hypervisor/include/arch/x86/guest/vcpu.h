@@ -193,6 +193,34 @@ struct msr_store_area {
 	struct msr_store_entry host[MSR_AREA_COUNT];
 };
 
+/* Intel SDM 13.4, the XSAVE area must be 64-byte aligned */
+#define XSAVE_AREA_SIZE		4096U
+#define XSAVE_LEGACY_AREA_SIZE	512U
+#define XSAVE_HEADER_SIZE	64U
+
+struct xsave_area {
+	uint64_t legacy_region[XSAVE_LEGACY_AREA_SIZE / sizeof(uint64_t)];
+	uint64_t xstate_bv;
+	uint64_t xcomp_bv;
+	uint64_t reserved[(XSAVE_HEADER_SIZE / sizeof(uint64_t)) - 2U];
+	uint8_t extended_region[XSAVE_AREA_SIZE - XSAVE_LEGACY_AREA_SIZE - XSAVE_HEADER_SIZE];
+} __aligned(64);
+
+/*
+ * Guest state the pCPU holds outside of the VMCS and lets the guest access
+ * directly, saved while the vCPU is switched out of a shared pCPU.
+ */
+struct shared_state {
+	uint64_t ia32_star;
+	uint64_t ia32_lstar;
+	uint64_t ia32_cstar;
+	uint64_t ia32_fmask;
+	uint64_t ia32_kernel_gs_base;
+	uint64_t xcr0;
+	uint64_t ia32_xss;
+	struct xsave_area xsave_area;
+};
+
 struct acrn_vcpu_arch {
 	/* vmcs region for this vcpu, MUST be 4KB-aligned */
 	uint8_t vmcs[PAGE_SIZE];
@@ -221,6 +249,7 @@ struct acrn_vcpu_arch {
 	uint32_t idt_vectoring_info;
 	uint64_t exit_qualification;
 	uint32_t inst_len;
+	uint64_t inst_cache_gen;	/* decoded instruction cache generation */
 
 	/* Information related to secondary / AP VCPU start-up */
 	enum vm_cpu_mode cpu_mode;
@@ -233,6 +262,9 @@ struct acrn_vcpu_arch {
 
 	/* List of MSRS to be stored and loaded on VM exits or VM entries */
 	struct msr_store_area msr_area;
+
+	/* State switched by software between the vCPUs of a shared pCPU */
+	struct shared_state shared_state;
 } __aligned(PAGE_SIZE);
 
 struct acrn_vm;
@@ -255,17 +287,28 @@ struct acrn_vcpu {
 	bool launched; /* Whether the vcpu is launched on target pcpu */
 	uint32_t paused_cnt; /* how many times vcpu is paused */
 	uint32_t running; /* vcpu is picked up and run? */
+	uint32_t halted; /* vcpu is off the runqueue waiting for an event after HLT */
 
 	struct io_request req; /* used by io/ept emulation */
+	uint16_t last_mmio_idx; /* emul_mmio[] region hit by the last MMIO access */
 
 	uint64_t guest_msrs[IDX_MAX_MSR];
 #ifdef CONFIG_MTRR_ENABLED
 	struct mtrr_state mtrr;
 #endif /* CONFIG_MTRR_ENABLED */
+	/*
+	 * Guest state read from the VMCS since the last VM exit (reg_cached)
+	 * and modified, to be written back at next VM entry (reg_updated),
+	 * indexed by enum cpu_reg_name and VCPU_CACHED_*
+	 */
 	uint64_t reg_cached;
 	uint64_t reg_updated;
 } __aligned(PAGE_SIZE);
 
+/* reg_cached bits for VM exit state which are not guest registers */
+#define VCPU_CACHED_INST_LEN	48U
+#define VCPU_CACHED_CPU_MODE	49U
+
 struct vcpu_dump {
 	struct acrn_vcpu *vcpu;
 	char *str;
@@ -281,6 +324,7 @@ static inline bool is_vcpu_bsp(const struct acrn_vcpu *vcpu)
 static inline void vcpu_retain_rip(struct acrn_vcpu *vcpu)
 {
 	(vcpu)->arch.inst_len = 0U;
+	bitmap_set_lock(VCPU_CACHED_INST_LEN, &vcpu->reg_cached);
 }
 
 static inline struct acrn_vlapic *
@@ -301,7 +345,7 @@ vcpu_vlapic(struct acrn_vcpu *vcpu)
  *
  * @return the value of the register.
  */
-uint64_t vcpu_get_gpreg(const struct acrn_vcpu *vcpu, uint32_t reg);
+uint64_t vcpu_get_gpreg(struct acrn_vcpu *vcpu, uint32_t reg);
 
 /**
  * @brief set vcpu register value
@@ -325,6 +369,29 @@ void vcpu_set_gpreg(struct acrn_vcpu *vcpu, uint32_t reg, uint64_t val);
  */
 uint64_t vcpu_get_rip(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief get the length of the instruction which caused the VM exit
+ *
+ * Get & cache VM exit instruction length, 0 if vcpu_retain_rip() was called.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ *
+ * @return the instruction length.
+ */
+uint32_t vcpu_get_inst_len(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief get vcpu CPU mode
+ *
+ * Get & cache target vCPU's CPU mode, derived from EFER.LMA, CR0.PE and
+ * CS.L.
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ *
+ * @return the CPU mode.
+ */
+enum vm_cpu_mode get_vcpu_mode(struct acrn_vcpu *vcpu);
+
 /**
  * @brief set vcpu RIP value
  *
@@ -537,6 +604,25 @@ int create_vcpu(uint16_t pcpu_id, struct acrn_vm *vm, struct acrn_vcpu **rtn_vcp
  */
 int run_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief save the guest state the pcpu holds outside of the VMCS
+ *
+ * Save the syscall MSRs, KERNEL_GS_BASE, XCR0, IA32_XSS and the FPU and
+ * extended states of the guest, before another vcpu runs on the pcpu.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ * @pre vcpu != NULL && vcpu->pcpu_id == get_cpu_id()
+ */
+void save_vcpu_shared_state(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief restore the guest state saved by save_vcpu_shared_state()
+ *
+ * @param[in] vcpu pointer to vcpu data structure
+ * @pre vcpu != NULL && vcpu->pcpu_id == get_cpu_id()
+ */
+void load_vcpu_shared_state(const struct acrn_vcpu *vcpu);
+
 int shutdown_vcpu(struct acrn_vcpu *vcpu);
 
 /**
@@ -577,6 +663,27 @@ void pause_vcpu(struct acrn_vcpu *vcpu, enum vcpu_state new_state);
  */
 void resume_vcpu(struct acrn_vcpu *vcpu);
 
+/**
+ * @brief park the vcpu after guest HLT
+ *
+ * Remove a vCPU from the run queue till an event is pending for it, unless
+ * one already is.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ */
+void halt_vcpu(struct acrn_vcpu *vcpu);
+
+/**
+ * @brief wake up the vcpu parked by halt_vcpu()
+ *
+ * Put a halted vCPU back to the run queue and make a reschedule request for it.
+ *
+ * @param[inout] vcpu pointer to vcpu data structure
+ *
+ * @return true if the vCPU was halted, false otherwise
+ */
+bool wake_vcpu(struct acrn_vcpu *vcpu);
+
 /**
  * @brief set the vcpu to running state, then it will be scheculed.
  *
@@ -136,6 +136,18 @@ uint64_t vlapic_get_cr8(const struct acrn_vlapic *vlapic);
  */
 int vlapic_pending_intr(const struct acrn_vlapic *vlapic, uint32_t *vecptr);
 
+/**
+ * @brief Check for a vector pending in RVI.
+ *
+ * @param[in] vlapic Pointer to target vLAPIC data structure
+ *
+ * @return true if virtual-interrupt delivery will deliver the vector in
+ *	   RVI at next VM entry.
+ *
+ * @pre vlapic belongs to the vcpu of the current VMCS
+ */
+bool vlapic_apicv_rvi_pending(const struct acrn_vlapic *vlapic);
+
 /**
  * @brief Accept virtual interrupt.
  *
@@ -101,11 +101,17 @@ struct vm_arch {
 	 */
 	void *sworld_eptp;
 	struct memory_ops ept_mem_ops;
+	/* EPT accessed/dirty flags enabled, for dirty page logging */
+	bool ept_ad_enabled;
+	/* set while the vCPUs are held in root mode, see ept_coalesce() */
+	uint32_t ept_quiesce;
 
 	void *tmp_pg_array;	/* Page array for tmp guest paging struct */
 	struct acrn_vioapic vioapic;	/* Virtual IOAPIC base address */
 	struct acrn_vpic vpic;      /* Virtual PIC */
 	struct vm_io_handler_desc emul_pio[EMUL_PIO_IDX_MAX];
+	/* Index + 1 in emul_pio[] of the handler of each port, 0 if none */
+	uint8_t emul_pio_map[EMUL_PIO_MAP_PORTS];
 
 	/* reference to virtual platform to come here (as needed) */
 } __aligned(PAGE_SIZE);
@@ -137,7 +143,10 @@ struct acrn_vm {
 	spinlock_t spinlock;	/* Spin-lock used to protect VM modifications */
 
 	uint16_t emul_mmio_regions; /* Number of emulated mmio regions */
+	/* Emulated mmio regions, sorted by range_start and not overlapping */
 	struct mem_io_node emul_mmio[CONFIG_MAX_EMULATED_MMIO_REGIONS];
+	struct posted_ioreq_info posted_ioreq;	/* Ranges and ring of posted ioreqs */
+	struct doorbell_info doorbell;	/* Doorbells matched by the hypervisor */
 
 	unsigned char GUID[16];
 	struct secure_world_control sworld_control;
@@ -178,6 +187,8 @@ struct vm_description {
 	uint16_t               vm_hw_num_cores;   /* Number of virtual cores */
 	/* Whether secure world is supported for current VM. */
 	bool                   sworld_supported;
+	/* Whether EPT dirty page logging is enabled for current VM. */
+	bool                   dirty_logging;
 #ifdef CONFIG_PARTITION_MODE
 	uint8_t			vm_id;
 	struct mptable_info	*mptable;
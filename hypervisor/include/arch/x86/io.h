@@ -24,6 +24,12 @@
 #define TESTDEV_PIO_IDX		(RTC_PIO_IDX + 1U)
 #define EMUL_PIO_IDX_MAX	(TESTDEV_PIO_IDX + 1U)
 
+/*
+ * Ports below EMUL_PIO_MAP_PORTS are looked up in a per-VM port-to-handler
+ * map; the (rare) handlers above it are found by scanning emul_pio[].
+ */
+#define EMUL_PIO_MAP_PORTS	0x1000U
+
 /* Write 1 byte to specified I/O port */
 static inline void pio_write8(uint8_t value, uint16_t port)
 {
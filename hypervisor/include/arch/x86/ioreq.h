@@ -9,6 +9,7 @@
 
 #include <types.h>
 #include <acrn_common.h>
+#include <spinlock.h>
 
 /**
  * @brief I/O Emulation
@@ -109,6 +110,78 @@ struct vm_io_handler_desc {
 };
 
 
+/**
+ * @brief Maximum number of posted I/O request ranges per VM
+ */
+#define POSTED_IOREQ_RANGE_MAX	16U
+
+/**
+ * @brief Range of PIO or MMIO writes which are delivered to VHM as posted
+ * requests.
+ */
+struct posted_ioreq_range {
+	uint32_t type;		/**< REQ_PORTIO or REQ_MMIO */
+	uint64_t start;		/**< start address of the range */
+	uint64_t end;		/**< end address of the range (exclusive) */
+};
+
+/**
+ * @brief Per-VM state of posted I/O requests
+ */
+struct posted_ioreq_info {
+	/**
+	 * @brief Lock protecting the ranges and the ring cursor
+	 */
+	spinlock_t lock;
+
+	/**
+	 * @brief Number of valid entries in \p ranges
+	 */
+	uint16_t num_ranges;
+
+	/**
+	 * @brief Index of the next slot to use in the posted request ring,
+	 * relative to VHM_REQUEST_POSTED_BASE
+	 */
+	uint16_t next_slot;
+
+	struct posted_ioreq_range ranges[POSTED_IOREQ_RANGE_MAX];
+};
+
+/**
+ * @brief A doorbell matched by the hypervisor
+ */
+struct doorbell {
+	uint32_t type;		/**< REQ_PORTIO or REQ_MMIO */
+	uint32_t len;		/**< access size in bytes */
+	uint64_t addr;		/**< address of the doorbell */
+	uint64_t data;		/**< value to match if \p datamatch is set */
+	bool datamatch;		/**< whether \p data shall be matched */
+	uint16_t id;		/**< bit index in the pending bitmap */
+};
+
+/**
+ * @brief Per-VM state of doorbells
+ */
+struct doorbell_info {
+	/**
+	 * @brief Lock protecting the doorbell table
+	 */
+	spinlock_t lock;
+
+	/**
+	 * @brief Number of valid entries in \p doorbells
+	 */
+	uint16_t num;
+
+	/**
+	 * @brief Pending bitmap shared with SOS, NULL if not set up yet
+	 */
+	struct acrn_doorbell_buffer *buf;
+
+	struct doorbell doorbells[ACRN_DOORBELL_MAX];
+};
+
 #define IO_ATTR_R               0U
 #define IO_ATTR_RW              1U
 #define IO_ATTR_NO_ACCESS       2U
@@ -287,6 +360,70 @@ void emulate_io_post(struct acrn_vcpu *vcpu);
  */
 int32_t acrn_insert_request_wait(struct acrn_vcpu *vcpu, const struct io_request *io_req);
 
+/**
+ * @brief Deliver \p io_req to SOS as a posted request without suspending
+ * \p vcpu
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the write
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 The request is delivered.
+ * @retval -ENODEV \p io_req is not a write to any posted range.
+ * @retval -EBUSY All slots of the posted request ring are in use.
+ * @retval -EINVAL The I/O request buffer of the VM is not set up.
+ */
+int32_t acrn_insert_request_posted(struct acrn_vcpu *vcpu, const struct io_request *io_req);
+
+/**
+ * @brief Signal SOS if \p io_req hits a doorbell of the VM
+ *
+ * @param vcpu The virtual CPU that triggers the I/O access
+ * @param io_req The I/O request holding the details of the access
+ *
+ * @pre vcpu != NULL && io_req != NULL
+ *
+ * @retval 0 \p io_req hits a doorbell and SOS has been signaled.
+ * @retval -ENODEV \p io_req does not hit any doorbell.
+ */
+int32_t acrn_ring_doorbell(struct acrn_vcpu *vcpu, const struct io_request *io_req);
+
+/**
+ * @brief Add or remove a doorbell of a VM
+ *
+ * @param vm The VM whose doorbells are to be changed
+ * @param db The doorbell and the operation
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p db is invalid or is not registered (on removal)
+ * @retval -EBUSY Another doorbell with the same ID or address exists
+ * @retval -ENOMEM No more doorbells can be registered
+ */
+int32_t set_doorbell(struct acrn_vm *vm, const struct acrn_doorbell *db);
+
+/**
+ * @brief Add or remove a posted I/O request range of a VM
+ *
+ * @param vm The VM whose posted ranges are to be changed
+ * @param range The range and the operation
+ *
+ * @retval 0 on success
+ * @retval -EINVAL \p range is invalid or is not registered (on removal)
+ * @retval -ENOMEM No more ranges can be registered
+ */
+int32_t set_posted_ioreq_range(struct acrn_vm *vm, const struct acrn_posted_ioreq_range *range);
+
+/**
+ * @brief Release a slot of the posted request ring
+ *
+ * @param vm The VM owning the slot
+ * @param slot Index of the slot in the request buffer
+ *
+ * @pre slot >= VHM_REQUEST_POSTED_BASE && slot < VHM_REQUEST_MAX
+ */
+void complete_posted_ioreq(struct acrn_vm *vm, uint16_t slot);
+
 /**
  * @brief Reset all IO requests status of the VM
  *
@@ -301,9 +438,9 @@ void reset_vm_ioreqs(struct acrn_vm *vm);
  *
  * @param pcpu_id The physical cpu id of vcpu whose IO request to be checked
  *
- * @return None
+ * @return true if a vcpu on \p pcpu_id polls for completion, false otherwise
  */
-void handle_complete_ioreq(uint16_t pcpu_id);
+bool handle_complete_ioreq(uint16_t pcpu_id);
 
 /**
  * @}
@@ -225,6 +225,7 @@ void vcpu_make_request(struct acrn_vcpu *vcpu, uint16_t eventid);
  */
 int exception_vmexit_handler(struct acrn_vcpu *vcpu);
 int interrupt_window_vmexit_handler(struct acrn_vcpu *vcpu);
+int hlt_vmexit_handler(struct acrn_vcpu *vcpu);
 int external_interrupt_vmexit_handler(struct acrn_vcpu *vcpu);
 int acrn_handle_pending_request(struct acrn_vcpu *vcpu);
 
@@ -114,6 +114,8 @@ void mmu_add(uint64_t *pml4_page, uint64_t paddr_base, uint64_t vaddr_base,
 		uint64_t size, uint64_t prot, const struct memory_ops *mem_ops);
 void mmu_modify_or_del(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size,
 		uint64_t prot_set, uint64_t prot_clr, const struct memory_ops *mem_ops, uint32_t type);
+bool mmu_coalesce(uint64_t *pml4_page, uint64_t vaddr_base, uint64_t size,
+		const struct memory_ops *mem_ops, bool check_only);
 /**
  * @brief EPT and VPID capability checking
  *
@@ -151,6 +153,9 @@ void flush_vpid_global(void);
  */
 void invept(const struct acrn_vcpu *vcpu);
 /**
+ * If addr is not mapped, NULL is returned and *pg_size is set to the size
+ * the missing entry would map.
+ *
  *@pre (pml4_page != NULL) && (pg_size != NULL)
  */
 uint64_t *lookup_address(uint64_t *pml4_page, uint64_t addr,
@@ -251,6 +256,23 @@ uint64_t vm0_hpa2gpa(uint64_t hpa);
  */
 void ept_mr_add(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t hpa,
 		uint64_t gpa, uint64_t size, uint64_t prot_orig);
+/**
+ * @brief Start a batch of EPT updates
+ *
+ * Until the matching ept_batch_end(), the ept_mr_add(), ept_mr_modify()
+ * and ept_mr_del() issued on this physical CPU don't request an EPT flush
+ * of the VM vCPUs each: it is requested once, by ept_batch_end().
+ * Batches may nest.
+ *
+ * @return None
+ */
+void ept_batch_begin(void);
+/**
+ * @brief End a batch of EPT updates, see ept_batch_begin()
+ *
+ * @return None
+ */
+void ept_batch_end(void);
 /**
  * @brief Guest-physical memory page access right or memory type updating
  *
@@ -283,6 +305,61 @@ void ept_mr_modify(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
  */
 void ept_mr_del(struct acrn_vm *vm, uint64_t *pml4_page, uint64_t gpa,
 		uint64_t size);
+/**
+ * @brief Merge back into large pages the EPT mappings of a memory region
+ *
+ * Collapse the Normal World EPT tables of [gpa,gpa+size) which map
+ * contiguous memory with uniform attributes again. All the vCPUs of the VM
+ * are held in root mode meanwhile, so this is meant for memory region
+ * setup, not for frequent page granular updates. Inside an EPT batch of
+ * the VM, the merge is deferred to ept_batch_end(). Nothing is merged in
+ * the Secure World EPT, or while a Secure World is active.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] pml4_page The physical address of The EPTP
+ * @param[in] gpa The start guest physical address of the region
+ * @param[in] size The size of the region
+ *
+ * @return None
+ */
+void ept_mr_coalesce(struct acrn_vm *vm, const uint64_t *pml4_page,
+		uint64_t gpa, uint64_t size);
+/**
+ * @brief Build the EPT pointer VMCS field of an EPT hierarchy
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] pml4_page The PML4 page of the EPT hierarchy
+ *
+ * @return The EPTP value: 4-level walk, WB paging structures, and the
+ *         accessed/dirty flags enabled when the VM logs dirty pages
+ */
+uint64_t ept_pointer(const struct acrn_vm *vm, void *pml4_page);
+
+typedef void (*ept_dirty_handler_t)(void *data, uint64_t gpa, uint64_t size);
+/**
+ * @brief Harvest and clear the dirty flags of a guest-physical range
+ *
+ * Walk the Normal World EPT over [gpa, gpa+size) and call handler for each
+ * dirty leaf mapping, clipped to the range, clearing its dirty flag. If any
+ * flag was cleared, it returns only once every vCPU of the VM has flushed
+ * its EPT translations: any write after the return sets the dirty flags
+ * again and shows up in the next harvest. A large page crossing the range
+ * boundaries is reported but keeps its dirty flag. Only the writes done
+ * through this EPT set its dirty flags: DMA, and writes of the SOS or of
+ * the hypervisor to the VM memory, are not reported.
+ *
+ * @param[in] vm the pointer that points to VM data structure
+ * @param[in] gpa The start guest physical address of the range, 4K aligned
+ * @param[in] size The size of the range, 4K aligned
+ * @param[in] handler Called with data and each dirty [gpa, gpa+size)
+ * @param[in] data Passed to handler
+ *
+ * @return None
+ *
+ * @pre vm->arch_vm.ept_ad_enabled
+ */
+void ept_harvest_dirty(struct acrn_vm *vm, uint64_t gpa, uint64_t size,
+		ept_dirty_handler_t handler, void *data);
 /**
  * @brief EPT violation handling
  *
@@ -329,9 +329,11 @@
 #define MSR_IA32_L3_MASK_0			0x00000C90U
 #define MSR_IA32_L2_MASK_0			0x00000D10U
 #define MSR_IA32_BNDCFGS			0x00000D90U
+#define MSR_IA32_XSS				0x00000DA0U
 #define MSR_IA32_EFER				0xC0000080U
 #define MSR_IA32_STAR				0xC0000081U
 #define MSR_IA32_LSTAR				0xC0000082U
+#define MSR_IA32_CSTAR				0xC0000083U
 #define MSR_IA32_FMASK				0xC0000084U
 #define MSR_IA32_FS_BASE			0xC0000100U
 #define MSR_IA32_GS_BASE			0xC0000101U
@@ -26,18 +26,31 @@ struct per_cpu_region {
 	uint64_t *sbuf[ACRN_SBUF_ID_MAX];
 	char logbuf[LOG_MESSAGE_MAX_SIZE];
 	uint32_t npk_log_ref;
+	/* VMREAD/VMWRITE executed, and charged to VM exits */
+	uint64_t vmcs_reads;
+	uint64_t vmcs_writes;
+	uint64_t vmcs_reads_charged;
+	uint64_t vmcs_writes_charged;
+	struct vmexit_vmcs_stat vmexit_vmcs[NR_VMX_EXIT_REASONS];
 #endif
 	uint64_t irq_count[NR_IRQS];
 	uint64_t softirq_pending;
 	uint64_t spurious;
 	void *vcpu;
 	void *ever_run_vcpu;
+	uint32_t ept_batch;	/* nesting of ept_batch_begin() */
+	void *ept_batch_vm;	/* VM whose EPT flush is deferred */
+	uint64_t ept_batch_merge_start;	/* GPA range of ept_batch_vm to merge */
+	uint64_t ept_batch_merge_end;	/* at ept_batch_end(), none if 0 */
+	uint64_t ept_batch_iotlb_start;	/* GPA range of ept_batch_vm to flush */
+	uint64_t ept_batch_iotlb_end;	/* from the IOTLB, none if 0 */
 #ifdef STACK_PROTECTOR
 	struct stack_canary stk_canary;
 #endif
 	struct per_cpu_timers cpu_timers;
 	struct sched_context sched_ctx;
 	struct instr_emul_ctxt g_inst_ctxt;
+	struct instr_cache g_inst_cache;
 	struct host_gdt gdt;
 	struct tss_64 tss;
 	enum pcpu_boot_state boot_state;
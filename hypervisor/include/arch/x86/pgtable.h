@@ -39,6 +39,10 @@
 #define EPT_WP			(5UL << EPT_MT_SHIFT)
 #define EPT_WB			(6UL << EPT_MT_SHIFT)
 #define EPT_MT_MASK		(7UL << EPT_MT_SHIFT)
+/* Accessed/dirty flags, set by the CPU only when EPTP enables them */
+#define EPT_ACCESSED		(1UL << 8U)
+#define EPT_DIRTY_SHIFT		9U
+#define EPT_DIRTY		(1UL << EPT_DIRTY_SHIFT)
 /* VTD: Second-Level Paging Entries: Snoop Control */
 #define EPT_SNOOP_CTRL		(1UL << 11U)
 #define EPT_VE			(1UL << 63U)
@@ -24,18 +24,31 @@ enum tick_mode {
 	TICK_MODE_PERIODIC,	/**< periodic mode */
 };
 
+/**
+ * @brief Maximum number of active timers on one pcpu
+ *
+ * Enough for the interrupt delay timers of all passthrough entries, the
+ * vlapic timers of the vcpus sharing the pcpu and a few hypervisor timers.
+ */
+#define MAX_TIMERS_PER_CPU	(CONFIG_MAX_PT_IRQ_ENTRIES + CONFIG_MAX_VCPUS_PER_PCPU + 8U)
+
+struct hv_timer;
+
 /**
  * @brief Definition of timers for per-cpu
  */
 struct per_cpu_timers {
-	struct list_head timer_list;	/**< it's for runtime active timer list */
+	spinlock_t lock;				/**< protects the heap */
+	uint32_t nr_timers;				/**< number of active timers */
+	struct hv_timer *heap[MAX_TIMERS_PER_CPU];	/**< active timers, min-heap by fire_tsc */
 };
 
 /**
  * @brief Definition of timer
  */
 struct hv_timer {
-	struct list_head node;		/**< link all timers */
+	struct per_cpu_timers *cpu_timer;	/**< timers it is active in, NULL if inactive */
+	uint32_t heap_idx;		/**< position in cpu_timer->heap */
 	enum tick_mode mode;		/**< timer mode: one-shot or periodic */
 	uint64_t fire_tsc;		/**< tsc deadline to interrupt */
 	uint64_t period_in_cycle;	/**< period of the periodic timer in unit of TSC cycles */
@@ -70,7 +83,8 @@ static inline void initialize_timer(struct hv_timer *timer,
 		timer->fire_tsc = fire_tsc;
 		timer->mode = mode;
 		timer->period_in_cycle = period_in_cycle;
-		INIT_LIST_HEAD(&timer->node);
+		timer->cpu_timer = NULL;
+		timer->heap_idx = 0U;
 	}
 }
 
@@ -86,6 +100,18 @@ static inline bool timer_expired(const struct hv_timer *timer)
 	return ((timer->fire_tsc == 0UL) || (rdtsc() >= timer->fire_tsc));
 }
 
+/**
+ * @brief Check whether a timer is active, i.e. added and not fired yet.
+ *
+ * @param[in] timer Pointer to timer.
+ *
+ * @retval true if the timer is active, false otherwise.
+ */
+static inline bool timer_is_active(const struct hv_timer *timer)
+{
+	return (timer->cpu_timer != NULL);
+}
+
 /**
  * @brief Add a timer.
  *
@@ -93,6 +119,7 @@ static inline bool timer_expired(const struct hv_timer *timer)
  *
  * @retval 0 on success
  * @retval -EINVAL timer has an invalid value
+ * @retval -ENOMEM too many timers are active on this pcpu
  *
  * @remark Don't call it in the timer callback function or interrupt content.
  */
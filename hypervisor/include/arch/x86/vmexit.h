@@ -7,12 +7,33 @@
 #ifndef VMEXIT_H_
 #define VMEXIT_H_
 
+/*
+ * According to "SDM APPENDIX C VMX BASIC EXIT REASONS",
+ * there are 65 Basic Exit Reasons.
+ */
+#define NR_VMX_EXIT_REASONS	65U
+
 struct vm_exit_dispatch {
 	int (*handler)(struct acrn_vcpu *);
 	uint32_t need_exit_qualification;
 };
 
+/* VMCS accesses per basic exit reason, see vmexit_account_vmcs() */
+struct vmexit_vmcs_stat {
+	uint64_t exits;
+	uint64_t vmreads;
+	uint64_t vmwrites;
+};
+
 int vmexit_handler(struct acrn_vcpu *vcpu);
+#ifdef HV_DEBUG
+void vmexit_account_vmcs(uint16_t pcpu_id, uint32_t basic_exit_reason);
+#else
+static inline void vmexit_account_vmcs(__unused uint16_t pcpu_id,
+		__unused uint32_t basic_exit_reason)
+{
+}
+#endif
 int vmcall_vmexit_handler(struct acrn_vcpu *vcpu);
 int cpuid_vmexit_handler(struct acrn_vcpu *vcpu);
 int cr_access_vmexit_handler(struct acrn_vcpu *vcpu);
@@ -452,6 +452,7 @@ void exec_vmwrite64(uint32_t field_full, uint64_t value);
 #define exec_vmwrite exec_vmwrite64
 
 void init_vmcs(struct acrn_vcpu *vcpu);
+void load_vmcs(struct acrn_vcpu *vcpu);
 
 void vmx_off(uint16_t pcpu_id);
 
@@ -466,11 +467,6 @@ void vmx_write_cr4(struct acrn_vcpu *vcpu, uint64_t cr4);
 bool is_vmx_disabled(void);
 void switch_apicv_mode_x2apic(struct acrn_vcpu *vcpu);
 
-static inline enum vm_cpu_mode get_vcpu_mode(const struct acrn_vcpu *vcpu)
-{
-	return vcpu->arch.cpu_mode;
-}
-
 static inline bool cpu_has_vmx_unrestricted_guest_cap(void)
 {
 	return ((msr_read(MSR_IA32_VMX_MISC) & VMX_SUPPORT_UNRESTRICTED_GUEST)
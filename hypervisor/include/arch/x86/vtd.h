@@ -340,6 +340,48 @@ static inline uint8_t dma_iotlb_invl_addr_am(uint8_t am)
 
 #define DMA_IOTLB_INVL_ADDR_IH_UNMODIFIED	(((uint64_t)1UL) << 6U)
 
+/* IQA_REG */
+#define DMA_IQA_QS_MASK				0x7UL
+
+/* Invalidation queue descriptors, lower 64 bits */
+#define DMA_QI_CONTEXT_DESC			0x1UL
+#define DMA_QI_IOTLB_DESC			0x2UL
+#define DMA_QI_WAIT_DESC			0x5UL
+
+#define DMA_QI_CONTEXT_GLOBAL_INVL		(((uint64_t)1UL) << 4U)
+#define DMA_QI_CONTEXT_DOMAIN_INVL		(((uint64_t)2UL) << 4U)
+#define DMA_QI_CONTEXT_DEVICE_INVL		(((uint64_t)3UL) << 4U)
+static inline uint64_t dma_qi_did(uint16_t did)
+{
+	return (((uint64_t)did & 0xffffUL) << 16UL);
+}
+
+static inline uint64_t dma_qi_sid(uint16_t sid)
+{
+	return (((uint64_t)sid & 0xffffUL) << 32UL);
+}
+
+static inline uint64_t dma_qi_fm(uint8_t fm)
+{
+	return (((uint64_t)fm & 0x3UL) << 48UL);
+}
+
+#define DMA_QI_IOTLB_GLOBAL_INVL		(((uint64_t)1UL) << 4U)
+#define DMA_QI_IOTLB_DOMAIN_INVL		(((uint64_t)2UL) << 4U)
+#define DMA_QI_IOTLB_PAGE_INVL			(((uint64_t)3UL) << 4U)
+#define DMA_QI_IOTLB_DW				(((uint64_t)1UL) << 6U)
+#define DMA_QI_IOTLB_DR				(((uint64_t)1UL) << 7U)
+/* upper 64 bits of the IOTLB descriptor: as INVALIDATE_ADDRESS_REG */
+
+#define DMA_QI_WAIT_IF				(((uint64_t)1UL) << 4U)
+#define DMA_QI_WAIT_SW				(((uint64_t)1UL) << 5U)
+#define DMA_QI_WAIT_FN				(((uint64_t)1UL) << 6U)
+static inline uint64_t dma_qi_wait_data(uint32_t data)
+{
+	return ((uint64_t)data << 32UL);
+}
+/* upper 64 bits of the wait descriptor: status write address */
+
 /* FECTL_REG */
 #define DMA_FECTL_IM				(((uint32_t)1U) << 31U)
 
@@ -624,6 +666,20 @@ void init_iommu_vm0_domain(struct acrn_vm *vm0);
  */
 bool iommu_snoop_supported(struct acrn_vm *vm);
 
+/**
+ * @brief Invalidate the IOTLB of a guest-physical range of a domain.
+ *
+ * Called after the translation table of the domain was changed, so that
+ * DMA no longer uses the former mappings of [gpa, gpa + size).
+ *
+ * @param[in] domain iommu domain whose translation table changed
+ * @param[in] gpa start guest physical address of the range
+ * @param[in] size size of the range
+ *
+ * @pre domain != NULL
+ */
+void iommu_flush_iotlb(const struct iommu_domain *domain, uint64_t gpa, uint64_t size);
+
 /**
   * @}
   */
@@ -206,12 +206,61 @@ int32_t hcall_set_ioreq_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param
  * The function will return -1 if the target VM does not exist.
  *
  * @param vmid ID of the VM
- * @param vcpu_id vcpu ID of the requestor
+ * @param vcpu_id vcpu ID of the requestor, or the slot index of a posted
+ *                request
  *
  * @return 0 on success, non-zero on error.
  */
 int32_t hcall_notify_ioreq_finish(uint16_t vmid, uint16_t vcpu_id);
 
+/**
+ * @brief add or remove a posted ioreq range
+ *
+ * Writes falling in a posted ioreq range are delivered to SOS without pausing
+ * the issuing vcpu of the target VM.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_posted_ioreq_range
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_posted_ioreq_range(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief add or remove a doorbell
+ *
+ * Writes hitting a doorbell of the target VM are signaled to SOS through the
+ * doorbell pending buffer, without pausing the issuing vcpu.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_doorbell
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_doorbell(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief set the doorbell pending buffer
+ *
+ * Set the buffer in which the pending bits of the doorbells of the target VM
+ * are reported to SOS.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_set_doorbell_buffer
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_set_doorbell_buffer(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief setup ept memory mapping for multi regions
  *
@@ -237,6 +286,51 @@ int32_t hcall_set_vm_memory_regions(struct acrn_vm *vm, uint64_t param);
  */
 int32_t hcall_write_protect_page(struct acrn_vm *vm, uint16_t vmid, uint64_t wp_gpa);
 
+/**
+ * @brief change multiple guest memory pages write permission
+ *
+ * All the pages are changed before a single EPT flush of the target VM.
+ * A page failing to change does not stop the others, its result entry
+ * tells why.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct wp_pages
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 if all the pages were changed, -EINVAL if some were not,
+ *         other non-zero value on error.
+ */
+int32_t hcall_write_protect_pages(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
+/**
+ * @brief harvest the dirty pages of a guest memory range
+ *
+ * Report the pages of the range written by the target VM since the last
+ * harvest, or since it was created, and clear their EPT dirty flags. The
+ * hypercall returns only after all the vCPUs of the target VM flushed their
+ * EPT translations, so a page written after the return is reported by the
+ * next harvest. The target VM must have been created with
+ * DIRTY_LOGGING_ENABLED.
+ *
+ * Only writes by the vCPUs of the target VM are reported. Writes reaching
+ * its memory without going through its EPT are not: DMA of passthrough
+ * devices, writes of the device model through the SOS mapping of that
+ * memory (virtio-blk reads or virtio-net receives, for instance), and
+ * writes of the hypervisor itself. Snapshot or migration users must track
+ * the pages written that way on their own.
+ *
+ * @param vm Pointer to VM data structure
+ * @param vmid ID of the VM
+ * @param param guest physical address. This gpa points to
+ *              struct acrn_dirty_log
+ *
+ * @pre Pointer vm shall point to VM0
+ * @return 0 on success, non-zero on error.
+ */
+int32_t hcall_get_dirty_log(struct acrn_vm *vm, uint16_t vmid, uint64_t param);
+
 /**
  * @brief translate guest physical address to host physical address
  *
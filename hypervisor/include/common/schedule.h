@@ -7,8 +7,11 @@
 #ifndef SCHEDULE_H
 #define SCHEDULE_H
 
+#include <timer.h>
+
 #define	NEED_RESCHEDULE		(1U)
 #define	NEED_OFFLINE		(2U)
+#define	SLICE_EXPIRED		(3U)
 
 struct sched_context {
 	spinlock_t runqueue_lock;
@@ -16,6 +19,14 @@ struct sched_context {
 	uint64_t flags;
 	struct acrn_vcpu *curr_vcpu;
 	spinlock_t scheduler_lock;
+
+	/* vCPUs assigned to this pCPU, including the ones being created */
+	uint16_t nr_vcpus;
+	/* Set if the pCPU is dedicated to a vCPU of VM0 or of a partition */
+	bool exclusive;
+	struct acrn_vcpu *vcpus[CONFIG_MAX_VCPUS_PER_PCPU];
+	/* Fires at the end of the time slice when vCPUs share this pCPU */
+	struct hv_timer slice_timer;
 };
 
 void init_scheduler(void);
@@ -25,12 +36,16 @@ void release_schedule_lock(uint16_t pcpu_id);
 void set_pcpu_used(uint16_t pcpu_id);
 uint16_t allocate_pcpu(void);
 void free_pcpu(uint16_t pcpu_id);
+void attach_vcpu_to_pcpu(struct acrn_vcpu *vcpu);
+void detach_vcpu_from_pcpu(const struct acrn_vcpu *vcpu);
 
 void add_vcpu_to_runqueue(struct acrn_vcpu *vcpu);
 void remove_vcpu_from_runqueue(struct acrn_vcpu *vcpu);
 
 void default_idle(void);
 
+bool is_pcpu_shared(uint16_t pcpu_id);
+void yield_vcpu(const struct acrn_vcpu *vcpu);
 void make_reschedule_request(const struct acrn_vcpu *vcpu);
 int need_reschedule(uint16_t pcpu_id);
 void make_pcpu_offline(uint16_t pcpu_id);
@@ -44,7 +44,15 @@ enum {
 	ACRN_SBUF_ID_MAX,
 };
 
-/* Make sure sizeof(struct shared_buf) == SBUF_HEAD_SIZE */
+/* returned by sbuf_reserve() when the record does not fit */
+#define SBUF_NO_SPACE	0xFFFFFFFFU
+
+/*
+ * Make sure sizeof(struct shared_buf) == SBUF_HEAD_SIZE
+ *
+ * nr_reserved and reserve_tail are private to the hypervisor side
+ * producers, consumers only use head and tail.
+ */
 struct shared_buf {
 	uint64_t magic;
 	uint32_t ele_num;	/* number of elements */
@@ -52,12 +60,49 @@ struct shared_buf {
 	uint32_t head;		/* offset from base, to read */
 	uint32_t tail;		/* offset from base, to write */
 	uint32_t flags;
-	uint32_t reserved;
+	int32_t nr_reserved;	/* reservations not committed yet */
 	uint32_t overrun_cnt;	/* count of overrun */
 	uint32_t size;		/* ele_num * ele_size */
-	uint32_t padding[6];
+	uint32_t reserve_tail;	/* offset from base, end of reserved space */
+	uint32_t padding[5];
 };
 
+/**
+ * Reserve len bytes of \p sbuf for a record
+ *
+ * Producers of one sbuf must run on the same pCPU, but may nest, e.g. from
+ * interrupt context. A record becomes visible to the consumer when the
+ * outermost reservation is committed, so nested records are published in a
+ * batch. Every call must be paired with sbuf_commit(), even on failure.
+ *
+ * @return offset of the record from the start of the data, it may wrap
+ *         around the end of the buffer, or SBUF_NO_SPACE
+ *
+ * @pre sbuf != NULL
+ * @pre 0 < len < sbuf->size
+ */
+uint32_t sbuf_reserve(struct shared_buf *sbuf, uint32_t len);
+
+/**
+ * Copy len bytes of data to offset of \p sbuf, wrapping around its end
+ *
+ * @pre offset and len are within a reservation
+ */
+void sbuf_copy_in(struct shared_buf *sbuf, uint32_t offset,
+		const uint8_t *data, uint32_t len);
+
+/**
+ * Publish the records reserved so far, if this is the outermost reservation
+ */
+void sbuf_commit(struct shared_buf *sbuf);
+
+/**
+ * Data at offset of \p sbuf, for records filled in place
+ */
+static inline void *sbuf_data(struct shared_buf *sbuf, uint32_t offset)
+{
+	return (void *)sbuf + SBUF_HEAD_SIZE + offset;
+}
 
 /**
  *@pre sbuf != NULL
@@ -21,9 +21,29 @@ struct mem_pool {
 	uint32_t *contiguity_bitmap;	/* Pointer to contiguity bitmap */
 };
 
+/* Number of size classes cached per pCPU in front of the memory pool */
+#define MALLOC_NR_SIZE_CLASSES	12U
+
+/* Heap usage and fragmentation, see get_heap_stats() */
+struct heap_stats {
+	uint32_t buff_size;		/* Size of one Buffer in Bytes */
+	uint32_t total_buffs;		/* Total Buffers in Memory Pool */
+	uint32_t used_buffs;		/* Allocated Buffers, cached ones included */
+	uint32_t cached_buffs;		/* Buffers held by the per-pCPU caches */
+	uint32_t free_extents;		/* Runs of contiguous free Buffers */
+	uint32_t largest_free_extent;	/* Largest run of free Buffers */
+	uint64_t allocs;		/* Successful malloc() calls */
+	uint64_t frees;			/* free() calls */
+	uint64_t cache_hits;		/* malloc() served by a per-pCPU cache */
+	uint64_t failures;		/* Failed malloc() calls */
+	uint32_t class_size[MALLOC_NR_SIZE_CLASSES];	/* Object size of each class */
+	uint32_t class_cached[MALLOC_NR_SIZE_CLASSES];	/* Cached objects of each class */
+};
+
 /* APIs exposing memory allocation/deallocation abstractions */
 void *malloc(unsigned int num_bytes);
 void *calloc(unsigned int num_elements, unsigned int element_size);
 void free(const void *ptr);
+void get_heap_stats(struct heap_stats *stats);
 
 #endif /* MEM_MGT_H */
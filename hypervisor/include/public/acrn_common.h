@@ -26,6 +26,15 @@
  */
 #define VHM_REQUEST_MAX 16U
 
+/*
+ * Request slots [0, VHM_REQUEST_POSTED_BASE) are dedicated to the vCPUs with
+ * the same IDs. The remaining slots form a ring shared by all vCPUs of a VM to
+ * deliver posted requests, i.e. writes to the ranges registered through
+ * HC_SET_POSTED_IOREQ_RANGE, which the vCPU does not wait for.
+ */
+#define VHM_REQUEST_POSTED_BASE	8U
+#define VHM_REQUEST_POSTED_NUM	(VHM_REQUEST_MAX - VHM_REQUEST_POSTED_BASE)
+
 #define REQ_STATE_FREE          3U
 #define REQ_STATE_PENDING	0U
 #define REQ_STATE_COMPLETE	1U
@@ -48,6 +57,7 @@
 
 /* Generic VM flags from guest OS */
 #define SECURE_WORLD_ENABLED    (1UL << 0U)  /* Whether secure world is enabled */
+#define DIRTY_LOGGING_ENABLED   (1UL << 1U)  /* Whether EPT dirty page logging is enabled */
 
 /**
  * @brief Hypercall
@@ -250,6 +260,12 @@ union vhm_io_request {
  *   4. One vCPU cannot trigger another I/O request before the previous one has
  *      completed (i.e. the state switched to FREE)
  *
+ * Posted requests (with \p posted set) live in the ring of slots starting
+ * from VHM_REQUEST_POSTED_BASE. The issuing vCPU is not paused and no
+ * post-work is needed, so the hypervisor may reuse a posted slot as soon as it
+ * is in COMPLETE or FREE state. A notification of the completion of a posted
+ * request, with the slot index as the vCPU ID, simply frees that slot.
+ *
  * Accesses to the state of a vhm_request shall be atomic and proper barriers
  * are needed to ensure that:
  *
@@ -275,11 +291,27 @@ struct vhm_request {
 	uint32_t completion_polling;
 
 	/**
-	 * @brief Reserved.
+	 * @brief Set if this is a posted request.
+	 *
+	 * The vCPU issuing a posted request does not wait for its completion.
 	 *
 	 * Byte offset: 8.
 	 */
-	uint32_t reserved0[14];
+	uint32_t posted;
+
+	/**
+	 * @brief ID of the vCPU issuing this request.
+	 *
+	 * Byte offset: 12.
+	 */
+	uint32_t vcpu;
+
+	/**
+	 * @brief Reserved.
+	 *
+	 * Byte offset: 16.
+	 */
+	uint32_t reserved0[12];
 
 	/**
 	 * @brief Details about this request.
@@ -344,6 +376,7 @@ struct acrn_create_vm {
 
 	/* VM flag bits from Guest OS, now used
 	 *  SECURE_WORLD_ENABLED          (1UL<<0)
+	 *  DIRTY_LOGGING_ENABLED         (1UL<<1)
 	 */
 	uint64_t vm_flag;
 
@@ -456,6 +489,86 @@ struct acrn_set_ioreq_buffer {
 	uint64_t req_buf;
 } __aligned(8);
 
+/**
+ * @brief Info to add or remove a posted I/O request range
+ *
+ * the parameter for HC_SET_POSTED_IOREQ_RANGE hypercall
+ */
+struct acrn_posted_ioreq_range {
+#define POSTED_IOREQ_ASSIGN	0U
+#define POSTED_IOREQ_DEASSIGN	1U
+	/** POSTED_IOREQ_ASSIGN or POSTED_IOREQ_DEASSIGN */
+	uint32_t op;
+
+	/** REQ_PORTIO or REQ_MMIO */
+	uint32_t type;
+
+	/** start address of the range */
+	uint64_t start;
+
+	/** end address of the range (exclusive) */
+	uint64_t end;
+} __aligned(8);
+
+/**
+ * @brief Maximum number of doorbells per VM
+ */
+#define ACRN_DOORBELL_MAX	64U
+
+/**
+ * @brief Info to add or remove a doorbell
+ *
+ * A doorbell is a write-only PIO or MMIO register (e.g. a virtqueue notify
+ * register) which the hypervisor matches by itself. A write hitting a
+ * doorbell sets bit \p id in the pending bitmap of the VM and raises the
+ * upcall, without pausing the vCPU or waiting for any completion. It is the
+ * hypervisor counterpart of an ioeventfd.
+ *
+ * the parameter for HC_SET_DOORBELL hypercall
+ */
+struct acrn_doorbell {
+#define DOORBELL_FLAG_PIO		0x01U
+#define DOORBELL_FLAG_DATAMATCH		0x02U
+#define DOORBELL_FLAG_DEASSIGN		0x04U
+	/** DOORBELL_FLAG_xxx */
+	uint32_t flags;
+
+	/** access size in bytes: 1, 2, 4 or 8 */
+	uint32_t len;
+
+	/** PIO port or MMIO guest physical address of the doorbell */
+	uint64_t addr;
+
+	/** value to match if DOORBELL_FLAG_DATAMATCH is set */
+	uint64_t data;
+
+	/** bit index in the pending bitmap, less than ACRN_DOORBELL_MAX */
+	uint32_t id;
+
+	/** Reserved */
+	uint32_t reserved;
+} __aligned(8);
+
+/**
+ * @brief Pending bitmap of the doorbells of a VM
+ *
+ * The buffer is allocated by SOS. The hypervisor sets bits with locked
+ * instructions and SOS shall fetch and clear them atomically, e.g. with xchg.
+ */
+struct acrn_doorbell_buffer {
+	uint64_t pending[ACRN_DOORBELL_MAX / 64U];
+} __aligned(8);
+
+/**
+ * @brief Info to set the doorbell pending buffer for a created VM
+ *
+ * the parameter for HC_SET_DOORBELL_BUFFER hypercall
+ */
+struct acrn_set_doorbell_buffer {
+	/** guest physical address of struct acrn_doorbell_buffer */
+	uint64_t buf;
+} __aligned(8);
+
 /** Operation types for setting IRQ line */
 #define GSI_SET_HIGH		0U
 #define GSI_SET_LOW		1U
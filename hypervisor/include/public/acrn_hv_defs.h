@@ -49,12 +49,17 @@
 #define HC_ID_IOREQ_BASE            0x30UL
 #define HC_SET_IOREQ_BUFFER         BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x00UL)
 #define HC_NOTIFY_REQUEST_FINISH    BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x01UL)
+#define HC_SET_POSTED_IOREQ_RANGE   BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x02UL)
+#define HC_SET_DOORBELL             BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x03UL)
+#define HC_SET_DOORBELL_BUFFER      BASE_HC_ID(HC_ID, HC_ID_IOREQ_BASE + 0x04UL)
 
 /* Guest memory management */
 #define HC_ID_MEM_BASE              0x40UL
 #define HC_VM_GPA2HPA               BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x01UL)
 #define HC_VM_SET_MEMORY_REGIONS    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x02UL)
 #define HC_VM_WRITE_PROTECT_PAGE    BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x03UL)
+#define HC_VM_WRITE_PROTECT_PAGES   BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x04UL)
+#define HC_VM_GET_DIRTY_LOG         BASE_HC_ID(HC_ID, HC_ID_MEM_BASE + 0x05UL)
 
 /* PCI assignment*/
 #define HC_ID_PCI_BASE              0x50UL
@@ -170,6 +175,50 @@ struct wp_data {
 	uint64_t gpa;
 } __aligned(8);
 
+/**
+ * @brief Info to change multiple guest pages write protect permission
+ *
+ * the parameter for HC_VM_WRITE_PROTECT_PAGES hypercall
+ */
+struct wp_pages {
+	/** number of pages to change */
+	uint32_t num;
+
+	/** Reserved */
+	uint32_t reserved;
+
+	/** the gpa of the struct wp_data array, one entry per page */
+	uint64_t wp_gpa;
+
+	/** the gpa of an int32_t array receiving the result of each page:
+	 *  0 on success or a negative error code, not written if 0
+	 */
+	uint64_t result_gpa;
+} __aligned(8);
+
+/**
+ * @brief Info to harvest the dirty pages of a guest memory range
+ *
+ * the parameter for HC_VM_GET_DIRTY_LOG hypercall
+ *
+ * Only the pages written by the vCPUs of the VM are reported. Pages written
+ * by DMA, by the device model through the SOS mapping of the VM memory, or
+ * by the hypervisor, are not: the device model has to track them itself.
+ */
+struct acrn_dirty_log {
+	/** start guest physical address of the range, 4K aligned */
+	uint64_t gpa;
+
+	/** size of the range in bytes, 4K aligned */
+	uint64_t size;
+
+	/** the gpa of the bitmap receiving one bit per 4K page of the range,
+	 *  bit n of 64-bit word m standing for page (64 * m + n); the whole
+	 *  bitmap, rounded up to 64-bit words, is written
+	 */
+	uint64_t bitmap_gpa;
+} __aligned(8);
+
 /**
  * Setup parameter for share buffer, used for HC_SETUP_SBUF hypercall
  */
@@ -31,6 +31,133 @@ static struct mem_pool Memory_Pool = {
 	.contiguity_bitmap = Malloc_Heap_Contiguity_Bitmap
 };
 
+/************************************************************************/
+/*  Per-pCPU caches of freed objects, one free list per size class      */
+/************************************************************************/
+/* Buffers per object of each size class, about 1.5x apart */
+static const uint32_t slab_class_buffs[MALLOC_NR_SIZE_CLASSES] = {
+	1U, 2U, 3U, 4U, 6U, 8U, 12U, 16U, 24U, 32U, 48U, 64U
+};
+
+/* Bytes each pCPU may keep cached per size class, at least one object */
+#define SLAB_CACHE_BYTES	1024U
+
+struct slab_cache {
+	spinlock_t lock;	/* Taken remotely only to drain the cache */
+	void *free_list[MALLOC_NR_SIZE_CLASSES];	/* Objects chained by their first word */
+	uint32_t nr_free[MALLOC_NR_SIZE_CLASSES];
+	uint64_t allocs;
+	uint64_t frees;
+	uint64_t cache_hits;
+	uint64_t failures;
+};
+
+static struct slab_cache slab_caches[CONFIG_MAX_PCPU_NUM];
+
+static void deallocate_mem(struct mem_pool *pool, const void *ptr);
+
+/* Size class holding buffs buffers, MALLOC_NR_SIZE_CLASSES if none */
+static uint32_t slab_class(uint32_t buffs, bool exact)
+{
+	uint32_t c;
+
+	for (c = 0U; c < MALLOC_NR_SIZE_CLASSES; c++) {
+		if (slab_class_buffs[c] >= buffs) {
+			if (exact && (slab_class_buffs[c] != buffs)) {
+				c = MALLOC_NR_SIZE_CLASSES;
+			}
+			break;
+		}
+	}
+
+	return c;
+}
+
+static inline uint32_t slab_cache_depth(const struct mem_pool *pool, uint32_t c)
+{
+	return max(SLAB_CACHE_BYTES / (slab_class_buffs[c] * pool->buff_size), 1U);
+}
+
+static struct slab_cache *get_slab_cache(void)
+{
+	uint16_t pcpu_id = get_cpu_id();
+
+	return (pcpu_id < CONFIG_MAX_PCPU_NUM) ? &slab_caches[pcpu_id] : NULL;
+}
+
+static void *slab_cache_get(struct slab_cache *cache, uint32_t c)
+{
+	void *obj;
+
+	spinlock_obtain(&cache->lock);
+	obj = cache->free_list[c];
+	if (obj != NULL) {
+		cache->free_list[c] = *(void **)obj;
+		cache->nr_free[c]--;
+	}
+	spinlock_release(&cache->lock);
+
+	return obj;
+}
+
+static bool slab_cache_put(const struct mem_pool *pool, struct slab_cache *cache,
+		uint32_t c, void *obj)
+{
+	bool cached = false;
+
+	spinlock_obtain(&cache->lock);
+	if (cache->nr_free[c] < slab_cache_depth(pool, c)) {
+		*(void **)obj = cache->free_list[c];
+		cache->free_list[c] = obj;
+		cache->nr_free[c]++;
+		cached = true;
+	}
+	spinlock_release(&cache->lock);
+
+	return cached;
+}
+
+/* Give the objects cached by all pCPUs back to the pool */
+static void slab_drain_all(struct mem_pool *pool)
+{
+	struct slab_cache *cache;
+	void *obj;
+	uint16_t i;
+	uint32_t c;
+
+	for (i = 0U; i < CONFIG_MAX_PCPU_NUM; i++) {
+		cache = &slab_caches[i];
+		for (c = 0U; c < MALLOC_NR_SIZE_CLASSES; c++) {
+			obj = slab_cache_get(cache, c);
+			while (obj != NULL) {
+				deallocate_mem(pool, obj);
+				obj = slab_cache_get(cache, c);
+			}
+		}
+	}
+}
+
+/*
+ * Number of buffers of the allocation starting at buff_idx, or limit if
+ * it has more. Only the caller owns these bits, so no lock is needed.
+ */
+static uint32_t get_alloc_buffs(const struct mem_pool *pool, uint32_t buff_idx,
+		uint32_t limit)
+{
+	uint32_t idx = buff_idx, buffs = 0U;
+
+	while ((idx < pool->total_buffs) && (buffs < limit)) {
+		buffs++;
+		if ((pool->contiguity_bitmap[idx / BITMAP_WORD_SIZE] &
+				(1U << (idx % BITMAP_WORD_SIZE))) == 0U) {
+			break;
+		}
+		idx++;
+	}
+
+	return buffs;
+}
+
 static void *allocate_mem(struct mem_pool *pool, unsigned int num_bytes)
 {
 
@@ -212,22 +339,55 @@ static void deallocate_mem(struct mem_pool *pool, const void *ptr)
 /*
  * The return address will be PAGE_SIZE aligned if 'num_bytes' is greater
  * than PAGE_SIZE.
+ *
+ * Objects of up to slab_class_buffs[MALLOC_NR_SIZE_CLASSES - 1U] buffers are
+ * rounded up to a size class and taken from the per-pCPU cache of that class
+ * first, so the common case does not scan the pool under its global lock.
  */
 void *malloc(unsigned int num_bytes)
 {
 	void *memory = NULL;
+	struct slab_cache *cache = get_slab_cache();
+	uint32_t c = MALLOC_NR_SIZE_CLASSES;
+	uint32_t alloc_bytes = num_bytes;
 
 	/* Check if bytes requested extend page-size */
 	if (num_bytes < PAGE_SIZE) {
+		c = slab_class(INT_DIV_ROUNDUP(num_bytes, Memory_Pool.buff_size), false);
+		if (c < MALLOC_NR_SIZE_CLASSES) {
+			alloc_bytes = slab_class_buffs[c] * Memory_Pool.buff_size;
+			if (cache != NULL) {
+				memory = slab_cache_get(cache, c);
+				if (memory != NULL) {
+					cache->cache_hits++;
+				}
+			}
+		}
+
 		/*
 		 * Request memory allocation from smaller segmented memory pool
 		 */
-		memory = allocate_mem(&Memory_Pool, num_bytes);
+		if (memory == NULL) {
+			memory = allocate_mem(&Memory_Pool, alloc_bytes);
+		}
+
+		/* Objects cached by other pCPUs may be what is missing */
+		if (memory == NULL) {
+			slab_drain_all(&Memory_Pool);
+			memory = allocate_mem(&Memory_Pool, alloc_bytes);
+		}
 	}
 
 	/* Check if memory allocation is successful */
 	if (memory == NULL) {
+		if (cache != NULL) {
+			cache->failures++;
+		}
 		pr_err("%s: failed to alloc 0x%x Bytes", __func__, num_bytes);
+	} else if (cache != NULL) {
+		cache->allocs++;
+	} else {
+		/* no per-pCPU statistics */
 	}
 
 	/* Return memory pointer to caller */
@@ -250,15 +410,87 @@ void *calloc(unsigned int num_elements, unsigned int element_size)
 
 void free(const void *ptr)
 {
+	struct slab_cache *cache;
+	uint32_t buff_idx, c;
+
 	/* Check if ptr belongs to 16-Bytes aligned Memory Pool */
-	if ((Memory_Pool.start_addr < ptr) &&
+	if ((Memory_Pool.start_addr <= ptr) &&
 		(ptr < (Memory_Pool.start_addr +
 			(Memory_Pool.total_buffs * Memory_Pool.buff_size)))) {
+		buff_idx = ((const char *)ptr - (char *)Memory_Pool.start_addr) /
+			Memory_Pool.buff_size;
+
+		/* Ignore buffers which are not allocated */
+		if ((Memory_Pool.bitmap[buff_idx / BITMAP_WORD_SIZE] &
+				(1U << (buff_idx % BITMAP_WORD_SIZE))) == 0U) {
+			return;
+		}
+
+		cache = get_slab_cache();
+		if (cache != NULL) {
+			cache->frees++;
+			c = slab_class(get_alloc_buffs(&Memory_Pool, buff_idx,
+				slab_class_buffs[MALLOC_NR_SIZE_CLASSES - 1U] + 1U), true);
+			if ((c < MALLOC_NR_SIZE_CLASSES) &&
+				slab_cache_put(&Memory_Pool, cache, c, (void *)ptr)) {
+				return;
+			}
+		}
+
 		/* Free buffer in 16-Bytes aligned Memory Pool */
 		deallocate_mem(&Memory_Pool, ptr);
 	}
 }
 
+/**
+ * @brief Collect usage and fragmentation statistics of the heap
+ */
+void get_heap_stats(struct heap_stats *stats)
+{
+	struct mem_pool *pool = &Memory_Pool;
+	struct slab_cache *cache;
+	uint32_t idx, run = 0U, c;
+	uint16_t i;
+
+	(void)memset(stats, 0U, sizeof(struct heap_stats));
+	stats->buff_size = pool->buff_size;
+	stats->total_buffs = pool->total_buffs;
+
+	for (c = 0U; c < MALLOC_NR_SIZE_CLASSES; c++) {
+		stats->class_size[c] = slab_class_buffs[c] * pool->buff_size;
+	}
+
+	for (i = 0U; i < CONFIG_MAX_PCPU_NUM; i++) {
+		cache = &slab_caches[i];
+		spinlock_obtain(&cache->lock);
+		for (c = 0U; c < MALLOC_NR_SIZE_CLASSES; c++) {
+			stats->class_cached[c] += cache->nr_free[c];
+			stats->cached_buffs += cache->nr_free[c] * slab_class_buffs[c];
+		}
+		stats->allocs += cache->allocs;
+		stats->frees += cache->frees;
+		stats->cache_hits += cache->cache_hits;
+		stats->failures += cache->failures;
+		spinlock_release(&cache->lock);
+	}
+
+	spinlock_obtain(&pool->spinlock);
+	for (idx = 0U; idx < pool->total_buffs; idx++) {
+		if ((pool->bitmap[idx / BITMAP_WORD_SIZE] &
+				(1U << (idx % BITMAP_WORD_SIZE))) != 0U) {
+			stats->used_buffs++;
+			run = 0U;
+		} else {
+			if (run == 0U) {
+				stats->free_extents++;
+			}
+			run++;
+			stats->largest_free_extent = max(stats->largest_free_extent, run);
+		}
+	}
+	spinlock_release(&pool->spinlock);
+}
+
 void *memchr(const void *void_s, int c, size_t n)
 {
 	unsigned char val = (unsigned char)c;
@@ -7,6 +7,7 @@
 #include <asm/errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/uio.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include "sbuf.h"
@@ -46,29 +47,50 @@ int sbuf_get(shared_buf_t *sbuf, uint8_t *data)
 	return sbuf->ele_size;
 }
 
+/*
+ * Write all the elements available in sbuf to fd, straight from the mapped
+ * buffer, and release them to the producer with a single head update.
+ */
 int sbuf_write(int fd, shared_buf_t *sbuf)
 {
-	const void *start;
-	int written;
+	struct iovec iov[2];
+	uint32_t head, tail;
+	int iovcnt = 1;
+	ssize_t written, len;
 
 	if (sbuf == NULL)
 		return -EINVAL;
 
-	if (sbuf_is_empty(sbuf)) {
+	head = sbuf->head;
+	/* pairs with the producer publishing tail after filling records */
+	tail = __atomic_load_n(&sbuf->tail, __ATOMIC_ACQUIRE);
+	if (head == tail) {
 		return 0;
 	}
 
-	start = (void *)sbuf + SBUF_HEAD_SIZE + sbuf->head;
-        written = write(fd, start, sbuf->ele_size);
-	if (written != sbuf->ele_size) {
-		printf("Failed to write: ret %d (ele_size %d), errno %d\n",
-			written, sbuf->ele_size, (written == -1) ? errno : 0);
+	iov[0].iov_base = (void *)sbuf + SBUF_HEAD_SIZE + head;
+	if (tail > head) {
+		iov[0].iov_len = tail - head;
+	} else {
+		/* wraps around the end of the buffer */
+		iov[0].iov_len = sbuf->size - head;
+		iov[1].iov_base = (void *)sbuf + SBUF_HEAD_SIZE;
+		iov[1].iov_len = tail;
+		iovcnt = (tail != 0) ? 2 : 1;
+	}
+	len = iov[0].iov_len + ((iovcnt == 2) ? iov[1].iov_len : 0);
+
+	written = writev(fd, iov, iovcnt);
+	if (written != len) {
+		printf("Failed to write: ret %zd (len %zd), errno %d\n",
+			written, len, (written == -1) ? errno : 0);
 		return -1;
 	}
 
-	sbuf->head = sbuf_next_ptr(sbuf->head, sbuf->ele_size, sbuf->size);
+	/* the records are copied out before the producer may reuse them */
+	__atomic_store_n(&sbuf->head, tail, __ATOMIC_RELEASE);
 
-	return sbuf->ele_size;
+	return (int)len;
 }
 
 int sbuf_clear_buffered(shared_buf_t *sbuf)